@@ -8,32 +8,226 @@
  * Modifications by: Dan Challou, John Harwell
  *
  ******************************************************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "include/Matrix.h"
-#include <fstream>
+#include "include/gemm.h"
+#include "include/matrix_chain.h"
+#include "include/matrix_file.h"
+#include "include/simd.h"
+#include "include/sparse_matrix.h"
+#include "include/thread_pool.h"
 #include <iostream>
+#include <new>
+#include <sstream>
+#include <utility>
+#include <vector>
 
-/*!We define the Matrix class here. We create a two-dimensional float array.*/
-matrix::matrix(int rows_, int cols_) {
-  rows = rows_;
-  cols = cols_;
+/*! matrix_load gives each thread chunks of at least this many bytes. */
+static const size_t kMatrixReadChunk = 1 << 20;
 
-  data = new float *[rows];
+/*! Powers of ten that floats hold exactly. */
+static const float kExactPowersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f,
+                                          1e4f, 1e5f, 1e6f, 1e7f,
+                                          1e8f, 1e9f, 1e10f};
 
-  for (int i = 0; i < rows; i++) {
-    data[i] = new float[cols];
+/*! Transposes recurse until a block has at most kTransposeLeaf elements,
+    when the source and destination blocks fit in L1 together. Each task of
+    an out-of-place transpose takes kTransposeBand columns of the source. */
+static const int kTransposeLeaf = 32 * 32;
+static const int kTransposeBand = 64;
+
+/*! The banner that starts every Matrix Market file. */
+static const char kMatrixMarketBanner[] = "%%MatrixMarket";
+
+/*! isspace in the C locale, which is all matrix files use. */
+static bool IsSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+static bool IsDigit(char c) {
+  return static_cast<unsigned char>(c - '0') < 10;
+}
+
+/*! The contents of a file, mapped into memory when it is a regular file
+    and read into a buffer when it is not, as a pipe is not. */
+class MappedFile {
+ public:
+  MappedFile(void) : map_(NULL), size_(0) {}
+  ~MappedFile(void) {
+    if (map_ != NULL) munmap(map_, size_);
   }
+
+  bool Open(const std::string &filename, std::string *error) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      *error = "cannot open " + filename + ": " + strerror(errno);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        map_ = p;
+        size_ = st.st_size;
+        close(fd);
+        return true;
+      }
+    }
+    char buffer[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        *error = "cannot read " + filename + ": " + strerror(errno);
+        close(fd);
+        return false;
+      }
+      text_.append(buffer, n);
+    }
+    close(fd);
+    return true;
+  }
+
+  const char *begin(void) const {
+    return map_ != NULL ? static_cast<const char *>(map_) : text_.data();
+  }
+  const char *end(void) const {
+    return map_ != NULL ? begin() + size_ : text_.data() + text_.size();
+  }
+  bool mapped(void) const { return map_ != NULL; }
+
+  /*! Makes the mapping writable, privately, and hands it to the caller to
+      unmap. Returns NULL, keeping it, if it cannot be made writable. */
+  void *Release(size_t *bytes) {
+    if (map_ == NULL || mprotect(map_, size_, PROT_READ | PROT_WRITE) != 0) {
+      return NULL;
+    }
+    void *map = map_;
+    *bytes = size_;
+    map_ = NULL;
+    size_ = 0;
+    return map;
+  }
+
+ private:
+  MappedFile(const MappedFile &);
+
+  void *map_;
+  size_t size_;
+  std::string text_;
+};
+
+/*! The end of the word that starts at p. */
+static const char *SkipWord(const char *p, const char *end) {
+  while (p < end && !IsSpace(*p)) p++;
+  return p;
 }
 
-/*! These are the accessors for the rows and the columns of the matrix.*/
-int matrix::n_rows() { return rows; }
+static const char *SkipSpace(const char *p, const char *end) {
+  while (p < end && IsSpace(*p)) p++;
+  return p;
+}
 
-int matrix::n_cols() { return cols; }
+/*! Parses the word that starts at p as strtof would and returns its end, or
+    NULL if it is not a number. Decimals of at most 2^24 without their
+    point, scaled by at most 10^10, are converted with one exact multiply
+    or divide, which rounds correctly; anything else is handed to strtof. */
+static const char *ParseFloat(const char *p, const char *end, float *value) {
+  const char *word = p;
+  bool negative = p < end && *p == '-';
+  if (p < end && (*p == '-' || *p == '+')) p++;
+  const char *first_digit = p;
+  uint64_t mantissa = 0;
+  while (p < end && IsDigit(*p)) mantissa = mantissa * 10 + (*p++ - '0');
+  int digits = p - first_digit;
+  int scale = 0;
+  if (p < end && *p == '.') {
+    const char *point = p++;
+    while (p < end && IsDigit(*p)) mantissa = mantissa * 10 + (*p++ - '0');
+    scale = -static_cast<int>(p - point - 1);
+    digits -= scale;
+  }
+  if (digits > 0 && p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negative_exponent = q < end && *q == '-';
+    if (q < end && (*q == '-' || *q == '+')) q++;
+    const char *exponent_digits = q;
+    int exponent = 0;
+    while (q < end && IsDigit(*q) && q - exponent_digits < 4) {
+      exponent = exponent * 10 + (*q++ - '0');
+    }
+    if (q > exponent_digits) {
+      scale += negative_exponent ? -exponent : exponent;
+      p = q;
+    }
+  }
+  if (digits > 0 && digits <= 19 && mantissa <= (1 << 24) && scale >= -10 &&
+      scale <= 10 && (p == end || IsSpace(*p))) {
+    float f = static_cast<float>(mantissa);
+    f = scale >= 0 ? f * kExactPowersOfTen[scale]
+                   : f / kExactPowersOfTen[-scale];
+    *value = negative ? -f : f;
+    return p;
+  }
+
+  /* The file is not nul terminated, so strtof gets a copy of the word. */
+  const char *word_end = SkipWord(p, end);
+  std::string copy(word, word_end);
+  char *parsed_end;
+  *value = strtof(copy.c_str(), &parsed_end);
+  if (copy.empty() || parsed_end != copy.c_str() + copy.size()) return NULL;
+  return word_end;
+}
+
+/*! Parses the word that starts at p as a count of rows or columns. */
+static const char *ParseCount(const char *p, const char *end, int *count) {
+  const char *first = p;
+  long n = 0;
+  while (p < end && *p >= '0' && *p <= '9' && n <= INT32_MAX) {
+    n = n * 10 + (*p++ - '0');
+  }
+  if (p == first || n > INT32_MAX || (p < end && !IsSpace(*p))) return NULL;
+  *count = static_cast<int>(n);
+  return p;
+}
+
+/*! The number of words in [begin, end), where begin follows whitespace.
+    Words are counted 32 bytes at a time by an inner loop of fixed length,
+    which the compiler vectorizes. */
+static long CountWords(const char *begin, const char *end) {
+  if (begin == end) return 0;
+  long count = !IsSpace(*begin);
+  const char *p = begin + 1;
+  for (; end - p >= 32; p += 32) {
+    int starts = 0;
+    for (int k = 0; k < 32; k++) starts += IsSpace(p[k - 1]) & !IsSpace(p[k]);
+    count += starts;
+  }
+  for (; p < end; p++) count += IsSpace(p[-1]) & !IsSpace(p[0]);
+  return count;
+}
+
+/*! The number of the line that p is on, counting from 1. */
+static long LineOf(const char *begin, const char *p) {
+  long line = 1;
+  for (const char *q = begin; q < p; q++) line += (*q == '\n');
+  return line;
+}
 
-float *matrix::access(const int i, const int j) const { return &data[i][j]; }
 /*! Here we overload the print operator for the Matrix class */
-std::ostream &operator<<(std::ostream &os, matrix &m) {
+std::ostream &operator<<(std::ostream &os, const matrix &m) {
+  return os << matrix_view(m);
+}
+
+std::ostream &operator<<(std::ostream &os, const matrix_view &m) {
   os << m.n_rows() << " " << m.n_cols() << std::endl;
 
   for (int i = 0; i < m.n_rows(); i++) {
@@ -46,89 +240,759 @@ std::ostream &operator<<(std::ostream &os, matrix &m) {
   return os;
 }
 /*! We overload the assign operator and the multiplication operator here. */
-matrix operator*(matrix &a, matrix &b) {
-  // matrix R = *this;
-  int x = a.n_rows();
-  int z = b.n_cols();
-  if (b.n_rows() != a.n_cols()) {
-    std::cout << "matrices dimensionses not compatible" << std::endl;
+matrix operator*(const matrix &a, const matrix &b) {
+  return matrix_multiply(a, b);
+}
+/*! Storage of the right shape is reused; otherwise it is replaced. With
+    copy-on-write, m's storage is shared instead. */
+matrix &matrix::operator=(const matrix &m) {
+  if (this == &m) return (*this);
+  if (kMatrixCopyOnWrite) {
+    if (data != m.data) {
+      if (m.data) {
+        storage(m.data)->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+      release();
+      rows = m.rows;
+      cols = m.cols;
+      stride_ = m.stride_;
+      data = m.data;
+    }
+    sparse_ = m.sparse_;
+    return (*this);
+  }
+  if (rows != m.rows || cols != m.cols) {
+    release();
+    rows = m.rows;
+    cols = m.cols;
+    stride_ = m.stride_;
+    data = allocate(rows, stride_);
+  }
+  copy_from(m);
+  sparse_ = NULL;
+  if (m.sparse_ != NULL) copy_sparse(m.sparse_);
+  return (*this);
+}
+
+/*! Rows narrower than a cache line are packed, so that vectors do not take
+    sixteen times their size. Wider rows are padded to a whole number of
+    cache lines, plus one more when that would make the stride a multiple
+    of 4KB, which maps the same column of every row to the same cache set. */
+int matrix::padded_stride(int cols) {
+  const int line = kMatrixAlignment / sizeof(float);
+  if (cols < line) return cols;
+  int stride = (cols + line - 1) / line * line;
+  if (stride % (4096 / sizeof(float)) == 0) stride += line;
+  return stride;
+}
+
+/*! The Storage header takes the first cache line of the block, so the
+    elements after it stay aligned. */
+float *matrix::allocate(int rows, int stride) {
+  size_t bytes =
+      kMatrixAlignment + static_cast<size_t>(rows) * stride * sizeof(float);
+  size_t alignment = kMatrixAlignment;
+  if (bytes >= kMatrixHugePageBytes) {
+    alignment = kMatrixHugePageBytes;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+  }
+  void *p = NULL;
+  if (posix_memalign(&p, alignment, bytes) != 0) {
+    std::cout << "out of memory for a " << rows << " x " << stride
+              << " matrix" << std::endl;
     exit(1);
   }
-  int y = a.n_cols();
-  matrix *R = new matrix(x, z);  // new matrix made from a
-  for (int i = 0; i < x; i++) {
-    for (int j = 0; j < z; j++) {
-      // R[i][j] = 0;
-      *R->access(i, j) = 0;
-      for (int k = 0; k < y; k++) {
-        *R->access(i, j) += *a.access(i, k) * *b.access(k, j);
-      } /* for(k..) */
-    }   /* for(j..) */
-  }     /* for(i..) */
-  return (*R);
+#ifdef MADV_HUGEPAGE
+  if (alignment == kMatrixHugePageBytes) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+  Storage *header = new (p) Storage;
+  header->refs.store(1, std::memory_order_relaxed);
+  header->mapping = NULL;
+  header->mapping_bytes = 0;
+  header->sparse = NULL;
+  return reinterpret_cast<float *>(static_cast<char *>(p) + kMatrixAlignment);
+}
+/*! Splits [body, text_end) into chunks for the threads to parse, at line
+    ends where it can. Returns the start of every chunk and then
+    text_end. */
+static std::vector<const char *> SplitChunks(const char *body,
+                                             const char *text_end) {
+  int n_chunks = std::max<size_t>(1, (text_end - body) / kMatrixReadChunk);
+  std::vector<const char *> starts(n_chunks + 1, text_end);
+  starts[0] = body;
+  for (int c = 1; c < n_chunks; c++) {
+    const char *start =
+        std::max(body + (text_end - body) * c / n_chunks, starts[c - 1]);
+    const char *limit = body + (text_end - body) * (c + 1) / n_chunks;
+    const char *line_end = NULL;
+    if (start < limit) {
+      line_end = static_cast<const char *>(memchr(start, '\n', limit - start));
+    }
+    if (line_end != NULL) {
+      start = line_end + 1;
+    } else {
+      /* A line longer than a chunk: split it between words instead. */
+      while (start < text_end && !IsSpace(start[-1])) start++;
+    }
+    starts[c] = start;
+  }
+  return starts;
 }
-matrix matrix::operator=(const matrix &m) {
-  rows = m.rows;
-  cols = m.cols;
 
-  // matrix *temp = new matrix(rows, cols);
-  data = new float *[rows];
+/*! Parses the elements of a row x col matrix in [body, text_end) of text,
+    in row-major order, or in column-major order when column_major is set.
+    The numbers in each chunk are counted in parallel, which gives the
+    index of the first element of every chunk, and then parsed in
+    parallel. */
+static bool ParseElements(const std::string &filename, const char *text,
+                          const char *body, const char *text_end, int row,
+                          int col, bool column_major, matrix *m,
+                          std::string *error) {
+  std::vector<const char *> starts = SplitChunks(body, text_end);
+  const int n_chunks = starts.size() - 1;
+  std::vector<long> first(n_chunks + 1, 0);
+  parallel_for(0, n_chunks, 1, [&](int c) {
+    first[c + 1] = CountWords(starts[c], starts[c + 1]);
+  });
+  for (int c = 0; c < n_chunks; c++) first[c + 1] += first[c];
 
-  for (int i = 0; i < rows; i++) {
-    data[i] = new float[cols];
+  long size = static_cast<long>(row) * col;
+  if (first[n_chunks] != size) {
+    std::stringstream ss;
+    ss << filename << ": a " << row << " x " << col << " matrix has " << size
+       << " elements, but the file has " << first[n_chunks];
+    *error = ss.str();
+    return false;
   }
 
-  for (int j = 0; j < rows; j++) {
-    for (int k = 0; k < cols; k++) {
-      data[j][k] = *(m.access(j, k));
+  /* A column-major file is a row-major file of the transpose. */
+  if (column_major) std::swap(row, col);
+  matrix result(row, col);
+  std::vector<const char *> bad_word(n_chunks);
+  parallel_for(0, n_chunks, 1, [&](int c) {
+    if (first[c] == first[c + 1]) return;
+    const char *q = starts[c];
+    int i = static_cast<int>(first[c] / col);
+    int j = static_cast<int>(first[c] % col);
+    float *out = result.access(i, 0);
+    for (long k = first[c]; k < first[c + 1]; k++) {
+      while (IsSpace(*q)) q++;
+      const char *next = ParseFloat(q, text_end, out + j);
+      if (next == NULL) {
+        bad_word[c] = q;
+        return;
+      }
+      q = next;
+      if (++j == col && ++i < row) {
+        j = 0;
+        out = result.access(i, 0);
+      }
+    }
+  });
+  for (int c = 0; c < n_chunks; c++) {
+    if (bad_word[c] != NULL) {
+      std::stringstream ss;
+      ss << filename << ":" << LineOf(text, bad_word[c]) << ": "
+         << std::string(bad_word[c], SkipWord(bad_word[c], text_end))
+         << " is not a number";
+      *error = ss.str();
+      return false;
     }
   }
+  *m = column_major ? matrix_transpose(result) : std::move(result);
+  return true;
+}
 
-  return (*this);
+/*! A text matrix file holds the number of rows, the number of columns and
+    then the elements in row-major order, all separated by whitespace. */
+static bool ParseMatrixText(const std::string &filename, const char *text,
+                            const char *text_end, matrix *m,
+                            std::string *error) {
+  int row = 0;
+  int col = 0;
+  const char *p = ParseCount(SkipSpace(text, text_end), text_end, &row);
+  if (p != NULL) p = ParseCount(SkipSpace(p, text_end), text_end, &col);
+  if (p == NULL) {
+    *error = filename + ": does not start with the number of rows and "
+             "columns of a matrix";
+    return false;
+  }
+  return ParseElements(filename, text, p, text_end, row, col, false, m,
+                       error);
 }
-matrix matrix::matrix_read(std::string filename) {
-  int row;
-  int col;
-  std::ifstream fin;
-  fin.open(filename.c_str());
 
-  if (fin.fail()) {
-    std::cout << "Failed to open file : " << filename << std::endl;
-    exit(1);
+/*! The end of the line that p is on: its newline, or end. */
+static const char *LineEnd(const char *p, const char *end) {
+  const char *line_end = static_cast<const char *>(memchr(p, '\n', end - p));
+  return line_end != NULL ? line_end : end;
+}
+
+/*! The start of the line after the one p is on. */
+static const char *SkipLine(const char *p, const char *end) {
+  const char *line_end = LineEnd(p, end);
+  return line_end < end ? line_end + 1 : end;
+}
+
+/*! A Matrix Market file starts with the banner line
+
+      %%MatrixMarket matrix <format> <field> <symmetry>
+
+    and comment lines, which start with %. The next line holds the numbers
+    of rows and columns, and for the coordinate format the number of
+    entries, each of which follows as its row and column, counting from 1,
+    and its value, which pattern matrices leave out. Only the lower
+    triangle of a symmetric matrix is listed. The array format lists every
+    element in column-major order. Entries are parsed a chunk of lines per
+    thread; the matrix keeps the sparse form they make if it is sparse. */
+static bool ParseMatrixMarket(const std::string &filename, const char *text,
+                              const char *text_end, matrix *m,
+                              std::string *error) {
+  const char *banner_end = SkipLine(text, text_end);
+  std::stringstream banner(std::string(text, banner_end));
+  std::string words[5];
+  for (int k = 0; k < 5; k++) {
+    banner >> words[k];
+    for (unsigned c = 0; c < words[k].size(); c++) {
+      words[k][c] = tolower(static_cast<unsigned char>(words[k][c]));
+    }
+  }
+  const std::string &format = words[2];
+  const std::string &field = words[3];
+  const std::string &symmetry = words[4];
+  const bool coordinate = format == "coordinate";
+  const bool pattern = field == "pattern";
+  const bool symmetric = symmetry == "symmetric";
+  const bool skew = symmetry == "skew-symmetric";
+  if (words[1] != "matrix" || (!coordinate && format != "array") ||
+      (field != "real" && field != "integer" && !(pattern && coordinate)) ||
+      (symmetry != "general" && !(coordinate && (symmetric || skew)))) {
+    *error = filename + ": cannot read Matrix Market " + words[1] + " " +
+             format + " " + field + " " + symmetry + " files";
+    return false;
   }
 
-  if (fin.is_open()) {
-    fin >> row >> col;
-    matrix m = matrix(row, col);
-    for (int i = 0; i < m.n_rows(); i++) {
-      for (int j = 0; j < m.n_cols(); j++) {
-        fin >> *(m.access(i, j));
+  const char *p = SkipSpace(banner_end, text_end);
+  while (p < text_end && *p == '%') {
+    p = SkipSpace(SkipLine(p, text_end), text_end);
+  }
+  int rows = 0;
+  int cols = 0;
+  int entries = 0;
+  p = ParseCount(SkipSpace(p, text_end), text_end, &rows);
+  if (p != NULL) p = ParseCount(SkipSpace(p, text_end), text_end, &cols);
+  if (p != NULL && coordinate) {
+    p = ParseCount(SkipSpace(p, text_end), text_end, &entries);
+  }
+  if (p == NULL) {
+    *error = filename + ": has no Matrix Market size line";
+    return false;
+  }
+  if (!coordinate) {
+    if (!ParseElements(filename, text, p, text_end, rows, cols, true, m,
+                       error)) {
+      return false;
+    }
+    m->find_sparse();
+    return true;
+  }
+
+  std::vector<const char *> starts = SplitChunks(p, text_end);
+  const int n_chunks = starts.size() - 1;
+  std::vector<std::vector<sparse_entry> > chunk_entries(n_chunks);
+  std::vector<long> listed(n_chunks + 1, 0);
+  std::vector<const char *> bad_entry(n_chunks);
+  parallel_for(0, n_chunks, 1, [&](int c) {
+    const char *end = starts[c + 1];
+    for (const char *q = SkipSpace(starts[c], end); q < end;
+         q = SkipSpace(q, end)) {
+      sparse_entry e = {0, 0, 1.0f};
+      const char *next = ParseCount(q, end, &e.row);
+      if (next != NULL) next = ParseCount(SkipSpace(next, end), end, &e.col);
+      if (next != NULL && !pattern) {
+        next = ParseFloat(SkipSpace(next, end), end, &e.value);
       }
+      if (next == NULL || e.row < 1 || e.row > rows || e.col < 1 ||
+          e.col > cols) {
+        bad_entry[c] = q;
+        return;
+      }
+      e.row--;
+      e.col--;
+      chunk_entries[c].push_back(e);
+      listed[c + 1]++;
+      if ((symmetric || skew) && e.row != e.col) {
+        std::swap(e.row, e.col);
+        if (skew) e.value = -e.value;
+        chunk_entries[c].push_back(e);
+      }
+      q = next;
+    }
+  });
+  for (int c = 0; c < n_chunks; c++) {
+    if (bad_entry[c] != NULL) {
+      std::stringstream ss;
+      ss << filename << ":" << LineOf(text, bad_entry[c]) << ": "
+         << std::string(bad_entry[c], LineEnd(bad_entry[c], text_end))
+         << " is not an entry of a " << rows << " x " << cols << " matrix";
+      *error = ss.str();
+      return false;
     }
+  }
 
-    fin.close();
-    return m;
+  std::vector<sparse_entry> all;
+  for (int c = 0; c < n_chunks; c++) {
+    all.insert(all.end(), chunk_entries[c].begin(), chunk_entries[c].end());
+    listed[c + 1] += listed[c];
+  }
+  if (listed[n_chunks] != entries) {
+    std::stringstream ss;
+    ss << filename << ": the size line gives " << entries
+       << " entries, but the file has " << listed[n_chunks];
+    *error = ss.str();
+    return false;
+  }
+  sparse_matrix sparse(rows, cols, all);
+  *m = sparse.dense();
+  if (sparse.is_sparse()) m->set_sparse(std::move(sparse));
+  return true;
+}
 
-  } else {
-    std::cout << "READ FAIL" << std::endl;
+/*! A binary file is used as the matrix's storage when it is mapped and
+    laid out as this runtime lays out storage; otherwise its rows are
+    copied. The mapping is private, so writes to the matrix never reach
+    the file. matrix_save replaces files rather than overwriting them, so
+    the file a matrix is mapped from is not truncated under it. */
+bool matrix::matrix_load(const std::string &filename, matrix *m,
+                         std::string *error) {
+  MappedFile file;
+  if (!file.Open(filename, error)) return false;
+  size_t size = file.end() - file.begin();
+  const size_t banner = sizeof(kMatrixMarketBanner) - 1;
+  if (size >= banner &&
+      strncasecmp(file.begin(), kMatrixMarketBanner, banner) == 0) {
+    return ParseMatrixMarket(filename, file.begin(), file.end(), m, error);
+  }
+  if (size < sizeof(MatrixFileHeader) ||
+      memcmp(file.begin(), kMatrixFileMagic, sizeof(kMatrixFileMagic)) != 0) {
+    if (!ParseMatrixText(filename, file.begin(), file.end(), m, error)) {
+      return false;
+    }
+    m->find_sparse();
+    return true;
+  }
+
+  MatrixFileHeader header;
+  memcpy(&header, file.begin(), sizeof(header));
+  if (!CheckMatrixFileHeader(filename, header, size, error)) return false;
+
+  int rows = header.rows;
+  int cols = header.cols;
+  size_t bytes;
+  if (file.mapped() && header.data_offset % kMatrixAlignment == 0 &&
+      static_cast<int>(header.stride) == padded_stride(cols)) {
+    char *base = static_cast<char *>(file.Release(&bytes));
+    if (base != NULL) {
+      matrix result;
+      result.rows = rows;
+      result.cols = cols;
+      result.stride_ = header.stride;
+      result.data = reinterpret_cast<float *>(base + header.data_offset);
+      Storage *s = new (storage(result.data)) Storage;
+      s->refs.store(1, std::memory_order_relaxed);
+      s->mapping = base;
+      s->mapping_bytes = bytes;
+      s->sparse = NULL;
+      result.find_sparse();
+      *m = std::move(result);
+      return true;
+    }
+  }
+  const float *elements =
+      reinterpret_cast<const float *>(file.begin() + header.data_offset);
+  matrix result(rows, cols);
+  parallel_for(0, rows, parallel_grain(cols), [&](int i) {
+    memcpy(result.access(i, 0),
+           elements + static_cast<size_t>(i) * header.stride,
+           cols * sizeof(float));
+  });
+  result.find_sparse();
+  *m = std::move(result);
+  return true;
+}
+
+matrix matrix::matrix_read(std::string filename) {
+  matrix m;
+  std::string error;
+  if (!matrix_load(filename, &m, &error)) {
+    std::cout << error << std::endl;
+    exit(1);
+  }
+  return m;
+}
+
+/*! The file is written next to filename and renamed over it, so a reader
+    never sees part of a matrix and a matrix mapped from the old file keeps
+    its storage. The padding of every row is written as zeros. */
+bool matrix::matrix_save(const matrix_view &m, const std::string &filename,
+                         std::string *error) {
+  MatrixFileHeader header;
+  InitMatrixFileHeader(m.n_rows(), m.n_cols(), &header);
+
+  std::stringstream temp;
+  temp << filename << ".tmp" << getpid();
+  FILE *out = fopen(temp.str().c_str(), "wbx");
+  if (out == NULL) {
+    *error = "cannot write " + filename + ": " + strerror(errno);
+    return false;
+  }
+  std::vector<float> row(header.stride, 0.0f);
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  for (int i = 0; ok && i < m.n_rows(); i++) {
+    memcpy(row.data(), m.access(i, 0), m.n_cols() * sizeof(float));
+    ok = fwrite(row.data(), sizeof(float), row.size(), out) == row.size();
+  }
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(temp.str().c_str(), filename.c_str()) != 0) {
+    *error = "cannot write " + filename + ": " + strerror(errno);
+    remove(temp.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+void matrix::matrix_write(const matrix_view &m, std::string filename) {
+  std::string error;
+  if (!matrix_save(m, filename, &error)) {
+    std::cout << error << std::endl;
     exit(1);
   }
 }
 
-/* Here we define the constructor for the Matrix class. */
-matrix::matrix(const matrix &m) {
-  rows = m.rows;
-  cols = m.cols;
+void matrix::unmap(Storage *s) { munmap(s->mapping, s->mapping_bytes); }
 
-  data = new float *[rows];
+void matrix::delete_sparse(Storage *s) { delete s->sparse; }
 
-  for (int i = 0; i < rows; i++) {
-    data[i] = new float[cols];
+void matrix::copy_sparse(const sparse_matrix *s) {
+  set_sparse(sparse_matrix(*s));
+}
+
+/*! Storage shared with other matrices that already has a sparse form may
+    have been written before it was shared, and its form may be another
+    matrix's, so it is left without one. */
+void matrix::set_sparse(sparse_matrix &&s) {
+  if (data == NULL) return;
+  Storage *header = storage(data);
+  if (header->sparse != NULL) {
+    if (header->refs.load(std::memory_order_acquire) != 1) return;
+    delete header->sparse;
+  }
+  header->sparse = new sparse_matrix(std::move(s));
+  sparse_ = header->sparse;
+}
+
+/*! The rows are counted in parallel, and each stops once the count has
+    passed the most nonzeros a sparse matrix can have, so little of a
+    dense matrix is read. */
+void matrix::find_sparse() {
+  if (sparse_ != NULL || !IsSparse(rows, cols, 0)) return;
+  const double most = kSparseDensity * rows * cols;
+  std::atomic<size_t> nonzeros(0);
+  parallel_for(0, rows, parallel_grain(cols), [&](int i) {
+    if (nonzeros.load(std::memory_order_relaxed) > most) return;
+    const float *row = data + static_cast<size_t>(i) * stride_;
+    size_t count = 0;
+    for (int j = 0; j < cols; j++) count += row[j] != 0;
+    nonzeros.fetch_add(count, std::memory_order_relaxed);
+  });
+  if (IsSparse(rows, cols, nonzeros.load())) {
+    set_sparse(sparse_matrix(matrix_view(*this)));
+  }
+}
+
+/*! General matrix-matrix product. The product of two sparse matrices that
+    adds up few enough terms to be sparse itself is computed in sparse
+    form and keeps it, so a chain of sparse products stays sparse. */
+matrix matrix_multiply(const matrix_view &a, const matrix_view &b) {
+  if (a.sparse() != NULL && b.sparse() != NULL &&
+      a.n_cols() == b.n_rows() &&
+      IsSparse(a.n_rows(), b.n_cols(),
+               sparse_multiply_terms(*a.sparse(), *b.sparse()))) {
+    sparse_matrix product = sparse_multiply(*a.sparse(), *b.sparse());
+    matrix R = product.dense();
+    R.set_sparse(std::move(product));
+    return R;
+  }
+  matrix R(a.n_rows(), b.n_cols());
+  matrix_gemm(a, false, b, false, 0, R);
+  return R;
+}
+
+void matrix_gemm(const matrix_view &a, bool transpose_a,
+                 const matrix_view &b, bool transpose_b, float beta,
+                 const matrix_block &c) {
+  int m = transpose_a ? a.n_cols() : a.n_rows();
+  int k = transpose_a ? a.n_rows() : a.n_cols();
+  int n = transpose_b ? b.n_rows() : b.n_cols();
+  int b_rows = transpose_b ? b.n_cols() : b.n_rows();
+  if (b_rows != k || c.n_rows() != m || c.n_cols() != n) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  if (a.sparse() != NULL || b.sparse() != NULL) {
+    sparse_gemm(a, transpose_a, b, transpose_b, beta, c);
+    return;
+  }
+  gemm(m, n, k, a.access(0, 0), a.stride(), transpose_a, b.access(0, 0),
+       b.stride(), transpose_b, beta, c.access(0, 0), c.stride());
+}
+
+matrix matrix_multiply_add(const matrix_view &a, const matrix_view &b,
+                           const matrix_view &c) {
+  matrix R(c);
+  matrix_gemm(a, false, b, false, 1, R);
+  return R;
+}
+
+/*! Product of a matrix and a column vector (a matrix with one column). Each
+    result element is a dot product of a row of a with v. */
+matrix matrix_vector_multiply(const matrix_view &a, const matrix_view &v) {
+  if (v.n_rows() != a.n_cols() || v.n_cols() != 1) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  if (a.sparse() != NULL) return sparse_vector_multiply(*a.sparse(), v);
+  matrix R(a.n_rows(), 1);
+  parallel_for(0, a.n_rows(), parallel_grain(a.n_cols()), [&](int i) {
+    const float *row = a.access(i, 0);
+    float sum = 0;
+    for (int k = 0; k < a.n_cols(); k++) {
+      sum += row[k] * *v.access(k, 0);
+    }
+    *R.access(i, 0) = sum;
+  });
+  return R;
+}
+
+/*! a b, with the kernel for a column vector b when it is one, as in the
+    generated code. */
+static matrix ChainMultiply(const matrix_view &a, const matrix_view &b) {
+  return b.n_cols() == 1 ? matrix_vector_multiply(a, b)
+                         : matrix_multiply(a, b);
+}
+
+/*! The product of factors i to j, for i < j, in the order split, from
+    ChainOrder. A single factor is multiplied in place. */
+static matrix ChainProduct(const std::vector<matrix_view> &factors,
+                           const std::vector<int> &split, int i, int j) {
+  const int s = split[i * factors.size() + j];
+  if (s == i && s + 1 == j) return ChainMultiply(factors[i], factors[j]);
+  if (s == i) {
+    return ChainMultiply(factors[i], ChainProduct(factors, split, s + 1, j));
+  }
+  if (s + 1 == j) {
+    return ChainMultiply(ChainProduct(factors, split, i, s), factors[j]);
+  }
+  return ChainMultiply(ChainProduct(factors, split, i, s),
+                       ChainProduct(factors, split, s + 1, j));
+}
+
+matrix matrix_multiply_chain(const std::vector<matrix_view> &factors) {
+  std::vector<int> dims(1, factors[0].n_rows());
+  for (size_t i = 0; i < factors.size(); i++) {
+    if (factors[i].n_rows() != dims.back()) {
+      std::cout << "matrices dimensionses not compatible" << std::endl;
+      exit(1);
+    }
+    dims.push_back(factors[i].n_cols());
+  }
+  return ChainProduct(factors, ChainOrder(dims), 0, factors.size() - 1);
+}
+
+/*! Copies the transpose of the rows x cols block at src to dst, halving
+    the longer side until the block is small. Whatever the cache sizes,
+    some level of the recursion has blocks that fit each of them. */
+static void TransposeBlock(const float *src, int lds, float *dst, int ldd,
+                           int rows, int cols) {
+  if (rows * cols <= kTransposeLeaf) {
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        dst[static_cast<size_t>(j) * ldd + i] =
+            src[static_cast<size_t>(i) * lds + j];
+      }
+    }
+  } else if (rows >= cols) {
+    int half = rows / 2;
+    TransposeBlock(src, lds, dst, ldd, half, cols);
+    TransposeBlock(src + static_cast<size_t>(half) * lds, lds, dst + half,
+                   ldd, rows - half, cols);
+  } else {
+    int half = cols / 2;
+    TransposeBlock(src, lds, dst, ldd, rows, half);
+    TransposeBlock(src + half, lds, dst + static_cast<size_t>(half) * ldd,
+                   ldd, rows, cols - half);
+  }
+}
+
+/*! Swaps the rows x cols block at a with the transpose of the cols x rows
+    block at b, recursing the same way. */
+static void TransposeSwap(float *a, float *b, int ld, int rows, int cols) {
+  if (rows * cols <= kTransposeLeaf) {
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        std::swap(a[static_cast<size_t>(i) * ld + j],
+                  b[static_cast<size_t>(j) * ld + i]);
+      }
+    }
+  } else if (rows >= cols) {
+    int half = rows / 2;
+    TransposeSwap(a, b, ld, half, cols);
+    TransposeSwap(a + static_cast<size_t>(half) * ld, b + half, ld,
+                  rows - half, cols);
+  } else {
+    int half = cols / 2;
+    TransposeSwap(a, b, ld, rows, half);
+    TransposeSwap(a + half, b + static_cast<size_t>(half) * ld, ld, rows,
+                  cols - half);
   }
+}
 
-  for (int j = 0; j < rows; j++) {
-    for (int k = 0; k < cols; k++) {
-      data[j][k] = *(m.access(j, k));
+/*! Transposes the n x n block at a in place: the diagonal blocks of each
+    halving in place, the blocks off the diagonal into each other. */
+static void TransposeSquare(float *a, int ld, int n) {
+  if (n * n <= kTransposeLeaf) {
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < i; j++) {
+        std::swap(a[static_cast<size_t>(i) * ld + j],
+                  a[static_cast<size_t>(j) * ld + i]);
+      }
     }
+    return;
   }
+  int half = n / 2;
+  float *lower = a + static_cast<size_t>(half) * ld;
+  TransposeSquare(a, ld, half);
+  TransposeSquare(lower + half, ld, n - half);
+  TransposeSwap(a + half, lower, ld, half, n - half);
+}
+
+matrix matrix_transpose(const matrix_view &a) {
+  matrix R(a.n_cols(), a.n_rows());
+  matrix_transpose_into(a, R);
+  return R;
+}
+
+/*! Each task transposes a band of columns of a into a band of rows of r,
+    so no two tasks write the same cache line. */
+void matrix_transpose_into(const matrix_view &a, const matrix_block &r) {
+  if (r.n_rows() != a.n_cols() || r.n_cols() != a.n_rows()) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  int bands = (a.n_cols() + kTransposeBand - 1) / kTransposeBand;
+  parallel_for(0, bands, 1, [&](int band) {
+    int j = band * kTransposeBand;
+    TransposeBlock(a.access(0, j), a.stride(), r.access(j, 0), r.stride(),
+                   a.n_rows(), std::min(kTransposeBand, a.n_cols() - j));
+  });
+}
+
+void matrix_transpose_in_place(const matrix_block &m) {
+  if (m.n_rows() != m.n_cols()) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  TransposeSquare(m.access(0, 0), m.stride(), m.n_rows());
+}
+
+/*! Rows are copied with memmove, first to last when dst starts before
+    src and last to first otherwise, so each row is read before it is
+    overwritten. */
+void matrix_copy(const matrix_view &src, const matrix_block &dst) {
+  if (src.n_rows() != dst.n_rows() || src.n_cols() != dst.n_cols()) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  const int rows = src.n_rows();
+  const bool forward = dst.access(0, 0) <= src.access(0, 0);
+  for (int k = 0; k < rows; k++) {
+    int i = forward ? k : rows - 1 - k;
+    memmove(dst.access(i, 0), src.access(i, 0), src.n_cols() * sizeof(float));
+  }
+}
+
+/*! Elementwise kernels work a row at a time, so they never touch the
+    padding at the end of each row. */
+static matrix Zip(const matrix_view &a, const matrix_view &b,
+                  ZipKernel kernel) {
+  if (a.n_rows() != b.n_rows() || a.n_cols() != b.n_cols()) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  matrix R(a.n_rows(), a.n_cols());
+  parallel_for(0, a.n_rows(), parallel_grain(a.n_cols()), [&](int i) {
+    kernel(R.access(i, 0), a.access(i, 0), b.access(i, 0), a.n_cols());
+  });
+  return R;
+}
+
+static matrix Broadcast(const matrix_view &a, float s,
+                        BroadcastKernel kernel) {
+  matrix R(a.n_rows(), a.n_cols());
+  parallel_for(0, a.n_rows(), parallel_grain(a.n_cols()), [&](int i) {
+    kernel(R.access(i, 0), a.access(i, 0), a.n_cols(), s);
+  });
+  return R;
+}
+
+static matrix Map(const matrix_view &a, MapKernel kernel) {
+  matrix R(a.n_rows(), a.n_cols());
+  parallel_for(0, a.n_rows(), parallel_grain(a.n_cols()), [&](int i) {
+    kernel(R.access(i, 0), a.access(i, 0), a.n_cols());
+  });
+  return R;
+}
+
+matrix matrix_add(const matrix_view &a, const matrix_view &b) {
+  return Zip(a, b, simd_kernels().add);
+}
+
+matrix matrix_subtract(const matrix_view &a, const matrix_view &b) {
+  return Zip(a, b, simd_kernels().subtract);
+}
+
+matrix matrix_hadamard(const matrix_view &a, const matrix_view &b) {
+  return Zip(a, b, simd_kernels().multiply);
+}
+
+matrix matrix_add_scalar(const matrix_view &a, float s) {
+  return Broadcast(a, s, simd_kernels().shift);
+}
+
+/*! x - s and x + -s round the same way. */
+matrix matrix_subtract_scalar(const matrix_view &a, float s) {
+  return Broadcast(a, -s, simd_kernels().shift);
+}
+
+matrix matrix_scale(const matrix_view &a, float s) {
+  return Broadcast(a, s, simd_kernels().scale);
+}
+
+matrix matrix_divide_scalar(const matrix_view &a, float s) {
+  return Broadcast(a, s, simd_kernels().divide);
+}
+
+matrix matrix_subtract_from(const matrix_view &a, float s) {
+  return Broadcast(a, s, simd_kernels().subtract_from);
+}
+
+matrix matrix_sqrt(const matrix_view &a) { return Map(a, simd_kernels().sqrt); }
+matrix matrix_exp(const matrix_view &a) { return Map(a, simd_kernels().exp); }
+matrix matrix_log(const matrix_view &a) { return Map(a, simd_kernels().log); }
+matrix matrix_sin(const matrix_view &a) { return Map(a, simd_kernels().sin); }
+matrix matrix_cos(const matrix_view &a) { return Map(a, simd_kernels().cos); }
+matrix matrix_tan(const matrix_view &a) { return Map(a, simd_kernels().tan); }
+matrix matrix_fabs(const matrix_view &a) { return Map(a, simd_kernels().fabs); }
+matrix matrix_floor(const matrix_view &a) {
+  return Map(a, simd_kernels().floor);
 }
+matrix matrix_ceil(const matrix_view &a) { return Map(a, simd_kernels().ceil); }
@@ -12,39 +12,450 @@
 #define PROJECT_INCLUDE_MATRIX_H
 
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <utility>
+#include <vector>
 
-/*! The Matrix class is declared here. It is composed of two ints defining the dimensions. We have a constructor and a copy constructor.  */
+/*! Identifies the runtime that generated programs are linked against. Bump
+    it whenever a change to the runtime should invalidate executables built
+    against the old one. */
+#define FCAL_RUNTIME_VERSION "fcalrt-9"
+
+/*! Matrix storage is aligned to a cache line, which is also the widest
+    vector register. Storage of at least kMatrixHugePageBytes is aligned to
+    a huge page and the kernel is asked to back it with huge pages. */
+const int kMatrixAlignment = 64;
+const size_t kMatrixHugePageBytes = 2 << 20;
+
+/*! Copy-on-write storage. When FCAL_MATRIX_COW is defined, for the runtime
+    and the program alike, copying a matrix shares its storage, counting
+    the references to it, and a matrix copies the storage only when it is
+    first written while shared. Otherwise every copy is deep. */
+#ifdef FCAL_MATRIX_COW
+const bool kMatrixCopyOnWrite = true;
+#else
+const bool kMatrixCopyOnWrite = false;
+#endif
+
+class matrix_view;
+class matrix_block;
+class sparse_matrix;
+
+/*! The Matrix class is declared here. It is composed of two ints defining the dimensions. It owns its storage: copies are deep, moves transfer the storage and leave an empty 0 x 0 matrix behind, and the destructor frees it.
+
+    Everything a generated program calls inside its loops is defined inline
+    below, so that m[i:j] in a loop compiles down to pointer arithmetic. */
 class matrix {
  public:
+  /*! Every block of storage starts with this, in the cache line before
+      the elements. The storage of a matrix read from a binary file is the
+      file, mapped privately: mapping is the start of the mapping and
+      mapping_bytes its length. Both are 0 for storage from allocate.
+      sparse is the sparse form of the elements, or NULL; the storage owns
+      it, so views of the matrix may keep it until the storage goes. */
+  struct Storage {
+    std::atomic<int> refs;
+    void *mapping;
+    size_t mapping_bytes;
+    sparse_matrix *sparse;
+  };
+
   matrix(int i, int j);
   matrix(const matrix &m);
+  matrix(matrix &&m) noexcept;
+  /*! A copy of the elements of v. */
+  explicit matrix(const matrix_view &v);
+  ~matrix();
 
-  int n_rows();
-  int n_cols();
+  int n_rows() const;
+  int n_cols() const;
 
-  float *access(const int i, const int j) const;
-  friend std::ostream &operator<<(std::ostream &os, matrix &m);
-  friend matrix operator*(matrix &a, matrix &b);  // got rid of friend keyword
-  matrix operator=(
+  /*! Distance in floats between the starts of consecutive rows. */
+  int stride() const;
+  /*! The address of element [i:j]. Through a non-const matrix it is
+      writable, so the storage is unshared first and the sparse form is
+      forgotten. */
+  float *access(const int i, const int j);
+  const float *access(const int i, const int j) const;
+  float at(const int i, const int j) const;
+  /*! Sets every element to value. */
+  void fill(float value);
+  /*! Makes the storage this matrix's alone, copying it if it is shared,
+      and forgets the sparse form. Threads may then write different
+      elements of the matrix at once. */
+  void unshare();
+  /*! The nonzero elements of this matrix, when it is sparse and has not
+      been written since that was found; NULL otherwise. Products of a
+      matrix with a sparse form multiply only its nonzeros. */
+  const sparse_matrix *sparse() const;
+  /*! Counts the nonzero elements and, if the matrix is sparse, keeps them
+      as its sparse form. The count stops as soon as there are too many. */
+  void find_sparse();
+  /*! Keeps s, which must have the elements of this matrix, as its sparse
+      form. */
+  void set_sparse(sparse_matrix &&s);
+  /*! Rows first_row to last_row and columns first_col to last_col of this
+      matrix, inclusive, as in m[r0 .. r1 : c0 .. c1], without copying
+      them. A slice may be empty, when last is first - 1. */
+  matrix_view view(int first_row, int last_row, int first_col,
+                   int last_col) const;
+  matrix_block block(int first_row, int last_row, int first_col,
+                     int last_col);
+  friend std::ostream &operator<<(std::ostream &os, const matrix &m);
+  friend matrix operator*(const matrix &a, const matrix &b);
+  matrix &operator=(
       const matrix &m);  //, const matrix &m2); //got rid of friend keyword
+  matrix &operator=(matrix &&m) noexcept;
+  /*! Reads the matrix in filename, a text, binary or Matrix Market
+      matrix file, into *m. A sparse matrix keeps its sparse form. If the
+      file cannot be read or does not hold a matrix, returns false and
+      says why in *error. */
+  static bool matrix_load(const std::string &filename, matrix *m,
+                          std::string *error);
+  /*! matrix_load for compiled programs, which stop on errors. */
   static matrix matrix_read(std::string filename);
+  /*! Writes m to filename as a binary matrix file, replacing the file
+      only once it is complete. Returns false and says why in *error if
+      it cannot. */
+  static bool matrix_save(const matrix_view &m, const std::string &filename,
+                          std::string *error);
+  /*! matrix_save for compiled programs, which stop on errors. */
+  static void matrix_write(const matrix_view &m, std::string filename);
+  /*! The stride of the rows of a matrix with cols columns. */
+  static int padded_stride(int cols);
 
  private:
-  matrix() {}
+  matrix() : rows(0), cols(0), stride_(0), data(NULL), sparse_(NULL) {}
   int rows;
   int cols;
 
-  /* Your implementation of "data" may vary.  There are ways in
-     which data can be an array of arrays and thus simplify the
-     access method, at the cost of complicating the process of
-     allocating space for data.  The choice is entirely up to
-     you. */
+  /*! The elements are stored row-major in a single block aligned to
+      kMatrixAlignment. Rows are padded to a stride that keeps each one
+      aligned; the padding is not part of the matrix and is left
+      uninitialized. */
+  int stride_;
+  float *data;
+  /*! The sparse form, owned by the storage, which is only the matrix's
+      while this is set: writing a matrix clears it. */
+  const sparse_matrix *sparse_;
+
+  static float *allocate(int rows, int stride);
+  static Storage *storage(float *data);
+  static void unmap(Storage *s);
+  static void delete_sparse(Storage *s);
+  void release();
+  void copy_from(const matrix &m);
+  void copy_sparse(const sparse_matrix *s);
+};
+
+/*! A block of a matrix, read where it is stored. The matrix must outlive
+    the view and keep its storage while the view is in use. A matrix
+    converts to a view of all of it, so the kernels below take views and
+    run on blocks without copying them. A view of a whole matrix carries
+    the matrix's sparse form. */
+class matrix_view {
+ public:
+  matrix_view(const matrix &m)
+      : data_(m.access(0, 0)),
+        rows_(m.n_rows()),
+        cols_(m.n_cols()),
+        stride_(m.stride()),
+        sparse_(m.sparse()) {}
+  matrix_view(const float *data, int rows, int cols, int stride)
+      : data_(data),
+        rows_(rows),
+        cols_(cols),
+        stride_(stride),
+        sparse_(NULL) {}
+
+  int n_rows() const { return rows_; }
+  int n_cols() const { return cols_; }
+  int stride() const { return stride_; }
+  const sparse_matrix *sparse() const { return sparse_; }
+  const float *access(const int i, const int j) const {
+    return data_ + static_cast<size_t>(i) * stride_ + j;
+  }
+  float at(const int i, const int j) const { return *access(i, j); }
+  /*! Whether some element of v might also be an element of this view:
+      whether the memory the two span overlaps. */
+  bool overlaps(const matrix_view &v) const;
+  friend std::ostream &operator<<(std::ostream &os, const matrix_view &m);
+
+ private:
+  const float *data_;
+  int rows_;
+  int cols_;
+  int stride_;
+  const sparse_matrix *sparse_;
+};
+
+/*! A block of a matrix that can be written, from matrix::block, which
+    unshares the storage first. */
+class matrix_block {
+ public:
+  matrix_block(matrix &m)
+      : data_(m.access(0, 0)),
+        rows_(m.n_rows()),
+        cols_(m.n_cols()),
+        stride_(m.stride()) {}
+  matrix_block(float *data, int rows, int cols, int stride)
+      : data_(data), rows_(rows), cols_(cols), stride_(stride) {}
+
+  int n_rows() const { return rows_; }
+  int n_cols() const { return cols_; }
+  int stride() const { return stride_; }
+  float *access(const int i, const int j) const {
+    return data_ + static_cast<size_t>(i) * stride_ + j;
+  }
+  operator matrix_view() const {
+    return matrix_view(data_, rows_, cols_, stride_);
+  }
 
-     /*! We implemented data as a double pointer. */
-  float **data;
+ private:
+  float *data_;
+  int rows_;
+  int cols_;
+  int stride_;
 };
 
+/*! Specialized kernels. The code generator calls these directly when the
+    type checker knows the operand types of an arithmetic operator. They are
+    built into libfcalrt, where they use the vector kernels of simd.h and
+    spread the rows of the result over the thread pool. Products with a
+    sparse factor use the kernels of sparse_matrix.h instead. */
+matrix matrix_multiply(const matrix_view &a, const matrix_view &b);
+matrix matrix_vector_multiply(const matrix_view &a, const matrix_view &v);
+
+/*! a b + c as one product that accumulates into a copy of c. */
+matrix matrix_multiply_add(const matrix_view &a, const matrix_view &b,
+                           const matrix_view &c);
+
+/*! The product of a chain of factors, of three or more matrices whose
+    shapes are not known when the program is compiled. Once the shapes are
+    checked, the factors are multiplied in the order of matrix_chain.h that
+    multiplies the fewest elements, which for skewed shapes, such as a chain
+    that ends in a column vector, is far cheaper than left to right. */
+matrix matrix_multiply_chain(const std::vector<matrix_view> &factors);
+
+/*! c = op(a) op(b) + beta c, where op transposes its matrix when the flag
+    is set by reading it in the other order, without moving it. c must have
+    the shape of the product and not overlap a or b. */
+void matrix_gemm(const matrix_view &a, bool transpose_a,
+                 const matrix_view &b, bool transpose_b, float beta,
+                 const matrix_block &c);
+
+/*! The transpose of a, by a cache-oblivious blocked copy, as a new matrix
+    or into r, which must not overlap a. A square block is transposed in
+    place without a second matrix. */
+matrix matrix_transpose(const matrix_view &a);
+void matrix_transpose_into(const matrix_view &a, const matrix_block &r);
+void matrix_transpose_in_place(const matrix_block &m);
+
+/*! Copies src into dst, which must be the same shape. They may overlap. */
+void matrix_copy(const matrix_view &src, const matrix_block &dst);
+
+/*! Elementwise a + b, a - b and a .* b; a and b must be the same shape. */
+matrix matrix_add(const matrix_view &a, const matrix_view &b);
+matrix matrix_subtract(const matrix_view &a, const matrix_view &b);
+matrix matrix_hadamard(const matrix_view &a, const matrix_view &b);
+
+/*! s applied to every element: a + s, a - s, a * s, a / s and s - a. */
+matrix matrix_add_scalar(const matrix_view &a, float s);
+matrix matrix_subtract_scalar(const matrix_view &a, float s);
+matrix matrix_scale(const matrix_view &a, float s);
+matrix matrix_divide_scalar(const matrix_view &a, float s);
+matrix matrix_subtract_from(const matrix_view &a, float s);
+
+/*! A math.h function of every element, one for each of kMathFunctions. */
+matrix matrix_sqrt(const matrix_view &a);
+matrix matrix_exp(const matrix_view &a);
+matrix matrix_log(const matrix_view &a);
+matrix matrix_sin(const matrix_view &a);
+matrix matrix_cos(const matrix_view &a);
+matrix matrix_tan(const matrix_view &a);
+matrix matrix_fabs(const matrix_view &a);
+matrix matrix_floor(const matrix_view &a);
+matrix matrix_ceil(const matrix_view &a);
+
+/*! Inline definitions. */
+inline matrix::matrix(int i, int j)
+    : rows(i), cols(j), stride_(padded_stride(j)), sparse_(NULL) {
+  data = allocate(rows, stride_);
+}
+
+/*! A deep copy copies the sparse form too; a shared one shares it with
+    the storage. */
+inline matrix::matrix(const matrix &m)
+    : rows(m.rows), cols(m.cols), stride_(m.stride_), sparse_(NULL) {
+  if (kMatrixCopyOnWrite) {
+    data = m.data;
+    sparse_ = m.sparse_;
+    if (data) storage(data)->refs.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  data = allocate(rows, stride_);
+  copy_from(m);
+  if (m.sparse_ != NULL) copy_sparse(m.sparse_);
+}
+
+inline matrix::matrix(const matrix_view &v)
+    : rows(v.n_rows()),
+      cols(v.n_cols()),
+      stride_(padded_stride(v.n_cols())),
+      sparse_(NULL) {
+  data = allocate(rows, stride_);
+  for (int r = 0; r < rows; r++) {
+    memcpy(data + static_cast<size_t>(r) * stride_, v.access(r, 0),
+           cols * sizeof(float));
+  }
+  if (v.sparse() != NULL) copy_sparse(v.sparse());
+}
+
+inline matrix::matrix(matrix &&m) noexcept
+    : rows(m.rows),
+      cols(m.cols),
+      stride_(m.stride_),
+      data(m.data),
+      sparse_(m.sparse_) {
+  m.rows = m.cols = m.stride_ = 0;
+  m.data = NULL;
+  m.sparse_ = NULL;
+}
+
+inline matrix::~matrix() { release(); }
+
+inline matrix::Storage *matrix::storage(float *data) {
+  return reinterpret_cast<Storage *>(reinterpret_cast<char *>(data) -
+                                     kMatrixAlignment);
+}
+
+/*! Drops this matrix's reference to its storage, freeing the storage if
+    that was the last one. */
+inline void matrix::release() {
+  if (data == NULL) return;
+  if (kMatrixCopyOnWrite &&
+      storage(data)->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (storage(data)->sparse != NULL) delete_sparse(storage(data));
+  if (storage(data)->mapping != NULL) {
+    unmap(storage(data));
+  } else {
+    free(storage(data));
+  }
+}
+
+/*! The old storage goes to m, which frees it when it is destroyed. */
+inline matrix &matrix::operator=(matrix &&m) noexcept {
+  std::swap(rows, m.rows);
+  std::swap(cols, m.cols);
+  std::swap(stride_, m.stride_);
+  std::swap(data, m.data);
+  std::swap(sparse_, m.sparse_);
+  return (*this);
+}
+
+inline int matrix::n_rows() const { return rows; }
+
+inline int matrix::n_cols() const { return cols; }
+
+inline int matrix::stride() const { return stride_; }
+
+inline float *matrix::access(const int i, const int j) {
+  unshare();
+  return data + static_cast<size_t>(i) * stride_ + j;
+}
+
+inline const float *matrix::access(const int i, const int j) const {
+  return data + static_cast<size_t>(i) * stride_ + j;
+}
+
+inline float matrix::at(const int i, const int j) const {
+  return data[static_cast<size_t>(i) * stride_ + j];
+}
+
+/*! With equal strides the rows and their padding form one block, copied
+    in a single memcpy. */
+inline void matrix::copy_from(const matrix &m) {
+  if (stride_ == m.stride_) {
+    memcpy(data, m.data, static_cast<size_t>(rows) * stride_ * sizeof(float));
+    return;
+  }
+  for (int r = 0; r < rows; r++) {
+    memcpy(data + static_cast<size_t>(r) * stride_,
+           m.data + static_cast<size_t>(r) * m.stride_, cols * sizeof(float));
+  }
+}
+
+inline const sparse_matrix *matrix::sparse() const { return sparse_; }
+
+/*! sparse_ is only stored when it is set, so that threads writing the
+    matrix after it is cleared share it without a race. */
+inline void matrix::unshare() {
+  if (sparse_ != NULL) sparse_ = NULL;
+  if (!kMatrixCopyOnWrite || data == NULL ||
+      storage(data)->refs.load(std::memory_order_acquire) == 1) {
+    return;
+  }
+  matrix copy(rows, cols);
+  copy.copy_from(*this);
+  *this = std::move(copy);
+}
+
+/*! Shared storage is replaced rather than copied, since every element is
+    about to be overwritten. */
+inline void matrix::fill(float value) {
+  sparse_ = NULL;
+  if (kMatrixCopyOnWrite && data && storage(data)->refs.load() != 1) {
+    *this = matrix(rows, cols);
+  }
+  if (cols == stride_) {
+    std::fill_n(data, static_cast<size_t>(rows) * cols, value);
+    return;
+  }
+  for (int r = 0; r < rows; r++) {
+    std::fill_n(data + static_cast<size_t>(r) * stride_, cols, value);
+  }
+}
+
+/*! Exits unless [first_row .. last_row : first_col .. last_col] is a
+    block, possibly empty, of a rows x cols matrix. */
+inline void CheckSlice(int rows, int cols, int first_row, int last_row,
+                       int first_col, int last_col) {
+  if (first_row < 0 || last_row >= rows || last_row < first_row - 1 ||
+      first_col < 0 || last_col >= cols || last_col < first_col - 1) {
+    std::cout << "matrix slice [" << first_row << " .. " << last_row << " : "
+              << first_col << " .. " << last_col << "] out of range"
+              << std::endl;
+    exit(1);
+  }
+}
+
+inline matrix_view matrix::view(int first_row, int last_row, int first_col,
+                                int last_col) const {
+  CheckSlice(rows, cols, first_row, last_row, first_col, last_col);
+  return matrix_view(access(first_row, first_col), last_row - first_row + 1,
+                     last_col - first_col + 1, stride_);
+}
+
+inline matrix_block matrix::block(int first_row, int last_row, int first_col,
+                                  int last_col) {
+  CheckSlice(rows, cols, first_row, last_row, first_col, last_col);
+  return matrix_block(access(first_row, first_col), last_row - first_row + 1,
+                      last_col - first_col + 1, stride_);
+}
+
+/*! The memory from the first element to the last is compared, which may
+    report an overlap for two interleaved blocks that share no element. */
+inline bool matrix_view::overlaps(const matrix_view &v) const {
+  if (rows_ == 0 || cols_ == 0 || v.rows_ == 0 || v.cols_ == 0) return false;
+  const float *end = access(rows_ - 1, cols_);
+  const float *v_end = v.access(v.rows_ - 1, v.cols_);
+  return data_ < v_end && v.data_ < end;
+}
 
 #endif  // PROJECT_INCLUDE_MATRIX_H
@@ -11,11 +11,17 @@
 /******************************************************************************
  * Includes
  ******************************************************************************/
+#include <ctype.h>
+#include <stdlib.h>
 #include <iostream>
-#include <string>
+#include <map>
 #include <sstream>
+#include <string>
+#include <vector>
 #include "include/scanner.h"
 #include "include/ast.h"
+#include "include/matrix_chain.h"
+#include "include/vm.h"
 
 /*******************************************************************************
  * Namespaces
@@ -27,6 +33,231 @@ namespace ast {
  * Class Definitions
  ******************************************************************************/
 
+/*******************************************************************************
+ * Code Generation Helpers
+ ******************************************************************************/
+/*! The source name of the Root currently generating code, or empty if no
+    #line directives are wanted. Set by Root::CppCode. */
+static std::string line_source;
+
+/*! Returns code, the C++ generated for node, with #line directives
+    attributing every line of it to the first line of node. A single
+    directive is not enough: the statements that generate several lines,
+    like the matrix initialization loops, would otherwise have their inner
+    loops attributed to the FCAL lines that follow them. Lines already
+    attributed by a nested statement keep their directives. */
+static std::string AttributeTo(Node *node, const std::string &code) {
+  if (line_source.empty() || node->span().first_line == 0) return code;
+  std::string name;
+  for (unsigned i = 0; i < line_source.size(); i++) {
+    if (line_source[i] == '\\' || line_source[i] == '"') name += '\\';
+    name += line_source[i];
+  }
+  std::stringstream directive_ss;
+  directive_ss << "#line " << node->span().first_line << " \"" << name
+               << "\"\n";
+  const std::string directive = directive_ss.str();
+
+  // Directives must start a line.
+  std::string out = "\n" + directive;
+  size_t line_begin = 0;
+  while (line_begin < code.size()) {
+    size_t newline = code.find('\n', line_begin);
+    if (newline == std::string::npos) newline = code.size() - 1;
+    out.append(code, line_begin, newline + 1 - line_begin);
+    bool is_directive = code.compare(line_begin, 5, "#line") == 0;
+    line_begin = newline + 1;
+    if (!is_directive && line_begin < code.size() &&
+        code.compare(line_begin, 5, "#line") != 0) {
+      out += directive;
+    }
+  }
+  return out;
+}
+
+/*! The sites timed by the program being generated, as entries of the
+    ProfileSite table, when Root::profile is set. Set by Root::CppCode. */
+static bool profiling = false;
+static std::vector<std::string> profile_sites;
+
+/*! Adds a profiling site for node and returns its number. The label is the
+    start of the node's FCAL source, prefixed by what if it is not empty. */
+static int NewProfileSite(Node *node, const std::string &what) {
+  std::string source;
+  std::string unparsed = node->UnParse();
+  for (unsigned i = 0; i < unparsed.size() && source.size() < 48; i++) {
+    char ch = isspace(unparsed[i]) ? ' ' : unparsed[i];
+    if (ch == ' ' && (source.empty() || source[source.size() - 1] == ' ')) {
+      continue;
+    }
+    source += ch;
+  }
+  if (source.size() >= 48) {
+    source += "...";
+  } else if (!source.empty() && source[source.size() - 1] == ' ') {
+    source.erase(source.size() - 1);
+  }
+  std::string label = what.empty() ? source : what + " in " + source;
+
+  std::stringstream entry;
+  entry << "{" << node->span().first_line << ", \"";
+  for (unsigned i = 0; i < label.size(); i++) {
+    if (label[i] == '\\' || label[i] == '"') entry << '\\';
+    entry << label[i];
+  }
+  entry << "\"}";
+  profile_sites.push_back(entry.str());
+  return profile_sites.size() - 1;
+}
+
+/*! Times the statement code generated for node as a new site. Declarations
+    must stay in the enclosing block, so the scope is stopped explicitly
+    rather than by closing a block around the statement. */
+static std::string ProfiledStmt(Node *node, const std::string &code) {
+  if (!profiling) return code;
+  int site = NewProfileSite(node, "");
+  std::stringstream scope;
+  scope << "fcal_profile_" << site;
+  std::stringstream start;
+  start << "ProfileScope " << scope.str() << "(" << site << "); ";
+  return start.str() + code + "\n" + scope.str() + ".Stop(); \n";
+}
+
+/*! Times each iteration of a loop body as a new site. */
+static std::string ProfiledBody(Node *body, const std::string &code) {
+  if (!profiling) return code;
+  std::stringstream scope;
+  scope << "{ ProfileScope fcal_profile(" << NewProfileSite(body, "body")
+        << "); " << code << " } \n";
+  return scope.str();
+}
+
+/*! A call of kernel, one of the runtime's matrix kernels, on args, timed as
+    its own site when profiling. */
+static std::string KernelCall(Node *node, const std::string &kernel,
+                              const std::vector<Expr *> &args) {
+  std::stringstream call;
+  if (profiling) {
+    call << " profile_kernel(" << NewProfileSite(node, kernel) << ", "
+         << kernel << ", ";
+  } else {
+    call << " " << kernel << "(";
+  }
+  for (size_t i = 0; i < args.size(); i++) {
+    call << (i ? ", " : "") << args[i]->CppCode();
+  }
+  call << ") ";
+  return call.str();
+}
+
+/*! A call of matrix_multiply_chain on factors, timed as one site when
+    profiling. */
+static std::string ChainCall(Node *node, const std::vector<Expr *> &factors) {
+  std::stringstream call;
+  if (profiling) {
+    call << " profile_kernel(" << NewProfileSite(node, "matrix_multiply_chain")
+         << ", matrix_multiply_chain, ";
+  } else {
+    call << " matrix_multiply_chain(";
+  }
+  call << "std::vector<matrix_view>{";
+  for (size_t i = 0; i < factors.size(); i++) {
+    call << (i ? ", " : "") << factors[i]->CppCode();
+  }
+  call << "}) ";
+  return call.str();
+}
+
+/*! A string operand of + or a comparison as a std::string. A string
+    literal is a char array in C++, which + rejects and < compares by
+    address. */
+static std::string StringOperand(Expr *expr) {
+  if (!expr->VariableName().empty()) return expr->CppCode();
+  return "std::string(" + expr->CppCode() + ")";
+}
+
+/*! The node of the runtime's expression templates (matrix_expr.h) for a
+    call of kernel on args: lazy_x for matrix_x. Matrix arguments are
+    nodes themselves, so a whole expression is evaluated in one pass. */
+static std::string LazyKernelCall(const std::string &kernel,
+                                  const std::vector<Expr *> &args) {
+  std::string call = " lazy_" + kernel.substr(kernel.find('_') + 1) + "(";
+  for (size_t i = 0; i < args.size(); i++) {
+    call += (i ? ", " : "") + args[i]->LazyCppCode();
+  }
+  return call + ") ";
+}
+
+/*! Whether a matrix variable of the given type is declared as a
+    fixed_matrix: when its shape is small and no assignment changes it.
+    Profiled programs keep matrix, whose kernels are the ones timed. */
+static bool IsFixed(const Type &type, bool keeps_shape) {
+  return keeps_shape && type.fits_fixed() && !profiling;
+}
+
+/*! The declaration of a fixed_matrix of the given type called name. */
+static std::string FixedDecl(const Type &type, const std::string &name) {
+  std::stringstream decl;
+  decl << "fixed_matrix<" << type.rows() << ", " << type.cols() << "> "
+       << name;
+  return decl.str();
+}
+
+/*! While the body of a parallelized repeat loop is being generated: the
+    reductions in it, which accumulate into per-chunk partial results. */
+static bool in_parallel_loop = false;
+static const std::map<const Node *, Reduction> *loop_reductions = NULL;
+
+/*******************************************************************************
+ * Type Checking Helpers
+ ******************************************************************************/
+/*! Conditions of if, while and ! must be booleans. */
+static void CheckCondition(Expr *expr, SymbolTable *symbols,
+                           const std::string &where) {
+  expr->TypeCheck(symbols);
+  if (expr->type().kind() != kBoolType) {
+    throw TypeError("condition of " + where + " must be a boolean but is " +
+                    expr->type().ToString());
+  }
+}
+
+/*! Matrix sizes and indices must be ints. */
+static void CheckIndex(Expr *expr, SymbolTable *symbols) {
+  expr->TypeCheck(symbols);
+  if (expr->type().kind() != kIntType) {
+    throw TypeError("matrix index or size must be an int but is " +
+                    expr->type().ToString());
+  }
+}
+
+static void CheckMatrixVar(VarName *var_name, SymbolTable *symbols) {
+  if (!symbols->Lookup(var_name->UnParse()).is_matrix()) {
+    throw TypeError("'" + var_name->UnParse() + "' is not a matrix");
+  }
+}
+
+/*! The body of an if, while or repeat is its own block in the generated
+    C++, so declarations inside it do not leak out. */
+static void CheckScoped(Stmt *stmt, SymbolTable *symbols) {
+  symbols->EnterScope();
+  stmt->TypeCheck(symbols);
+  symbols->ExitScope();
+}
+
+/*******************************************************************************
+ * Bytecode Compilation Helpers
+ ******************************************************************************/
+/*! Compiles expr and returns a register holding its value as type to. */
+static int CompileAs(Expr *expr, const Type &to, vm::Compiler *compiler) {
+  return compiler->Convert(expr->Compile(compiler), expr->type(), to);
+}
+
+static void CompileScoped(Stmt *stmt, vm::Compiler *compiler) {
+  compiler->EnterScope();
+  stmt->Compile(compiler);
+  compiler->ExitScope();
+}
+
 // Root
 // ---------------------------------------------------------
 /*!
@@ -40,10 +271,36 @@ std::string Root::UnParse() {
 Root::~Root() { std::cout << "... destructing Root ...." << std::endl; }
 
 std::string Root::CppCode() {
-  return "#include <iostream>\n" +
-         std::string("#include \"include/Matrix.h\"\n") +
-         "#include <math.h>\n" + "using namespace std; \n" +
-         "int main () { \n" + stmts_->CppCode() + "\n}\n";
+  line_source = source_name_;
+  profiling = profile_;
+  profile_sites.clear();
+  std::string body = stmts_->CppCode();
+
+  std::string sites;
+  if (!profile_sites.empty()) {
+    sites = "static const ProfileSite fcal_profile_sites[] = {\n";
+    for (unsigned i = 0; i < profile_sites.size(); i++) {
+      sites += "  " + profile_sites[i] + ",\n";
+    }
+    std::stringstream start;
+    start << "profile_start(fcal_profile_sites, " << profile_sites.size()
+          << "); \n";
+    sites += "};\n" + start.str();
+  }
+  return std::string("#include \"include/fcalrt.h\"\n") +
+         "using namespace std; \n" + "int main () { \n" + sites + body +
+         "\n}\n";
+}
+
+/*!
+    Type checks the whole program. Errors are reported by throwing a string,
+    as the parser does.
+*/
+void Root::TypeCheck(SymbolTable *symbols) { stmts_->TypeCheck(symbols); }
+
+int Root::Compile(vm::Compiler *compiler) {
+  stmts_->Compile(compiler);
+  return -1;
 }
 // VarName
 // -----------------------------------------------------------
@@ -68,7 +325,32 @@ StmtsSeq::StmtsSeq(Stmt *s, Stmts *ss) {
 */
 std::string StmtsSeq::UnParse() { return stmt_->UnParse() + stmts_->UnParse(); }
 
-std::string StmtsSeq::CppCode() { return stmt_->CppCode() + stmts_->CppCode(); }
+/*!
+    Each statement is preceded by a #line directive naming the FCAL line it
+    came from, so profilers and debuggers report FCAL lines instead of lines
+    of the generated code.
+*/
+std::string StmtsSeq::CppCode() {
+  std::string code = AttributeTo(stmt_, ProfiledStmt(stmt_, stmt_->CppCode()));
+  return code + stmts_->CppCode();
+}
+
+void StmtsSeq::TypeCheck(SymbolTable *symbols) {
+  stmt_->TypeCheck(symbols);
+  stmts_->TypeCheck(symbols);
+}
+
+int StmtsSeq::Compile(vm::Compiler *compiler) {
+  stmt_->Compile(compiler);
+  compiler->EndStatement();
+  stmts_->Compile(compiler);
+  return -1;
+}
+
+void StmtsSeq::Analyze(LoopAnalysis *loop) {
+  stmt_->Analyze(loop);
+  stmts_->Analyze(loop);
+}
 /*!
     Unparse method for EmptyStmts. Returns nothing
 */
@@ -78,6 +360,10 @@ std::string EmptyStmts::CppCode() {
   return "";  // there was a \n here
 }
 
+void EmptyStmts::TypeCheck(SymbolTable *symbols) {}
+
+int EmptyStmts::Compile(vm::Compiler *compiler) { return -1; }
+
 // Stmt
 // -----------------------------------------------------------
 /*!
@@ -87,6 +373,14 @@ std::string EmptyStmts::CppCode() {
 std::string DeclStmt::UnParse() { return decl_->UnParse(); }
 
 std::string DeclStmt::CppCode() { return decl_->CppCode(); }
+
+void DeclStmt::TypeCheck(SymbolTable *symbols) { decl_->TypeCheck(symbols); }
+
+int DeclStmt::Compile(vm::Compiler *compiler) {
+  return decl_->Compile(compiler);
+}
+
+void DeclStmt::Analyze(LoopAnalysis *loop) { decl_->Analyze(loop); }
 /*!
     Unparse method for the StmtsStmts class. When unparsed it has the form:
     Stmt ::= '{' Stmts '}'
@@ -95,6 +389,25 @@ std::string StmtStmts::UnParse() { return " { " + stmts_->UnParse() + " } "; }
 
 std::string StmtStmts::CppCode() { return "{ \n" + stmts_->CppCode() + "} \n"; }
 
+void StmtStmts::TypeCheck(SymbolTable *symbols) {
+  symbols->EnterScope();
+  stmts_->TypeCheck(symbols);
+  symbols->ExitScope();
+}
+
+int StmtStmts::Compile(vm::Compiler *compiler) {
+  compiler->EnterScope();
+  stmts_->Compile(compiler);
+  compiler->ExitScope();
+  return -1;
+}
+
+void StmtStmts::Analyze(LoopAnalysis *loop) {
+  loop->EnterScope();
+  stmts_->Analyze(loop);
+  loop->ExitScope();
+}
+
 IfStmt::IfStmt(Expr *expr, Stmt *stmt) {
   expr_ = expr;
   stmt_ = stmt;
@@ -109,7 +422,30 @@ std::string IfStmt::UnParse() {
 }
 
 std::string IfStmt::CppCode() {
-  return "if (" + expr_->CppCode() + ") " + stmt_->CppCode();
+  return "if (" + expr_->CppCode() + ") " +
+         AttributeTo(stmt_, stmt_->CppCode());
+}
+
+void IfStmt::TypeCheck(SymbolTable *symbols) {
+  CheckCondition(expr_, symbols, "if");
+  CheckScoped(stmt_, symbols);
+}
+
+int IfStmt::Compile(vm::Compiler *compiler) {
+  int cond = expr_->Compile(compiler);
+  int skip = compiler->Emit(vm::kJumpIfFalse, cond);
+  CompileScoped(stmt_, compiler);
+  compiler->PatchJump(skip);
+  return -1;
+}
+
+void IfStmt::Analyze(LoopAnalysis *loop) {
+  expr_->Analyze(loop);
+  loop->EnterScope();
+  loop->EnterBranch();
+  stmt_->Analyze(loop);
+  loop->ExitBranch();
+  loop->ExitScope();
 }
 
 IfElseStmt::IfElseStmt(Expr *expr, Stmt *stmt1, Stmt *stmt2) {
@@ -133,6 +469,23 @@ std::string IfElseStmt::CppCode() {
          stmt2_->CppCode() + " );";
 }
 
+void IfElseStmt::TypeCheck(SymbolTable *symbols) {
+  CheckCondition(expr_, symbols, "if");
+  CheckScoped(stmt1_, symbols);
+  CheckScoped(stmt2_, symbols);
+}
+
+int IfElseStmt::Compile(vm::Compiler *compiler) {
+  int cond = expr_->Compile(compiler);
+  int to_else = compiler->Emit(vm::kJumpIfFalse, cond);
+  CompileScoped(stmt1_, compiler);
+  int to_end = compiler->Emit(vm::kJump);
+  compiler->PatchJump(to_else);
+  CompileScoped(stmt2_, compiler);
+  compiler->PatchJump(to_end);
+  return -1;
+}
+
 AssignStmt::AssignStmt(VarName *var_name, Expr *expr) {
   var_name_ = var_name;
   expr_ = expr;
@@ -147,9 +500,50 @@ std::string AssignStmt::UnParse() {
 }
 
 std::string AssignStmt::CppCode() {
+  if (loop_reductions && loop_reductions->count(this)) {
+    const Reduction &reduction = loop_reductions->find(this)->second;
+    return "fcal_partial_" + reduction.var + " " + reduction.op + "= " +
+           reduction.term->CppCode() + " ; \n";
+  }
+  if (expr_->type().is_matrix() && !profiling) {
+    return "matrix_assign(" + var_name_->CppCode() + ", " +
+           expr_->LazyCppCode() + ") ; \n";
+  }
   return var_name_->CppCode() + " = " + expr_->CppCode() + " ; \n";
 }
 
+void AssignStmt::TypeCheck(SymbolTable *symbols) {
+  expr_->TypeCheck(symbols);
+  symbols->Assign(var_name_->UnParse(), expr_->type());
+}
+
+int AssignStmt::Compile(vm::Compiler *compiler) {
+  Type var_type;
+  int var = compiler->LookupVar(var_name_->UnParse(), &var_type);
+  compiler->Move(var, CompileAs(expr_, var_type, compiler), var_type);
+  return -1;
+}
+
+/*!
+    Assignments of the form s = s op term are reductions if nothing else in
+    the loop uses s. Matrices assigned as a whole cannot be split between
+    iterations, so only local ones are allowed.
+*/
+void AssignStmt::Analyze(LoopAnalysis *loop) {
+  const std::string name = var_name_->UnParse();
+  char op;
+  Expr *term;
+  if (expr_->ReductionOf(name, &op, &term)) {
+    term->Analyze(loop);
+    if (loop->Reduce(this, name, op, term)) return;
+    loop->Read(name);
+  } else {
+    expr_->Analyze(loop);
+  }
+  if (expr_->type().is_matrix() && !loop->IsLocal(name)) loop->Reject();
+  loop->Write(name);
+}
+
 AssignMatrixStmt::AssignMatrixStmt(VarName *var_name, Expr *expr1, Expr *expr2,
                                    Expr *expr3) {
   var_name_ = var_name;
@@ -172,6 +566,88 @@ std::string AssignMatrixStmt::CppCode() {
          expr2_->CppCode() + ")) = " + expr3_->CppCode() + " ;";
 }
 
+void AssignMatrixStmt::TypeCheck(SymbolTable *symbols) {
+  CheckMatrixVar(var_name_, symbols);
+  CheckIndex(expr1_, symbols);
+  CheckIndex(expr2_, symbols);
+  expr3_->TypeCheck(symbols);
+  if (!expr3_->type().is_numeric()) {
+    throw TypeError("cannot store " + expr3_->type().ToString() +
+                    " in an element of matrix '" + var_name_->UnParse() + "'");
+  }
+}
+
+int AssignMatrixStmt::Compile(vm::Compiler *compiler) {
+  int m = compiler->LookupVar(var_name_->UnParse(), NULL);
+  int i = CompileAs(expr1_, Type(kIntType), compiler);
+  int j = CompileAs(expr2_, Type(kIntType), compiler);
+  int value = CompileAs(expr3_, Type(kFloatType), compiler);
+  compiler->Emit(vm::kMatrixSet, m, i, j, value);
+  return -1;
+}
+
+void AssignMatrixStmt::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  expr2_->Analyze(loop);
+  expr3_->Analyze(loop);
+  loop->AccessCell(var_name_->UnParse(),
+                   expr1_->VariableName() == loop->index(),
+                   expr2_->VariableName() == loop->index(), true);
+}
+
+/*!
+    This is the UnParse method for the AssignSliceStmt class. When unparsed it
+   has the form:
+    Stmt ::= varName '[' Expr '..' Expr ':' Expr '..' Expr ']' '=' Expr ';'
+*/
+std::string AssignSliceStmt::UnParse() {
+  return slice_->UnParse() + " = " + expr_->UnParse() + ";\n";
+}
+
+std::string AssignSliceStmt::CppCode() {
+  return "matrix_assign(" + slice_->BlockCppCode() + ", " +
+         expr_->LazyCppCode() + ") ; \n";
+}
+
+void AssignSliceStmt::TypeCheck(SymbolTable *symbols) {
+  slice_->TypeCheck(symbols);
+  expr_->TypeCheck(symbols);
+  const Type &block = slice_->type();
+  const Type &value = expr_->type();
+  if (!value.is_matrix()) {
+    throw TypeError("cannot store " + value.ToString() +
+                    " in a slice of matrix '" +
+                    slice_->var_name()->UnParse() + "'");
+  }
+  if ((block.rows() != kUnknownDim && value.rows() != kUnknownDim &&
+       block.rows() != value.rows()) ||
+      (block.cols() != kUnknownDim && value.cols() != kUnknownDim &&
+       block.cols() != value.cols())) {
+    throw TypeError("cannot store " + value.ToString() + " in a slice of " +
+                    "type " + block.ToString());
+  }
+}
+
+int AssignSliceStmt::Compile(vm::Compiler *compiler) {
+  int m = compiler->LookupVar(slice_->var_name()->UnParse(), NULL);
+  int bounds = slice_->CompileBounds(compiler);
+  int value = expr_->Compile(compiler);
+  compiler->Emit(vm::kSetSlice, m, bounds, value);
+  return -1;
+}
+
+/*!
+    Which elements of a block a loop iteration writes is not worked out, so
+    as for a whole matrix, only blocks of local matrices may be written.
+*/
+void AssignSliceStmt::Analyze(LoopAnalysis *loop) {
+  const std::string name = slice_->var_name()->UnParse();
+  slice_->Analyze(loop);
+  expr_->Analyze(loop);
+  if (!loop->IsLocal(name)) loop->Reject();
+  loop->Write(name);
+}
+
 /*!
     This is the UnParse method for the PrintStmt class. When unparsed it has the
    form:
@@ -185,6 +661,55 @@ std::string PrintStmt::CppCode() {
   return "cout << " + expr_->CppCode() + " ; \n";
 }
 
+void PrintStmt::TypeCheck(SymbolTable *symbols) { expr_->TypeCheck(symbols); }
+
+int PrintStmt::Compile(vm::Compiler *compiler) {
+  int value = expr_->Compile(compiler);
+  switch (expr_->type().kind()) {
+    case kFloatType:
+      compiler->Emit(vm::kPrintFloat, value);
+      break;
+    case kStringType:
+      compiler->Emit(vm::kPrintString, value);
+      break;
+    case kMatrixType:
+      compiler->Emit(vm::kPrintMatrix, value);
+      break;
+    default:
+      compiler->Emit(vm::kPrintInt, value);
+  } /* switch() */
+  return -1;
+}
+
+std::string MatrixWriteStmt::UnParse() {
+  return " matrix_write ( " + matrix_->UnParse() + " , " + file_->UnParse() +
+         " ); \n";
+}
+
+std::string MatrixWriteStmt::CppCode() {
+  return "matrix::matrix_write(" + matrix_->CppCode() + ", " +
+         file_->CppCode() + ") ; \n";
+}
+
+void MatrixWriteStmt::TypeCheck(SymbolTable *symbols) {
+  matrix_->TypeCheck(symbols);
+  file_->TypeCheck(symbols);
+  if (!matrix_->type().is_matrix()) {
+    throw TypeError("matrix_write expects a matrix but was given " +
+                    matrix_->type().ToString());
+  }
+  if (file_->type().kind() != kStringType) {
+    throw TypeError("matrix_write expects a file name but was given " +
+                    file_->type().ToString());
+  }
+}
+
+int MatrixWriteStmt::Compile(vm::Compiler *compiler) {
+  int m = matrix_->Compile(compiler);
+  compiler->Emit(vm::kMatrixWrite, m, file_->Compile(compiler));
+  return -1;
+}
+
 RepeatStmt::RepeatStmt(VarName *var_name, Expr *expr1, Expr *expr2,
                        Stmt *stmt) {
   var_name_ = var_name;
@@ -203,9 +728,186 @@ std::string RepeatStmt::UnParse() {
 }
 
 std::string RepeatStmt::CppCode() {
+  std::string code;
+  if (ParallelCppCode(&code)) return code;
   return "for (" + var_name_->CppCode() + " = " + expr1_->CppCode() + "; " +
          var_name_->CppCode() + " <= " + expr2_->CppCode() + "; " +
-         var_name_->CppCode() + " ++ )" + stmt_->CppCode();
+         var_name_->CppCode() + " ++ )" +
+         AttributeTo(stmt_, ProfiledBody(stmt_, stmt_->CppCode()));
+}
+
+/*!
+    Generates the loop as a parallel loop if the dependence analysis shows
+    that its iterations are independent and its bounds do not depend on
+    anything the body writes. Returns false, generating nothing, otherwise.
+
+    The body is generated once, as a function of a range of iterations and
+    of the variables it writes, so its code and profile sites are the same
+    for every iteration. All but the last iteration run on the thread pool,
+    on private copies of the scalars the body writes and private partial
+    results for its reductions. The last iteration then runs serially on
+    the real variables, which leaves the loop variable and every scalar
+    with the values the serial loop would have left. Parallel loops are not
+    nested: loops inside the body are generated serially.
+*/
+bool RepeatStmt::ParallelCppCode(std::string *code) {
+  if (in_parallel_loop) return false;
+  const std::string index = var_name_->UnParse();
+  LoopAnalysis loop(index);
+  stmt_->Analyze(&loop);
+  if (!loop.Independent()) return false;
+  std::vector<std::string> written = loop.Written();
+  for (unsigned k = 0; k < written.size(); k++) {
+    if (!expr1_->IndependentOf(written[k]) ||
+        !expr2_->IndependentOf(written[k])) {
+      return false;
+    }
+  }
+
+  /* The combining operation of each reduction variable: += for sums and
+     differences, *= for products. */
+  std::map<std::string, char> combine;
+  const std::map<const Node *, Reduction> &reductions = loop.reductions();
+  for (std::map<const Node *, Reduction>::const_iterator r =
+           reductions.begin();
+       r != reductions.end(); ++r) {
+    combine[r->second.var] = r->second.op == '*' ? '*' : '+';
+  }
+
+  const std::string lo = "fcal_lo_" + index;
+  const std::string hi = "fcal_hi_" + index;
+  const std::string lock = "fcal_reduce_" + index;
+  const std::string run = "fcal_body_" + index;
+  std::vector<std::string> privates = loop.Privates();
+  std::stringstream out;
+  out << "{ \n";
+  out << "const int " << lo << " = " << expr1_->CppCode() << "; \n";
+  out << "const int " << hi << " = " << expr2_->CppCode() << "; \n";
+  if (!combine.empty()) out << "std::mutex " << lock << "; \n";
+  /* Threads write their elements through access(), which must not find
+     the storage shared. */
+  std::vector<std::string> matrices = loop.WrittenMatrices();
+  for (unsigned k = 0; k < matrices.size(); k++) {
+    out << matrices[k] << ".unshare(); \n";
+  }
+
+  /* The parameters named after the written variables hide them, so the
+     body writes whichever copies it is given. */
+  out << "auto " << run << " = [&](int fcal_begin, int fcal_end";
+  for (unsigned k = 0; k < privates.size(); k++) {
+    out << ", decltype(" << privates[k] << ") &" << privates[k];
+  }
+  for (std::map<std::string, char>::iterator c = combine.begin();
+       c != combine.end(); ++c) {
+    out << ", decltype(" << c->first << ") &fcal_partial_" << c->first;
+  }
+  out << ") { \n";
+  in_parallel_loop = true;
+  loop_reductions = &reductions;
+  std::string body = stmt_->CppCode();
+  loop_reductions = NULL;
+  in_parallel_loop = false;
+  out << "  for (int " << index << " = fcal_begin; " << index
+      << " < fcal_end; " << index << " ++ )"
+      << AttributeTo(stmt_, ProfiledBody(stmt_, body)) << "\n";
+  out << "}; \n";
+
+  out << "parallel_for_range(" << lo << ", " << hi << ", "
+      << (loop.has_inner_loop() ? "kParallelMinNestedTrips"
+                                : "kParallelMinTrips")
+      << ", [&](int fcal_begin, int fcal_end) { \n";
+  for (unsigned k = 0; k < privates.size(); k++) {
+    out << "  decltype(" << privates[k] << ") " << privates[k] << "; \n";
+  }
+  for (std::map<std::string, char>::iterator c = combine.begin();
+       c != combine.end(); ++c) {
+    out << "  decltype(" << c->first << ") fcal_partial_" << c->first
+        << " = " << (c->second == '*' ? 1 : 0) << "; \n";
+  }
+  out << "  " << run << "(fcal_begin, fcal_end";
+  for (unsigned k = 0; k < privates.size(); k++) out << ", " << privates[k];
+  for (std::map<std::string, char>::iterator c = combine.begin();
+       c != combine.end(); ++c) {
+    out << ", fcal_partial_" << c->first;
+  }
+  out << "); \n";
+  if (!combine.empty()) {
+    out << "  std::lock_guard<std::mutex> fcal_lock(" << lock << "); \n";
+    for (std::map<std::string, char>::iterator c = combine.begin();
+         c != combine.end(); ++c) {
+      out << "  " << c->first << " " << c->second << "= fcal_partial_"
+          << c->first << "; \n";
+    }
+  }
+  out << "}); \n";
+
+  /* The last iteration, on the real variables. A reduction applied to the
+     variable itself is the assignment the serial loop makes. */
+  out << "for (" << index << " = " << lo << " < " << hi << " ? " << hi
+      << " : " << lo << "; " << index << " <= " << hi << "; " << index
+      << " ++ ) " << run << "(" << index << ", " << index << " + 1";
+  for (unsigned k = 0; k < privates.size(); k++) out << ", " << privates[k];
+  for (std::map<std::string, char>::iterator c = combine.begin();
+       c != combine.end(); ++c) {
+    out << ", " << c->first;
+  }
+  out << "); \n";
+  out << "} \n";
+  *code = out.str();
+  return true;
+} /* RepeatStmt::ParallelCppCode() */
+
+void RepeatStmt::TypeCheck(SymbolTable *symbols) {
+  if (symbols->Lookup(var_name_->UnParse()).kind() != kIntType) {
+    throw TypeError("repeat variable '" + var_name_->UnParse() +
+                    "' must be an int");
+  }
+  CheckIndex(expr1_, symbols);
+  CheckIndex(expr2_, symbols);
+
+  /* A body that changes the size of a matrix invalidates what we assumed
+     about that size at the top of the body, so check it again until no
+     more shapes are forgotten. */
+  bool changed = symbols->changed();
+  do {
+    symbols->changed(false);
+    CheckScoped(stmt_, symbols);
+    changed = changed || symbols->changed();
+  } while (symbols->changed());
+  symbols->changed(changed);
+}
+
+/*!
+    As in the generated C++, the upper bound is evaluated again before every
+    iteration.
+*/
+int RepeatStmt::Compile(vm::Compiler *compiler) {
+  Type int_type(kIntType);
+  int var = compiler->LookupVar(var_name_->UnParse(), NULL);
+  compiler->Move(var, CompileAs(expr1_, int_type, compiler), int_type);
+
+  int top = compiler->here();
+  int last = CompileAs(expr2_, int_type, compiler);
+  int cond = compiler->NewTemp(Type(kBoolType));
+  compiler->Emit(vm::kLeInt, cond, var, last);
+  int exit = compiler->Emit(vm::kJumpIfFalse, cond);
+  CompileScoped(stmt_, compiler);
+  compiler->Emit(vm::kIncInt, var);
+  compiler->Emit(vm::kJump, top);
+  compiler->PatchJump(exit);
+  return -1;
+}
+
+void RepeatStmt::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  loop->Write(var_name_->UnParse());
+  loop->InnerLoop();
+  loop->EnterScope();
+  loop->EnterBranch();
+  expr2_->Analyze(loop);
+  stmt_->Analyze(loop);
+  loop->ExitBranch();
+  loop->ExitScope();
 }
 
 WhileStmt::WhileStmt(Expr *expr, Stmt *stmt) {
@@ -222,7 +924,29 @@ std::string WhileStmt::UnParse() {
 }
 
 std::string WhileStmt::CppCode() {
-  return "while (" + expr_->CppCode() + " )" + stmt_->CppCode();
+  return "while (" + expr_->CppCode() + " )" +
+         AttributeTo(stmt_, ProfiledBody(stmt_, stmt_->CppCode()));
+}
+
+void WhileStmt::TypeCheck(SymbolTable *symbols) {
+  bool changed = symbols->changed();
+  do {
+    symbols->changed(false);
+    CheckCondition(expr_, symbols, "while");
+    CheckScoped(stmt_, symbols);
+    changed = changed || symbols->changed();
+  } while (symbols->changed());
+  symbols->changed(changed);
+}
+
+int WhileStmt::Compile(vm::Compiler *compiler) {
+  int top = compiler->here();
+  int cond = expr_->Compile(compiler);
+  int exit = compiler->Emit(vm::kJumpIfFalse, cond);
+  CompileScoped(stmt_, compiler);
+  compiler->Emit(vm::kJump, top);
+  compiler->PatchJump(exit);
+  return -1;
 }
 
 SemiStmt::SemiStmt() {}
@@ -234,6 +958,10 @@ std::string SemiStmt::UnParse() { return " ; \n"; }
 
 std::string SemiStmt::CppCode() { return " ; \n"; }
 
+void SemiStmt::TypeCheck(SymbolTable *symbols) {}
+
+int SemiStmt::Compile(vm::Compiler *compiler) { return -1; }
+
 // Decl
 // -----------------------------------------------------------
 /*!
@@ -247,6 +975,19 @@ std::string IntDecl::UnParse() {
 std::string IntDecl::CppCode() {
   return "int " + var_name_->CppCode() + " ; \n";
 }
+
+void IntDecl::TypeCheck(SymbolTable *symbols) {
+  symbols->Declare(var_name_->UnParse(), Type(kIntType));
+}
+
+int IntDecl::Compile(vm::Compiler *compiler) {
+  compiler->DeclareVar(var_name_->UnParse(), Type(kIntType));
+  return -1;
+}
+
+void IntDecl::Analyze(LoopAnalysis *loop) {
+  loop->Declare(var_name_->UnParse());
+}
 /*!
     This is the Unparse method for the FloatDecl class. When unparsed it has the
    form:
@@ -259,6 +1000,19 @@ std::string FloatDecl::UnParse() {
 std::string FloatDecl::CppCode() {
   return "float " + var_name_->CppCode() + " ; \n";
 }
+
+void FloatDecl::TypeCheck(SymbolTable *symbols) {
+  symbols->Declare(var_name_->UnParse(), Type(kFloatType));
+}
+
+int FloatDecl::Compile(vm::Compiler *compiler) {
+  compiler->DeclareVar(var_name_->UnParse(), Type(kFloatType));
+  return -1;
+}
+
+void FloatDecl::Analyze(LoopAnalysis *loop) {
+  loop->Declare(var_name_->UnParse());
+}
 /*!
     This is the UnParse method for the StringDecl class. When unparsed it has
    the form:
@@ -271,6 +1025,19 @@ std::string StringDecl::UnParse() {
 std::string StringDecl::CppCode() {
   return "string " + var_name_->CppCode() + " ; \n";
 }
+
+void StringDecl::TypeCheck(SymbolTable *symbols) {
+  symbols->Declare(var_name_->UnParse(), Type(kStringType));
+}
+
+int StringDecl::Compile(vm::Compiler *compiler) {
+  compiler->DeclareVar(var_name_->UnParse(), Type(kStringType));
+  return -1;
+}
+
+void StringDecl::Analyze(LoopAnalysis *loop) {
+  loop->Declare(var_name_->UnParse());
+}
 /*!
     This is the UnParse method for the BooleanDecl class.
     When unparsed it has the form:
@@ -281,12 +1048,26 @@ std::string BooleanDecl::UnParse() {
 }
 
 std::string BooleanDecl::CppCode() {
-  return "boolean " + var_name_->CppCode() + " ; \n";
+  return "bool " + var_name_->CppCode() + " ; \n";
+}
+
+void BooleanDecl::TypeCheck(SymbolTable *symbols) {
+  symbols->Declare(var_name_->UnParse(), Type(kBoolType));
+}
+
+int BooleanDecl::Compile(vm::Compiler *compiler) {
+  compiler->DeclareVar(var_name_->UnParse(), Type(kBoolType));
+  return -1;
+}
+
+void BooleanDecl::Analyze(LoopAnalysis *loop) {
+  loop->Declare(var_name_->UnParse());
 }
 
 MatrixDecl::MatrixDecl(VarName *var_name, Expr *expr) {
   var_name_ = var_name;
   expr_ = expr;
+  keeps_shape_ = false;
 }
 /*!
     This is the UnParse method for the MatrixDecl class.
@@ -298,7 +1079,32 @@ std::string MatrixDecl::UnParse() {
 }
 
 std::string MatrixDecl::CppCode() {
-  return "matrix " + var_name_->CppCode() + "( " + expr_->CppCode() + " ) ; \n";
+  std::string decl = "matrix " + var_name_->CppCode();
+  if (IsFixed(expr_->type(), keeps_shape_)) {
+    decl = FixedDecl(expr_->type(), var_name_->CppCode());
+  }
+  return decl + "( " + expr_->CppCode() + " ) ; \n";
+}
+
+void MatrixDecl::TypeCheck(SymbolTable *symbols) {
+  expr_->TypeCheck(symbols);
+  if (!expr_->type().is_matrix()) {
+    throw TypeError("matrix '" + var_name_->UnParse() +
+                    "' initialized with " + expr_->type().ToString());
+  }
+  symbols->Declare(var_name_->UnParse(), expr_->type(), &keeps_shape_);
+}
+
+int MatrixDecl::Compile(vm::Compiler *compiler) {
+  int value = expr_->Compile(compiler);
+  int m = compiler->DeclareVar(var_name_->UnParse(), expr_->type());
+  compiler->Move(m, value, expr_->type());
+  return -1;
+}
+
+void MatrixDecl::Analyze(LoopAnalysis *loop) {
+  expr_->Analyze(loop);
+  loop->Declare(var_name_->UnParse());
 }
 
 LongMatrixDecl::LongMatrixDecl(VarName *var_name1, VarName *var_name2,
@@ -310,6 +1116,7 @@ LongMatrixDecl::LongMatrixDecl(VarName *var_name1, VarName *var_name2,
   expr1_ = expr1;
   expr2_ = expr2;
   expr3_ = expr3;
+  keeps_shape_ = false;
 }
 
 /*!
@@ -324,16 +1131,124 @@ std::string LongMatrixDecl::UnParse() {
          var_name3_->UnParse() + " = " + expr3_->UnParse() + "; ";
 }
 
+/*!
+    The loops are bounded by the size of the new matrix rather than by
+    re-evaluating the size expressions. An initializer that depends on
+    neither index is evaluated once and stored with matrix::fill. When it
+    depends only on the two index variables, rows are filled in parallel,
+    each by a tight loop over a contiguous row that the C++ compiler can
+    vectorize. A fixed_matrix is too small to split between threads, and
+    its loops have constant bounds.
+*/
 std::string LongMatrixDecl::CppCode() {
-  return "matrix " + var_name1_->CppCode() + "( " + expr1_->CppCode() + "," +
-         expr2_->CppCode() + ") ; \n" + "for (int " + var_name2_->CppCode() +
-         " = 0;" + var_name2_->CppCode() + " < " + expr1_->CppCode() + "; " +
-         var_name2_->CppCode() + " ++ ) { \n" + "		for (int " +
-         var_name3_->CppCode() + " = 0;" + var_name3_->CppCode() + " < " +
-         expr2_->CppCode() + "; " + var_name3_->CppCode() + " ++ ) { \n" +
-         " 	*(" + var_name1_->CppCode() + ".access(" +
-         var_name2_->CppCode() + "," + var_name3_->CppCode() + ")) = " +
-         expr3_->CppCode() + "	;} } \n";
+  std::string m = var_name1_->CppCode();
+  std::string i = var_name2_->CppCode();
+  std::string j = var_name3_->CppCode();
+  std::string decl =
+      "matrix " + m + "( " + expr1_->CppCode() + "," + expr2_->CppCode() +
+      ") ; \n";
+  int const_rows, const_cols;
+  bool fixed = expr1_->ConstIntValue(&const_rows) &&
+               expr2_->ConstIntValue(&const_cols) &&
+               IsFixed(Type::Matrix(const_rows, const_cols), keeps_shape_);
+  if (fixed) {
+    decl = FixedDecl(Type::Matrix(const_rows, const_cols), m) + " ; \n";
+  }
+
+  if (expr3_->IndependentOf(m) && expr3_->IndependentOf(i) &&
+      expr3_->IndependentOf(j)) {
+    return decl + m + ".fill( " + expr3_->CppCode() + " ) ; \n";
+  }
+  if (expr3_->IndependentOf(m) && !fixed) {
+    std::string row = "fcal_row_" + m;
+    std::string cols = "fcal_cols_" + m;
+    return decl + "parallel_for(0, " + m + ".n_rows(), parallel_grain(" + m +
+           ".n_cols()), [&](int " + i + ") { \n" + "  float *" + row +
+           " = " + m + ".access(" + i + ", 0); \n" + "  const int " + cols +
+           " = " + m + ".n_cols(); \n" + "  for (int " + j + " = 0; " + j +
+           " < " + cols + "; " + j + " ++ ) " + row + "[" + j + "] = " +
+           expr3_->CppCode() + " ; \n" + "}); \n";
+  }
+  return decl + "for (int " + i + " = 0;" + i + " < " + m + ".n_rows(); " + i +
+         " ++ ) { \n" + "		for (int " + j + " = 0;" + j + " < " + m +
+         ".n_cols(); " + j + " ++ ) { \n" + " 	*(" + m + ".access(" + i +
+         "," + j + ")) = " + expr3_->CppCode() + "	;} } \n";
+}
+
+/*!
+    The matrix is declared before its initializer runs, so the initializer
+    may refer to elements already written. The two index variables are only
+    in scope for the initializer.
+*/
+void LongMatrixDecl::TypeCheck(SymbolTable *symbols) {
+  CheckIndex(expr1_, symbols);
+  CheckIndex(expr2_, symbols);
+  int rows = kUnknownDim;
+  int cols = kUnknownDim;
+  if (!expr1_->ConstIntValue(&rows)) rows = kUnknownDim;
+  if (!expr2_->ConstIntValue(&cols)) cols = kUnknownDim;
+  symbols->Declare(var_name1_->UnParse(), Type::Matrix(rows, cols),
+                   &keeps_shape_);
+
+  symbols->EnterScope();
+  symbols->Declare(var_name2_->UnParse(), Type(kIntType));
+  symbols->Declare(var_name3_->UnParse(), Type(kIntType));
+  expr3_->TypeCheck(symbols);
+  symbols->ExitScope();
+  if (!expr3_->type().is_numeric()) {
+    throw TypeError("matrix '" + var_name1_->UnParse() +
+                    "' elements initialized with " +
+                    expr3_->type().ToString());
+  }
+}
+
+int LongMatrixDecl::Compile(vm::Compiler *compiler) {
+  Type int_type(kIntType);
+  int rows = CompileAs(expr1_, int_type, compiler);
+  int cols = CompileAs(expr2_, int_type, compiler);
+  int m = compiler->DeclareVar(var_name1_->UnParse(),
+                               Type::Matrix(kUnknownDim, kUnknownDim));
+  compiler->Emit(vm::kNewMatrix, m, rows, cols);
+
+  compiler->EnterScope();
+  int i = compiler->DeclareVar(var_name2_->UnParse(), int_type);
+  int j = compiler->DeclareVar(var_name3_->UnParse(), int_type);
+  int bound = compiler->NewTemp(int_type);
+  int cond = compiler->NewTemp(Type(kBoolType));
+
+  compiler->Emit(vm::kLoadInt, i, 0);
+  int outer = compiler->here();
+  compiler->Emit(vm::kNRows, bound, m);
+  compiler->Emit(vm::kLtInt, cond, i, bound);
+  int exit_outer = compiler->Emit(vm::kJumpIfFalse, cond);
+
+  compiler->Emit(vm::kLoadInt, j, 0);
+  int inner = compiler->here();
+  compiler->Emit(vm::kNCols, bound, m);
+  compiler->Emit(vm::kLtInt, cond, j, bound);
+  int exit_inner = compiler->Emit(vm::kJumpIfFalse, cond);
+  int value = CompileAs(expr3_, Type(kFloatType), compiler);
+  compiler->Emit(vm::kMatrixSet, m, i, j, value);
+  compiler->Emit(vm::kIncInt, j);
+  compiler->Emit(vm::kJump, inner);
+  compiler->PatchJump(exit_inner);
+
+  compiler->Emit(vm::kIncInt, i);
+  compiler->Emit(vm::kJump, outer);
+  compiler->PatchJump(exit_outer);
+  compiler->ExitScope();
+  return -1;
+}
+
+void LongMatrixDecl::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  expr2_->Analyze(loop);
+  loop->Declare(var_name1_->UnParse());
+  loop->EnterScope();
+  loop->Declare(var_name2_->UnParse());
+  loop->Declare(var_name3_->UnParse());
+  expr3_->Analyze(loop);
+  loop->ExitScope();
 }
 
 // Expressions (Expr)
@@ -343,6 +1258,7 @@ BinaryOpExpr::BinaryOpExpr(Expr *expr1, std::string op, Expr *expr2) {
   expr1_ = expr1;
   operator_ = op;
   expr2_ = expr2;
+  chain_ordered_ = false;
 }
 /*!
     This is the UnParse method for the BinaryOpExpr class.
@@ -364,9 +1280,334 @@ std::string BinaryOpExpr::UnParse() {
   return expr1_->UnParse() + " " + operator_ + " " + expr2_->UnParse();
 }
 
+/*!
+    The runtime kernel that computes a matrix valued operator, with its
+    arguments in order, or "" for other operators. Kernels are called
+    directly instead of relying on operator overloading; the scalar operand
+    of a broadcast always comes second, and a product plus a matrix is a
+    single multiply-add.
+*/
+std::string BinaryOpExpr::MatrixKernel(std::vector<Expr *> *args) {
+  OrderChain();
+  const Type &t1 = expr1_->type();
+  const Type &t2 = expr2_->type();
+  Expr *a = NULL;
+  Expr *b = NULL;
+  if (!chain_.empty()) {
+    *args = chain_;
+    return "matrix_multiply_chain";
+  } else if (t1.is_matrix() && t2.is_matrix()) {
+    Expr *addend = expr1_->ProductOf(&a, &b)   ? expr2_
+                   : expr2_->ProductOf(&a, &b) ? expr1_
+                                               : NULL;
+    if (operator_ == "+" && addend) {
+      *args = {a, b, addend};
+      return "matrix_multiply_add";
+    }
+    *args = {expr1_, expr2_};
+    return operator_ == "+"   ? "matrix_add"
+           : operator_ == "-" ? "matrix_subtract"
+           : t2.cols() == 1   ? "matrix_vector_multiply"
+                              : "matrix_multiply";
+  } else if (t1.is_matrix() && t2.is_numeric()) {
+    *args = {expr1_, expr2_};
+    return operator_ == "+"   ? "matrix_add_scalar"
+           : operator_ == "-" ? "matrix_subtract_scalar"
+           : operator_ == "*" ? "matrix_scale"
+                              : "matrix_divide_scalar";
+  } else if (t1.is_numeric() && t2.is_matrix()) {
+    *args = {expr2_, expr1_};
+    return operator_ == "+"   ? "matrix_add_scalar"
+           : operator_ == "-" ? "matrix_subtract_from"
+                              : "matrix_scale";
+  }
+  return "";
+}
+
+/*!
+    A matrix valued operator is the root of an expression template, which
+    matrix_eval evaluates, unless profiling, which times each kernel.
+*/
 std::string BinaryOpExpr::CppCode() {
-  return " (" + expr1_->CppCode() + " " + operator_ + " " + expr2_->CppCode() +
-         ") ";
+  std::vector<Expr *> args;
+  std::string kernel = MatrixKernel(&args);
+  if (kernel.empty() && expr1_->type().kind() == kStringType) {
+    return " (" + StringOperand(expr1_) + " " + operator_ + " " +
+           StringOperand(expr2_) + ") ";
+  } else if (kernel.empty()) {
+    return " (" + expr1_->CppCode() + " " + operator_ + " " +
+           expr2_->CppCode() + ") ";
+  } else if (!chain_.empty()) {
+    return ChainCall(this, args);
+  } else if (profiling) {
+    return KernelCall(this, kernel, args);
+  }
+  return " matrix_eval(" + LazyKernelCall(kernel, args) + ") ";
+}
+
+std::string BinaryOpExpr::LazyCppCode() {
+  std::vector<Expr *> args;
+  std::string kernel = MatrixKernel(&args);
+  if (kernel.empty() || profiling || !chain_.empty()) return CppCode();
+  return LazyKernelCall(kernel, args);
+}
+
+/*! Matrix-vector products have a kernel of their own, and a chain ordered
+    at run time is one call. */
+bool BinaryOpExpr::ProductOf(Expr **a, Expr **b) {
+  OrderChain();
+  if (!chain_.empty() || operator_ != "*" || !expr1_->type().is_matrix() ||
+      !expr2_->type().is_matrix() || expr2_->type().cols() == 1) {
+    return false;
+  }
+  *a = expr1_;
+  *b = expr2_;
+  return true;
+}
+
+void BinaryOpExpr::ChainFactors(std::vector<Expr *> *factors) {
+  if (operator_ != "*" || !expr1_->type().is_matrix() ||
+      !expr2_->type().is_matrix()) {
+    factors->push_back(this);
+    return;
+  }
+  expr1_->ChainFactors(factors);
+  expr2_->ChainFactors(factors);
+}
+
+/*!
+    a * b * c * d parses as ((a * b) * c) * d, but the cost of a chain of
+    products depends on its order: with a column vector d, a * (b * (c * d))
+    multiplies vectors only. The product at the root of a chain of three or
+    more matrices, when code is first generated from it, flattens the chain
+    and finds the cheapest order (matrix_chain.h). When the type checker
+    knows every shape, the chain is rebuilt as products in that order,
+    which the kernels compute as usual. Otherwise matrix_multiply_chain
+    orders it at run time from the shapes of the factors.
+*/
+void BinaryOpExpr::OrderChain(void) {
+  if (chain_ordered_) return;
+  chain_ordered_ = true;
+  std::vector<Expr *> factors;
+  ChainFactors(&factors);
+  if (factors.size() < 3) return;
+  std::vector<int> dims;
+  for (size_t i = 0; i < factors.size(); i++) {
+    if (!factors[i]->type().has_shape()) {
+      chain_ = factors;
+      return;
+    }
+    dims.push_back(factors[i]->type().rows());
+  }
+  dims.push_back(factors.back()->type().cols());
+  std::vector<int> split = ChainOrder(dims);
+  const int last = factors.size() - 1;
+  const int s = split[last];
+  expr1_ = ChainProduct(factors, dims, split, 0, s);
+  expr2_ = ChainProduct(factors, dims, split, s + 1, last);
+}
+
+/*! The product of factors i to j in the order split, as new, already
+    ordered nodes spanning the source of those factors. */
+Expr *BinaryOpExpr::ChainProduct(const std::vector<Expr *> &factors,
+                                 const std::vector<int> &dims,
+                                 const std::vector<int> &split, int i, int j) {
+  if (i == j) return factors[i];
+  const int s = split[i * factors.size() + j];
+  BinaryOpExpr *product =
+      new BinaryOpExpr(ChainProduct(factors, dims, split, i, s), "*",
+                       ChainProduct(factors, dims, split, s + 1, j));
+  product->type_ = Type::Matrix(dims[i], dims[j + 1]);
+  product->chain_ordered_ = true;
+  SourceSpan span = factors[i]->span();
+  span.last_line = factors[j]->span().last_line;
+  span.last_column = factors[j]->span().last_column;
+  product->span(span);
+  return product;
+}
+
+void BinaryOpExpr::TypeCheck(SymbolTable *symbols) {
+  expr1_->TypeCheck(symbols);
+  expr2_->TypeCheck(symbols);
+  const Type &t1 = expr1_->type();
+  const Type &t2 = expr2_->type();
+
+  if (operator_ == "+" || operator_ == "-" || operator_ == "*" ||
+      operator_ == "/") {
+    if (t1.is_numeric() && t2.is_numeric()) {
+      type_ = Type(t1.kind() == kIntType && t2.kind() == kIntType ? kIntType
+                                                                  : kFloatType);
+      return;
+    } else if (operator_ == "*" && t1.is_matrix() && t2.is_matrix()) {
+      if (t1.cols() != kUnknownDim && t2.rows() != kUnknownDim &&
+          t1.cols() != t2.rows()) {
+        throw TypeError("matrix dimensions not compatible in " +
+                        t1.ToString() + " * " + t2.ToString());
+      }
+      type_ = Type::Matrix(t1.rows(), t2.cols());
+      return;
+    } else if (operator_ != "/" && t1.is_matrix() && t2.is_matrix()) {
+      /* + and - are elementwise, so the shapes must agree. */
+      if ((t1.rows() != kUnknownDim && t2.rows() != kUnknownDim &&
+           t1.rows() != t2.rows()) ||
+          (t1.cols() != kUnknownDim && t2.cols() != kUnknownDim &&
+           t1.cols() != t2.cols())) {
+        throw TypeError("matrix dimensions not compatible in " +
+                        t1.ToString() + " " + operator_ + " " +
+                        t2.ToString());
+      }
+      type_ = Type::Matrix(t1.rows() != kUnknownDim ? t1.rows() : t2.rows(),
+                           t1.cols() != kUnknownDim ? t1.cols() : t2.cols());
+      return;
+    } else if (t1.is_matrix() && t2.is_numeric()) {
+      type_ = t1;
+      return;
+    } else if (operator_ != "/" && t1.is_numeric() && t2.is_matrix()) {
+      type_ = t2;
+      return;
+    } else if (operator_ == "+" && t1.kind() == kStringType &&
+               t2.kind() == kStringType) {
+      type_ = Type(kStringType);
+      return;
+    }
+  } else if (operator_ == "&&" || operator_ == "||") {
+    if (t1.kind() == kBoolType && t2.kind() == kBoolType) {
+      type_ = Type(kBoolType);
+      return;
+    }
+  } else if (operator_ == "==" || operator_ == "!=") {
+    if ((t1.is_numeric() && t2.is_numeric()) ||
+        (t1.kind() == t2.kind() && !t1.is_matrix())) {
+      type_ = Type(kBoolType);
+      return;
+    }
+  } else {
+    if ((t1.is_numeric() && t2.is_numeric()) ||
+        (t1.kind() == kStringType && t2.kind() == kStringType)) {
+      type_ = Type(kBoolType);
+      return;
+    }
+  }
+  throw TypeError("operator '" + operator_ + "' cannot be applied to " +
+                  t1.ToString() + " and " + t2.ToString());
+} /* BinaryOpExpr::TypeCheck() */
+
+int BinaryOpExpr::Compile(vm::Compiler *compiler) {
+  static const char *kMatrixKernels[] = {
+      "matrix_add",          "matrix_subtract",        "matrix_multiply",
+      "matrix_vector_multiply", "matrix_multiply_add", "matrix_add_scalar",
+      "matrix_subtract_scalar", "matrix_scale",        "matrix_divide_scalar",
+      "matrix_subtract_from"};
+  static const vm::Opcode kMatrixOps[] = {
+      vm::kMatAdd,       vm::kMatSub,       vm::kMatMul,
+      vm::kMatVecMul,    vm::kMatMulAdd,    vm::kMatAddScalar,
+      vm::kMatSubScalar, vm::kMatScale,     vm::kMatDivScalar,
+      vm::kMatSubFrom};
+  static const char *kOperators[] = {"+",  "-", "*",  "/",  "<",
+                                     "<=", ">", ">=", "==", "!="};
+  static const vm::Opcode kIntOps[] = {
+      vm::kAddInt, vm::kSubInt, vm::kMulInt, vm::kDivInt, vm::kLtInt,
+      vm::kLeInt,  vm::kGtInt,  vm::kGeInt,  vm::kEqInt,  vm::kNeInt};
+  static const vm::Opcode kFloatOps[] = {
+      vm::kAddFloat, vm::kSubFloat, vm::kMulFloat, vm::kDivFloat,
+      vm::kLtFloat,  vm::kLeFloat,  vm::kGtFloat,  vm::kGeFloat,
+      vm::kEqFloat,  vm::kNeFloat};
+  static const vm::Opcode kStringOps[] = {
+      vm::kConcat,   vm::kHalt,     vm::kHalt,     vm::kHalt,
+      vm::kLtString, vm::kLeString, vm::kGtString, vm::kGeString,
+      vm::kEqString, vm::kNeString};
+  const Type &t1 = expr1_->type();
+  const Type &t2 = expr2_->type();
+  int result = compiler->NewTemp(type_);
+
+  if (operator_ == "&&" || operator_ == "||") {
+    compiler->Move(result, expr1_->Compile(compiler), type_);
+    int skip = compiler->Emit(
+        operator_ == "&&" ? vm::kJumpIfFalse : vm::kJumpIfTrue, result);
+    compiler->Move(result, expr2_->Compile(compiler), type_);
+    compiler->PatchJump(skip);
+    return result;
+  } else if (type_.is_matrix()) {
+    /* The same kernels the generated C++ calls, one instruction each. */
+    std::vector<Expr *> args;
+    std::string kernel = MatrixKernel(&args);
+    if (!chain_.empty()) {
+      std::vector<int> factors;
+      for (size_t i = 0; i < args.size(); i++) {
+        factors.push_back(args[i]->Compile(compiler));
+      }
+      compiler->Emit(vm::kMatChain, result, compiler->RegisterList(factors),
+                     factors.size());
+      return result;
+    }
+    int operands[3] = {0, 0, 0};
+    for (size_t i = 0; i < args.size(); i++) {
+      operands[i] = args[i]->type().is_matrix()
+                        ? args[i]->Compile(compiler)
+                        : CompileAs(args[i], Type(kFloatType), compiler);
+    }
+    int k = 0;
+    while (kernel != kMatrixKernels[k]) k++;
+    compiler->Emit(kMatrixOps[k], result, operands[0], operands[1],
+                   operands[2]);
+    return result;
+  }
+
+  int op = 0;
+  while (operator_ != kOperators[op]) op++;
+  if (t1.kind() == kStringType) {
+    int a = expr1_->Compile(compiler);
+    int b = expr2_->Compile(compiler);
+    compiler->Emit(kStringOps[op], result, a, b);
+    return result;
+  }
+  /* Booleans only meet == and != and compare like ints. */
+  Type operand(t1.kind() == kFloatType || t2.kind() == kFloatType ? kFloatType
+                                                                  : kIntType);
+  int a = CompileAs(expr1_, operand, compiler);
+  int b = CompileAs(expr2_, operand, compiler);
+  compiler->Emit(operand.kind() == kFloatType ? kFloatOps[op] : kIntOps[op],
+                 result, a, b);
+  return result;
+} /* BinaryOpExpr::Compile() */
+
+bool BinaryOpExpr::IndependentOf(const std::string &name) {
+  return expr1_->IndependentOf(name) && expr2_->IndependentOf(name);
+}
+
+void BinaryOpExpr::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  expr2_->Analyze(loop);
+}
+
+/*!
+    Sums, differences with var on the left and products are reductions.
+    An int var with a float term is not, since C++ truncates the sum back
+    to an int after every step.
+*/
+bool BinaryOpExpr::ReductionOf(const std::string &var, char *op,
+                               Expr **term) {
+  if (operator_ != "+" && operator_ != "-" && operator_ != "*") return false;
+  if (!expr1_->type().is_numeric() || !expr2_->type().is_numeric()) {
+    return false;
+  }
+  Expr *var_expr = NULL;
+  if (expr1_->VariableName() == var && expr2_->IndependentOf(var)) {
+    var_expr = expr1_;
+    *term = expr2_;
+  } else if (operator_ != "-" && expr2_->VariableName() == var &&
+             expr1_->IndependentOf(var)) {
+    var_expr = expr2_;
+    *term = expr1_;
+  } else {
+    return false;
+  }
+  if (var_expr->type().kind() == kIntType &&
+      (*term)->type().kind() != kIntType) {
+    return false;
+  }
+  *op = operator_[0];
+  return true;
 }
 
 // MatrixRef expression
@@ -386,9 +1627,134 @@ std::string MatrixRefExpr::UnParse() {
          expr2_->UnParse() + " ] ";
 }
 
+/*!
+    Reads go through the const at(), which never copies shared storage.
+*/
 std::string MatrixRefExpr::CppCode() {
-  return "*( " + var_name_->CppCode() + ".access(" + expr1_->CppCode() + ", " +
-         expr2_->CppCode() + ")) ";
+  return var_name_->CppCode() + ".at(" + expr1_->CppCode() + ", " +
+         expr2_->CppCode() + ") ";
+}
+
+void MatrixRefExpr::TypeCheck(SymbolTable *symbols) {
+  CheckMatrixVar(var_name_, symbols);
+  CheckIndex(expr1_, symbols);
+  CheckIndex(expr2_, symbols);
+  type_ = Type(kFloatType);
+}
+
+int MatrixRefExpr::Compile(vm::Compiler *compiler) {
+  int m = compiler->LookupVar(var_name_->UnParse(), NULL);
+  int i = CompileAs(expr1_, Type(kIntType), compiler);
+  int j = CompileAs(expr2_, Type(kIntType), compiler);
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kMatrixGet, result, m, i, j);
+  return result;
+}
+
+void MatrixRefExpr::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  expr2_->Analyze(loop);
+  loop->AccessCell(var_name_->UnParse(),
+                   expr1_->VariableName() == loop->index(),
+                   expr2_->VariableName() == loop->index(), false);
+}
+
+bool MatrixRefExpr::IndependentOf(const std::string &name) {
+  return var_name_->UnParse() != name && expr1_->IndependentOf(name) &&
+         expr2_->IndependentOf(name);
+}
+
+// MatrixSlice expression
+// Expr :== varName '[' Expr '..' Expr ':' Expr '..' Expr ']'
+MatrixSliceExpr::MatrixSliceExpr(VarName *v, Expr *first_row, Expr *last_row,
+                                 Expr *first_col, Expr *last_col) {
+  var_name_ = v;
+  first_row_ = first_row;
+  last_row_ = last_row;
+  first_col_ = first_col;
+  last_col_ = last_col;
+}
+
+std::string MatrixSliceExpr::UnParse() {
+  return var_name_->UnParse() + " [ " + first_row_->UnParse() + " .. " +
+         last_row_->UnParse() + " : " + first_col_->UnParse() + " .. " +
+         last_col_->UnParse() + " ] ";
+}
+
+std::string MatrixSliceExpr::BoundsCppCode() {
+  return "(" + first_row_->CppCode() + ", " + last_row_->CppCode() + ", " +
+         first_col_->CppCode() + ", " + last_col_->CppCode() + ")";
+}
+
+/*!
+    Where a matrix is needed the block is copied into one. Kernels and
+    assignments take the view itself.
+*/
+std::string MatrixSliceExpr::CppCode() {
+  return " matrix(" + LazyCppCode() + ") ";
+}
+
+std::string MatrixSliceExpr::LazyCppCode() {
+  return var_name_->CppCode() + ".view" + BoundsCppCode() + " ";
+}
+
+std::string MatrixSliceExpr::BlockCppCode() {
+  return var_name_->CppCode() + ".block" + BoundsCppCode();
+}
+
+/*!
+    The shape is known when both bounds of a dimension are constants.
+*/
+void MatrixSliceExpr::TypeCheck(SymbolTable *symbols) {
+  CheckMatrixVar(var_name_, symbols);
+  CheckIndex(first_row_, symbols);
+  CheckIndex(last_row_, symbols);
+  CheckIndex(first_col_, symbols);
+  CheckIndex(last_col_, symbols);
+  int first, last;
+  int rows = kUnknownDim;
+  int cols = kUnknownDim;
+  if (first_row_->ConstIntValue(&first) && last_row_->ConstIntValue(&last)) {
+    rows = last - first + 1;
+  }
+  if (first_col_->ConstIntValue(&first) && last_col_->ConstIntValue(&last)) {
+    cols = last - first + 1;
+  }
+  type_ = Type::Matrix(rows, cols);
+}
+
+int MatrixSliceExpr::CompileBounds(vm::Compiler *compiler) {
+  Expr *bounds[] = {first_row_, last_row_, first_col_, last_col_};
+  Type int_type(kIntType);
+  int first = compiler->NewTemp(int_type);
+  for (int k = 1; k < 4; k++) compiler->NewTemp(int_type);
+  for (int k = 0; k < 4; k++) {
+    compiler->Move(first + k, CompileAs(bounds[k], int_type, compiler),
+                   int_type);
+  }
+  return first;
+}
+
+int MatrixSliceExpr::Compile(vm::Compiler *compiler) {
+  int m = compiler->LookupVar(var_name_->UnParse(), NULL);
+  int bounds = CompileBounds(compiler);
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kSlice, result, m, bounds);
+  return result;
+}
+
+void MatrixSliceExpr::Analyze(LoopAnalysis *loop) {
+  first_row_->Analyze(loop);
+  last_row_->Analyze(loop);
+  first_col_->Analyze(loop);
+  last_col_->Analyze(loop);
+  loop->Read(var_name_->UnParse());
+}
+
+bool MatrixSliceExpr::IndependentOf(const std::string &name) {
+  return var_name_->UnParse() != name && first_row_->IndependentOf(name) &&
+         last_row_->IndependentOf(name) && first_col_->IndependentOf(name) &&
+         last_col_->IndependentOf(name);
 }
 /*!
     This is the UnParse method for the BoolExpr class.
@@ -401,10 +1767,15 @@ std::string BoolExpr::UnParse() {
   return ss.str();
 }
 
-// std::string BoolExpr::CppCode() {  //Sifora did this one. Is it correct
-// return " ( "" ) ";  //Sifora did this one. Correct? //uppercase, lowercase
+std::string BoolExpr::CppCode() { return boolean_ ? "true" : "false"; }
+
+void BoolExpr::TypeCheck(SymbolTable *symbols) { type_ = Type(kBoolType); }
 
-//}
+int BoolExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kLoadInt, result, boolean_ ? 1 : 0);
+  return result;
+}
 
 /*!
     This is the UnParse method for the VarNameExpr class.
@@ -414,6 +1785,24 @@ std::string BoolExpr::UnParse() {
 std::string VarNameExpr::UnParse() { return var_name_->UnParse(); }
 std::string VarNameExpr::CppCode() { return var_name_->CppCode(); }
 
+void VarNameExpr::TypeCheck(SymbolTable *symbols) {
+  type_ = symbols->Lookup(var_name_->UnParse());
+}
+
+int VarNameExpr::Compile(vm::Compiler *compiler) {
+  return compiler->LookupVar(var_name_->UnParse(), NULL);
+}
+
+void VarNameExpr::Analyze(LoopAnalysis *loop) {
+  loop->Read(var_name_->UnParse());
+}
+
+std::string VarNameExpr::VariableName() { return var_name_->UnParse(); }
+
+bool VarNameExpr::IndependentOf(const std::string &name) {
+  return var_name_->UnParse() != name;
+}
+
 /*!
     This is the UnParse method for the ParenExpr class.
     When unparsed it has the form:
@@ -422,6 +1811,18 @@ std::string VarNameExpr::CppCode() { return var_name_->CppCode(); }
 std::string ParenExpr::UnParse() { return " ( " + expr_->UnParse() + " ) "; }
 
 std::string ParenExpr::CppCode() { return " ( " + expr_->CppCode() + " ) "; }
+std::string ParenExpr::LazyCppCode() {
+  return " ( " + expr_->LazyCppCode() + " ) ";
+}
+
+void ParenExpr::TypeCheck(SymbolTable *symbols) {
+  expr_->TypeCheck(symbols);
+  type_ = expr_->type();
+}
+
+int ParenExpr::Compile(vm::Compiler *compiler) {
+  return expr_->Compile(compiler);
+}
 // NestedOrFunctionExpr
 // Expr ::= VarName '(' Expr ')'
 NestedOrFunctionExpr::NestedOrFunctionExpr(VarName *v, Expr *e) {
@@ -442,9 +1843,113 @@ std::string NestedOrFunctionExpr::CppCode() {
   if (var_name_->CppCode() == "n_rows" || var_name_->CppCode() == "n_cols") {
     return expr_->CppCode() + "." + var_name_->CppCode() + "()";
   }
+  if (expr_->type().is_matrix()) {
+    std::string kernel = "matrix_" + var_name_->CppCode();
+    if (profiling) return KernelCall(this, kernel, {expr_});
+    return " matrix_eval(" + LazyKernelCall(kernel, {expr_}) + ") ";
+  }
   return var_name_->CppCode() + " (" + expr_->CppCode() + " )";
 }
 
+std::string NestedOrFunctionExpr::LazyCppCode() {
+  if (expr_->type().is_matrix() && !profiling) {
+    return LazyKernelCall("matrix_" + var_name_->CppCode(), {expr_});
+  }
+  return CppCode();
+}
+
+/*!
+    The callee of a NestedOrFunctionExpr is never a variable, so it is
+    checked against the functions the generated program can call: the
+    matrix runtime and the single argument functions of math.h.
+*/
+void NestedOrFunctionExpr::TypeCheck(SymbolTable *symbols) {
+  std::string name = var_name_->UnParse();
+  expr_->TypeCheck(symbols);
+  const Type &arg = expr_->type();
+
+  if (name == "n_rows" || name == "n_cols") {
+    if (!arg.is_matrix()) {
+      throw TypeError(name + " expects a matrix but was given " +
+                      arg.ToString());
+    }
+    type_ = Type(kIntType);
+    return;
+  } else if (name == "transpose") {
+    if (!arg.is_matrix()) {
+      throw TypeError("transpose expects a matrix but was given " +
+                      arg.ToString());
+    }
+    type_ = Type::Matrix(arg.cols(), arg.rows());
+    return;
+  } else if (name == "matrix_read") {
+    if (arg.kind() != kStringType) {
+      throw TypeError("matrix_read expects a file name but was given " +
+                      arg.ToString());
+    }
+    type_ = Type::Matrix(kUnknownDim, kUnknownDim);
+    return;
+  }
+  for (int i = 0; i < kNumMathFunctions; i++) {
+    if (name != kMathFunctions[i]) continue;
+    if (arg.is_matrix()) {
+      type_ = arg;  /* applied to every element */
+      return;
+    } else if (!arg.is_numeric()) {
+      throw TypeError(name + " expects a number or a matrix but was given " +
+                      arg.ToString());
+    }
+    type_ = Type(kFloatType);
+    return;
+  }
+  throw TypeError("unknown function '" + name + "'");
+} /* NestedOrFunctionExpr::TypeCheck() */
+
+int NestedOrFunctionExpr::Compile(vm::Compiler *compiler) {
+  std::string name = var_name_->UnParse();
+  int result = compiler->NewTemp(type_);
+  if (name == "n_rows" || name == "n_cols") {
+    int m = expr_->Compile(compiler);
+    compiler->Emit(name == "n_rows" ? vm::kNRows : vm::kNCols, result, m);
+  } else if (name == "transpose") {
+    compiler->Emit(vm::kTranspose, result, expr_->Compile(compiler));
+  } else if (name == "matrix_read") {
+    compiler->Emit(vm::kMatrixRead, result, expr_->Compile(compiler));
+  } else {
+    int f = 0;
+    while (name != kMathFunctions[f]) f++;
+    if (type_.is_matrix()) {
+      compiler->Emit(vm::kMatMath, result, expr_->Compile(compiler), f);
+    } else {
+      int arg = CompileAs(expr_, Type(kFloatType), compiler);
+      compiler->Emit(vm::kCallMath, result, arg, f);
+    }
+  }
+  return result;
+}
+
+/*!
+    n_rows and n_cols of a matrix variable only read its size, which no
+    loop that gets parallelized can change.
+*/
+void NestedOrFunctionExpr::Analyze(LoopAnalysis *loop) {
+  const std::string name = var_name_->UnParse();
+  if ((name == "n_rows" || name == "n_cols") &&
+      !expr_->VariableName().empty()) {
+    return;
+  }
+  if (name == "matrix_read") loop->Reject();
+  expr_->Analyze(loop);
+}
+
+/*!
+    Every function the type checker accepts is free of side effects except
+    matrix_read, which does I/O.
+*/
+bool NestedOrFunctionExpr::IndependentOf(const std::string &name) {
+  return var_name_->UnParse() != "matrix_read" && expr_->IndependentOf(name);
+}
+
 // LetExpr
 // Expr::= 'let' Stmts 'in' Expr 'end'
 LetExpr::LetExpr(Stmts *ss, Expr *e) {
@@ -463,6 +1968,27 @@ std::string LetExpr::UnParse() {
 std::string LetExpr::CppCode() {
   return "({" + stmts_->CppCode() + expr_->CppCode() + "; })  ";
 }
+
+void LetExpr::TypeCheck(SymbolTable *symbols) {
+  symbols->EnterScope();
+  stmts_->TypeCheck(symbols);
+  expr_->TypeCheck(symbols);
+  type_ = expr_->type();
+  symbols->ExitScope();
+}
+
+/*!
+    The result register is allocated outside the let's scope so that it
+    survives the scope's variables.
+*/
+int LetExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->EnterScope();
+  stmts_->Compile(compiler);
+  compiler->Move(result, CompileAs(expr_, type_, compiler), type_);
+  compiler->ExitScope();
+  return result;
+}
 // If Expression
 // Expr::= 'if' Expr 'then' Expr 'else' Expr
 IfExpr::IfExpr(Expr *e1, Expr *e2, Expr *e3) {
@@ -479,9 +2005,66 @@ std::string IfExpr::UnParse() {
   return " if " + expr1_->UnParse() + " then " + expr2_->UnParse() + " else " +
          expr3_->UnParse();
 }
+/*!
+    The branches of ?: must have one C++ type. Matrix branches that may be
+    fixed_matrix are converted to one: to the fixed_matrix when both have
+    its shape, and to matrix otherwise, since a branch of another shape
+    could only be narrowed to it.
+*/
 std::string IfExpr::CppCode() {
-  return "( (" + expr1_->CppCode() + ") ? (" + expr2_->CppCode() + ") : " +
-         expr3_->CppCode() + " )";
+  const Type &t2 = expr2_->type();
+  const Type &t3 = expr3_->type();
+  std::string branch2 = expr2_->CppCode();
+  std::string branch3 = expr3_->CppCode();
+  if (t2.is_matrix() && !profiling && (t2.fits_fixed() || t3.fits_fixed())) {
+    std::string common = t2 == t3 ? FixedDecl(t2, "") : "matrix";
+    branch2 = common + "(" + branch2 + ")";
+    branch3 = common + "(" + branch3 + ")";
+  }
+  return "( (" + expr1_->CppCode() + ") ? (" + branch2 + ") : " + branch3 +
+         " )";
+}
+
+void IfExpr::TypeCheck(SymbolTable *symbols) {
+  CheckCondition(expr1_, symbols, "if");
+  expr2_->TypeCheck(symbols);
+  expr3_->TypeCheck(symbols);
+  const Type &t2 = expr2_->type();
+  const Type &t3 = expr3_->type();
+  if (t2.is_numeric() && t3.is_numeric()) {
+    type_ = Type(t2 == t3 ? t2.kind() : kFloatType);
+  } else if (t2 == t3) {
+    type_ = t2;
+  } else if (t2.is_matrix() && t3.is_matrix()) {
+    type_ = Type::Matrix(t2.rows() == t3.rows() ? t2.rows() : kUnknownDim,
+                         t2.cols() == t3.cols() ? t2.cols() : kUnknownDim);
+  } else {
+    throw TypeError("branches of if have different types " + t2.ToString() +
+                    " and " + t3.ToString());
+  }
+}
+
+int IfExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  int cond = expr1_->Compile(compiler);
+  int to_else = compiler->Emit(vm::kJumpIfFalse, cond);
+  compiler->Move(result, CompileAs(expr2_, type_, compiler), type_);
+  int to_end = compiler->Emit(vm::kJump);
+  compiler->PatchJump(to_else);
+  compiler->Move(result, CompileAs(expr3_, type_, compiler), type_);
+  compiler->PatchJump(to_end);
+  return result;
+}
+
+void IfExpr::Analyze(LoopAnalysis *loop) {
+  expr1_->Analyze(loop);
+  expr2_->Analyze(loop);
+  expr3_->Analyze(loop);
+}
+
+bool IfExpr::IndependentOf(const std::string &name) {
+  return expr1_->IndependentOf(name) && expr2_->IndependentOf(name) &&
+         expr3_->IndependentOf(name);
 }
 
 /*!
@@ -493,6 +2076,23 @@ std::string NotExpr::UnParse() { return "!" + expr_->UnParse(); }
 
 std::string NotExpr::CppCode() { return "! (" + expr_->CppCode() + ") "; }
 
+void NotExpr::TypeCheck(SymbolTable *symbols) {
+  CheckCondition(expr_, symbols, "!");
+  type_ = Type(kBoolType);
+}
+
+int NotExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kNot, result, expr_->Compile(compiler));
+  return result;
+}
+
+void NotExpr::Analyze(LoopAnalysis *loop) { expr_->Analyze(loop); }
+
+bool NotExpr::IndependentOf(const std::string &name) {
+  return expr_->IndependentOf(name);
+}
+
 /*!
     This is the UnParse method for the IntConstExpr class.
     When unparsed it has the form:
@@ -502,6 +2102,19 @@ std::string IntConstExpr::UnParse() { return const_int_; }
 
 std::string IntConstExpr::CppCode() { return const_int_; }
 
+void IntConstExpr::TypeCheck(SymbolTable *symbols) { type_ = Type(kIntType); }
+
+int IntConstExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kLoadInt, result, atoi(const_int_.c_str()));
+  return result;
+}
+
+bool IntConstExpr::ConstIntValue(int *value) {
+  *value = atoi(const_int_.c_str());
+  return true;
+}
+
 /*!
     This is the UnParse method for the FloatConstExpr class.
     When unparsed it has the form:
@@ -511,6 +2124,17 @@ std::string FloatConstExpr::UnParse() { return const_float_; }
 
 std::string FloatConstExpr::CppCode() { return const_float_; }
 
+void FloatConstExpr::TypeCheck(SymbolTable *symbols) {
+  type_ = Type(kFloatType);
+}
+
+int FloatConstExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kLoadFloat, result,
+                 compiler->FloatConstant(atof(const_float_.c_str())));
+  return result;
+}
+
 /*!
     This is the UnParse method for the StringConstExpr class.
     When UnParsed it has the form:
@@ -520,5 +2144,16 @@ std::string StringConstExpr::UnParse() { return string_const_; }
 
 std::string StringConstExpr::CppCode() { return string_const_; }
 
+void StringConstExpr::TypeCheck(SymbolTable *symbols) {
+  type_ = Type(kStringType);
+}
+
+int StringConstExpr::Compile(vm::Compiler *compiler) {
+  int result = compiler->NewTemp(type_);
+  compiler->Emit(vm::kLoadString, result,
+                 compiler->StringConstant(string_const_));
+  return result;
+}
+
 } /* namespace ast */
 } /* namespace fcal */
@@ -16,14 +16,35 @@
  ******************************************************************************/
 #include <iostream>
 #include <string>
+#include <vector>
+#include "include/loop_analysis.h"
 #include "include/scanner.h"
+#include "include/types.h"
 
 /*******************************************************************************
  * Namespaces
  ******************************************************************************/
 namespace fcal {
+namespace vm {
+class Compiler;
+} /* namespace vm */
 namespace ast {
 
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! The part of the FCAL source a node was parsed from, from the start of its
+    first token to the start of its last one. Lines and columns count from
+    1; a line of 0 means the node was not built by the parser. */
+struct SourceSpan {
+  SourceSpan(void) : first_line(0), first_column(0), last_line(0),
+                     last_column(0) {}
+  int first_line;
+  int first_column;
+  int last_line;
+  int last_column;
+};
+
 /*******************************************************************************
  * Class Definitions
  ******************************************************************************/
@@ -37,8 +58,22 @@ class Node {
  public:
   virtual std::string UnParse(void) { return " This should be pure virtual "; }
   virtual std::string CppCode(void) { return " This should be pure virtual"; }
+  virtual void TypeCheck(SymbolTable *symbols) {}
+  /*! Emits bytecode for the node. Expressions return the register that
+      holds their value; statements return -1. */
+  virtual int Compile(vm::Compiler *compiler) { return -1; }
+  /*! Records what the node reads and writes when it is part of the body of
+      a repeat loop being considered for parallelization. Nodes that do not
+      override it reject the loop. */
+  virtual void Analyze(LoopAnalysis *loop) { loop->Reject(); }
   // virtual std::string CppCode(void) = 0;
   virtual ~Node(void) {}
+
+  const SourceSpan &span(void) const { return span_; }
+  void span(const SourceSpan &span_in) { span_ = span_in; }
+
+ private:
+  SourceSpan span_;
 };
 
 /*!
@@ -48,7 +83,45 @@ class Node {
 class Stmts : public Node {};
 class Stmt : public Node {};
 class Decl : public Node {};
-class Expr : public Node {};
+
+/*!
+    Every expression records the static type computed for it by TypeCheck.
+    The type is kNoType until the pass has run.
+*/
+class Expr : public Node {
+ public:
+  const Type &type(void) const { return type_; }
+  /*! If the expression is an integer literal, store its value and return
+      true. Used to recover matrix sizes at compile time. */
+  virtual bool ConstIntValue(int *value) { return false; }
+  /*! True if evaluating the expression has no side effects and never reads
+      the named variable, so it can be evaluated in any order. */
+  virtual bool IndependentOf(const std::string &name) { return false; }
+  /*! The name of the variable if the expression is just a variable. */
+  virtual std::string VariableName(void) { return ""; }
+  /*! If the expression is var op term, for an op that can be computed as a
+      reduction over var, store op and term and return true. */
+  virtual bool ReductionOf(const std::string &var, char *op, Expr **term) {
+    return false;
+  }
+  /*! The expression as a node of the runtime's expression templates
+      (matrix_expr.h), for the caller to evaluate. Only matrix arithmetic
+      builds nodes; any other expression is a leaf. */
+  virtual std::string LazyCppCode(void) { return CppCode(); }
+  /*! If the expression is a product of two matrices computed by
+      matrix_multiply, store the factors and return true. */
+  virtual bool ProductOf(Expr **a, Expr **b) { return false; }
+  /*! Appends the factors of the expression as a chain of matrix products,
+      which is just the expression unless it is a product of matrices. A
+      parenthesized product is a single factor, so the order written in
+      parentheses is kept. */
+  virtual void ChainFactors(std::vector<Expr *> *factors) {
+    factors->push_back(this);
+  }
+
+ protected:
+  Type type_;
+};
 
 /*!
     This class represents a variable name within a production.
@@ -75,16 +148,27 @@ class VarName {
 class Root : public Node {
  public:
   explicit Root(VarName *var_name, Stmts *stmts)
-      : var_name_(var_name), stmts_(stmts) {}
+      : var_name_(var_name), stmts_(stmts), profile_(false) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
   virtual ~Root();
 
+  /*! The name of the .fcal file the program came from. When it is set,
+      CppCode emits #line directives mapping every statement back to it. */
+  void source_name(const std::string &name) { source_name_ = name; }
+  /*! When set, CppCode times every statement, loop body and matrix kernel
+      and the generated program reports its hot spots when it exits. */
+  void profile(bool profile_in) { profile_ = profile_in; }
+
  private:
-  Root() : var_name_(NULL), stmts_(NULL) {}
+  Root() : var_name_(NULL), stmts_(NULL), profile_(false) {}
   Root(const Root &) {}
   VarName *var_name_;
   Stmts *stmts_;
+  std::string source_name_;
+  bool profile_;
 };
 
 // Stmts
@@ -99,6 +183,9 @@ class StmtsSeq : public Stmts {
   StmtsSeq(Stmt *stmt, Stmts *stmts);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   StmtsSeq() : stmt_(NULL), stmts_(NULL) {}
@@ -112,6 +199,9 @@ class EmptyStmts : public Stmts {
   EmptyStmts() {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
 
  private:
   EmptyStmts(const EmptyStmts &) {}
@@ -128,6 +218,9 @@ class DeclStmt : public Stmt {
   explicit DeclStmt(Decl *decl) : decl_(decl) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   DeclStmt() : decl_(NULL) {}
@@ -144,6 +237,9 @@ class StmtStmts : public Stmt {
   explicit StmtStmts(Stmts *stmts) : stmts_(stmts) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   StmtStmts() : stmts_(NULL) {}
@@ -160,6 +256,9 @@ class IfStmt : public Stmt {
   IfStmt(Expr *expr, Stmt *stmt);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   IfStmt() : expr_(NULL), stmt_(NULL) {}
@@ -177,6 +276,8 @@ class IfElseStmt : public Stmt {
   IfElseStmt(Expr *expr, Stmt *stmt1, Stmt *stmt2);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
 
  private:
   IfElseStmt() : expr_(NULL), stmt1_(NULL), stmt2_(NULL) {}
@@ -195,6 +296,9 @@ class AssignStmt : public Stmt {
   AssignStmt(VarName *var_name, Expr *expr);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   AssignStmt() : var_name_(NULL), expr_(NULL) {}
@@ -212,6 +316,9 @@ class AssignMatrixStmt : public Stmt {
   AssignMatrixStmt(VarName *var_name, Expr *expr1, Expr *expr2, Expr *expr3);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   AssignMatrixStmt()
@@ -223,6 +330,30 @@ class AssignMatrixStmt : public Stmt {
   Expr *expr3_;
 };
 
+class MatrixSliceExpr;
+
+/*!
+    This class encompasses productions with the following form:
+    Stmt ::= varName '[' Expr '..' Expr ':' Expr '..' Expr ']' '=' Expr ';'
+    The expression is evaluated into the block of the matrix.
+*/
+class AssignSliceStmt : public Stmt {
+ public:
+  AssignSliceStmt(MatrixSliceExpr *slice, Expr *expr)
+      : slice_(slice), expr_(expr) {}
+  std::string UnParse();
+  std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+
+ private:
+  AssignSliceStmt() : slice_(NULL), expr_(NULL) {}
+  AssignSliceStmt(const AssignSliceStmt &) {}
+  MatrixSliceExpr *slice_;
+  Expr *expr_;
+};
+
 /*!
     This class encompasses productions with the following form:
     Stmt ::= 'print' '(' Expr ')' ';'
@@ -233,6 +364,8 @@ class PrintStmt : public Stmt {
   std::string UnParse();
   ;
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
 
  private:
   PrintStmt() : expr_(NULL) {}
@@ -240,6 +373,26 @@ class PrintStmt : public Stmt {
   Expr *expr_;
 };
 
+/*!
+    This class encompasses productions with the following form:
+    Stmt ::= 'matrix_write' '(' Expr ',' Expr ')' ';'
+    The matrix is written to the file as a binary matrix file.
+*/
+class MatrixWriteStmt : public Stmt {
+ public:
+  MatrixWriteStmt(Expr *matrix, Expr *file) : matrix_(matrix), file_(file) {}
+  std::string UnParse();
+  std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+
+ private:
+  MatrixWriteStmt() : matrix_(NULL), file_(NULL) {}
+  MatrixWriteStmt(const MatrixWriteStmt &) {}
+  Expr *matrix_;
+  Expr *file_;
+};
+
 /*!
     This class encompasses productions with the following form:
     Stmt ::= 'repeat' '(' varName '=' Expr 'to' Expr ')' Stmt
@@ -249,10 +402,14 @@ class RepeatStmt : public Stmt {
   RepeatStmt(VarName *var_name, Expr *expr1, Expr *expr2, Stmt *stmt);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   RepeatStmt() : var_name_(NULL), expr1_(NULL), expr2_(NULL), stmt_(NULL) {}
   RepeatStmt(const RepeatStmt &) {}
+  bool ParallelCppCode(std::string *code);
   VarName *var_name_;
   Expr *expr1_;
   Expr *expr2_;
@@ -268,6 +425,8 @@ class WhileStmt : public Stmt {
   WhileStmt(Expr *expr, Stmt *stmt);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
 
  private:
   WhileStmt() : expr_(NULL), stmt_(NULL) {}
@@ -285,6 +444,9 @@ class SemiStmt : public Stmt {
   SemiStmt();
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
 
  private:
   SemiStmt(const SemiStmt &) {}
@@ -301,6 +463,9 @@ class IntDecl : public Decl {
   explicit IntDecl(VarName *var_name) : var_name_(var_name) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   IntDecl() : var_name_(NULL) {}
@@ -317,6 +482,9 @@ class FloatDecl : public Decl {
   explicit FloatDecl(VarName *var_name) : var_name_(var_name) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   FloatDecl() : var_name_(NULL) {}
@@ -333,6 +501,9 @@ class StringDecl : public Decl {
   explicit StringDecl(VarName *var_name) : var_name_(var_name) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   StringDecl() : var_name_(NULL) {}
@@ -349,6 +520,9 @@ class BooleanDecl : public Decl {
   explicit BooleanDecl(VarName *var_name) : var_name_(var_name) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   BooleanDecl() : var_name_(NULL) {}
@@ -365,12 +539,17 @@ class MatrixDecl : public Decl {
   MatrixDecl(VarName *var_name, Expr *expr);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
-  MatrixDecl() : var_name_(NULL), expr_(NULL) {}
+  MatrixDecl() : var_name_(NULL), expr_(NULL), keeps_shape_(false) {}
   MatrixDecl(const MatrixDecl &) {}
   VarName *var_name_;
   Expr *expr_;
+  /*! Whether no assignment changes the shape of the matrix. */
+  bool keeps_shape_;
 };
 
 /*!
@@ -384,6 +563,9 @@ class LongMatrixDecl : public Decl {
                  Expr *expr1, Expr *expr2, Expr *expr3);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
 
  private:
   LongMatrixDecl()
@@ -392,7 +574,8 @@ class LongMatrixDecl : public Decl {
         var_name3_(NULL),
         expr1_(NULL),
         expr2_(NULL),
-        expr3_(NULL) {}
+        expr3_(NULL),
+        keeps_shape_(false) {}
   LongMatrixDecl(const LongMatrixDecl &) {}
   VarName *var_name1_;
   VarName *var_name2_;
@@ -400,6 +583,8 @@ class LongMatrixDecl : public Decl {
   Expr *expr1_;
   Expr *expr2_;
   Expr *expr3_;
+  /*! Whether no assignment changes the shape of the matrix. */
+  bool keeps_shape_;
 };
 
 // Expr
@@ -424,13 +609,31 @@ class BinaryOpExpr : public Expr {
   BinaryOpExpr(Expr *expr1, std::string op, Expr *expr2);
   std::string UnParse();
   std::string CppCode();
-
- private:
-  BinaryOpExpr() : expr1_(NULL), operator_(NULL), expr2_(NULL) {}
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
+  bool ReductionOf(const std::string &var, char *op, Expr **term);
+  std::string LazyCppCode(void);
+  bool ProductOf(Expr **a, Expr **b);
+  void ChainFactors(std::vector<Expr *> *factors);
+
+ private:
+  BinaryOpExpr()
+      : expr1_(NULL), operator_(NULL), expr2_(NULL), chain_ordered_(false) {}
   BinaryOpExpr(const BinaryOpExpr &) {}
+  std::string MatrixKernel(std::vector<Expr *> *args);
+  void OrderChain(void);
+  Expr *ChainProduct(const std::vector<Expr *> &factors,
+                     const std::vector<int> &dims,
+                     const std::vector<int> &split, int i, int j);
   Expr *expr1_;
   std::string operator_;
   Expr *expr2_;
+  /*! Whether OrderChain has run, and the factors of a chain whose order is
+      chosen at run time, when it has some factor of unknown shape. */
+  bool chain_ordered_;
+  std::vector<Expr *> chain_;
 };
 
 /*!
@@ -442,6 +645,10 @@ class MatrixRefExpr : public Expr {
   MatrixRefExpr(VarName *var_name, Expr *expr1, Expr *expr2);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
 
  private:
   MatrixRefExpr() : var_name_(NULL), expr1_(NULL), expr2_(NULL) {}
@@ -451,6 +658,44 @@ class MatrixRefExpr : public Expr {
   Expr *expr2_;
 };
 
+/*!
+    This class encompasses productions with the following form:
+    Expr ::= varName '[' Expr '..' Expr ':' Expr '..' Expr ']'
+    The rows and columns from the first bound to the last, inclusive, as a
+    matrix. The generated C++ reads them in place, through a matrix_view.
+*/
+class MatrixSliceExpr : public Expr {
+ public:
+  MatrixSliceExpr(VarName *var_name, Expr *first_row, Expr *last_row,
+                  Expr *first_col, Expr *last_col);
+  std::string UnParse();
+  std::string CppCode();
+  std::string LazyCppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
+
+  /*! The writable block, for an AssignSliceStmt. */
+  std::string BlockCppCode();
+  /*! Emits the bounds into four consecutive int registers and returns the
+      first, as kSlice and kSetSlice expect them. */
+  int CompileBounds(vm::Compiler *compiler);
+  VarName *var_name() { return var_name_; }
+
+ private:
+  MatrixSliceExpr()
+      : var_name_(NULL), first_row_(NULL), last_row_(NULL), first_col_(NULL),
+        last_col_(NULL) {}
+  MatrixSliceExpr(const MatrixSliceExpr &) {}
+  std::string BoundsCppCode();
+  VarName *var_name_;
+  Expr *first_row_;
+  Expr *last_row_;
+  Expr *first_col_;
+  Expr *last_col_;
+};
+
 /*!
     This class encompasses productions with the following form:
     Expr ::= 'True' | 'False'
@@ -459,7 +704,11 @@ class BoolExpr : public Expr {
  public:
   explicit BoolExpr(bool boolean) : boolean_(boolean) {}
   std::string UnParse();
-  // std::string CppCode();
+  std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
+  bool IndependentOf(const std::string &name) { return true; }
 
  private:
   BoolExpr() : boolean_(NULL) {}
@@ -477,6 +726,11 @@ class VarNameExpr : public Expr {
   explicit VarNameExpr(VarName *var_name) : var_name_(var_name) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
+  std::string VariableName(void);
 
  private:
   VarNameExpr() : var_name_(NULL) {}
@@ -494,6 +748,19 @@ class ParenExpr : public Expr {
   explicit ParenExpr(Expr *expr) : expr_(expr) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) { expr_->Analyze(loop); }
+  bool IndependentOf(const std::string &name) {
+    return expr_->IndependentOf(name);
+  }
+  bool ConstIntValue(int *value) { return expr_->ConstIntValue(value); }
+  std::string VariableName(void) { return expr_->VariableName(); }
+  bool ReductionOf(const std::string &var, char *op, Expr **term) {
+    return expr_->ReductionOf(var, op, term);
+  }
+  std::string LazyCppCode(void);
+  bool ProductOf(Expr **a, Expr **b) { return expr_->ProductOf(a, b); }
 
  private:
   ParenExpr() : expr_(NULL) {}
@@ -511,6 +778,11 @@ class NestedOrFunctionExpr : public Expr {
   NestedOrFunctionExpr(VarName *var_name, Expr *expr);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
+  std::string LazyCppCode(void);
 
  private:
   NestedOrFunctionExpr() : var_name_(NULL), expr_(NULL) {}
@@ -529,6 +801,8 @@ class LetExpr : public Expr {
   LetExpr(Stmts *stmts, Expr *expr);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
 
  private:
   LetExpr() : stmts_(NULL), expr_(NULL) {}
@@ -547,6 +821,10 @@ class IfExpr : public Expr {
   IfExpr(Expr *expr1, Expr *expr2, Expr *expr3);
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
 
  private:
   IfExpr() : expr1_(NULL), expr2_(NULL), expr3_(NULL) {}
@@ -565,6 +843,10 @@ class NotExpr : public Expr {
   explicit NotExpr(Expr *expr) : expr_(expr) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop);
+  bool IndependentOf(const std::string &name);
 
  private:
   NotExpr() : expr_(NULL) {}
@@ -581,6 +863,11 @@ class IntConstExpr : public Expr {
   explicit IntConstExpr(std::string const_int) : const_int_(const_int) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
+  bool IndependentOf(const std::string &name) { return true; }
+  bool ConstIntValue(int *value);
 
  private:
   IntConstExpr() : const_int_(NULL) {}
@@ -599,6 +886,10 @@ class FloatConstExpr : public Expr {
       : const_float_(const_float) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
+  bool IndependentOf(const std::string &name) { return true; }
 
  private:
   FloatConstExpr();
@@ -617,6 +908,10 @@ class StringConstExpr : public Expr {
       : string_const_(const_string) {}
   std::string UnParse();
   std::string CppCode();
+  void TypeCheck(SymbolTable *symbols);
+  int Compile(vm::Compiler *compiler);
+  void Analyze(LoopAnalysis *loop) {}
+  bool IndependentOf(const std::string &name) { return true; }
 
  private:
   StringConstExpr() : string_const_(NULL) {}
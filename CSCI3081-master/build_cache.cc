@@ -0,0 +1,473 @@
+/*******************************************************************************
+ * Name            : build_cache.cc
+ * Project         : fcal
+ * Module          : driver
+ * Description     : Implementation of the native build cache
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include "include/Matrix.h"
+#include "include/build_cache.h"
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace driver {
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! The headers generated programs compile against. */
+static const char *const kRuntimeHeaders[] = {
+    "fcalrt.h",  "Matrix.h", "fixed_matrix.h", "matrix_expr.h",
+    "profile.h", "simd.h",   "thread_pool.h"};
+static const int kNumRuntimeHeaders =
+    sizeof(kRuntimeHeaders) / sizeof(char *);
+
+/*******************************************************************************
+ * SHA-256
+ ******************************************************************************/
+static const uint32_t kSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static uint32_t RotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void Sha256Block(const unsigned char *block, uint32_t *h) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (block[4 * i] << 24) | (block[4 * i + 1] << 16) |
+           (block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t v[8];
+  for (int i = 0; i < 8; i++) v[i] = h[i];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = RotateRight(v[4], 6) ^ RotateRight(v[4], 11) ^
+                  RotateRight(v[4], 25);
+    uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    uint32_t t1 = v[7] + s1 + ch + kSha256K[i] + w[i];
+    uint32_t s0 = RotateRight(v[0], 2) ^ RotateRight(v[0], 13) ^
+                  RotateRight(v[0], 22);
+    uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+    uint32_t t2 = s0 + maj;
+    for (int j = 7; j > 0; j--) v[j] = v[j - 1];
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++) h[i] += v[i];
+} /* Sha256Block() */
+
+std::string Sha256Hex(const std::string &data) {
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  std::string padded = data;
+  uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+  padded += static_cast<char>(0x80);
+  while (padded.size() % 64 != 56) padded += static_cast<char>(0);
+  for (int i = 7; i >= 0; i--) {
+    padded += static_cast<char>((bits >> (8 * i)) & 0xff);
+  }
+  for (unsigned i = 0; i < padded.size(); i += 64) {
+    Sha256Block(reinterpret_cast<const unsigned char *>(padded.data()) + i, h);
+  }
+
+  char hex[65];
+  for (int i = 0; i < 8; i++) snprintf(hex + 8 * i, 9, "%08x", h[i]);
+  return std::string(hex, 64);
+} /* Sha256Hex() */
+
+/*******************************************************************************
+ * Helpers
+ ******************************************************************************/
+static std::string ReadFile(const std::string &path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool WriteFile(const std::string &path, const std::string &data) {
+  std::ofstream out(path.c_str(), std::ios::binary);
+  out << data;
+  return out.good();
+}
+
+static bool IsExecutable(const std::string &path) {
+  return access(path.c_str(), X_OK) == 0;
+}
+
+/*! mkdir -p */
+static void MakeDirs(const std::string &path) {
+  for (unsigned i = 1; i <= path.size(); i++) {
+    if (i == path.size() || path[i] == '/') {
+      mkdir(path.substr(0, i).c_str(), 0755);
+    }
+  }
+}
+
+/*! Places a copy of the cached executable at dst, sharing the file when
+    both are on the same file system. */
+static bool Place(const std::string &src, const std::string &dst) {
+  unlink(dst.c_str());
+  if (link(src.c_str(), dst.c_str()) == 0) return true;
+  if (!WriteFile(dst, ReadFile(src))) return false;
+  return chmod(dst.c_str(), 0755) == 0;
+}
+
+/*! Starts the command args, writing everything it prints to log. Returns
+    the child's pid, or -1. */
+static pid_t StartCommand(const std::vector<std::string> &args,
+                          const std::string &log) {
+  std::vector<char *> argv;
+  for (unsigned i = 0; i < args.size(); i++) {
+    argv.push_back(const_cast<char *>(args[i].c_str()));
+  }
+  argv.push_back(NULL);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      dup2(fd, 1);
+      dup2(fd, 2);
+      close(fd);
+    }
+    execvp(argv[0], &argv[0]);
+    fprintf(stderr, "cannot run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  return pid;
+} /* StartCommand() */
+
+/*! Waits for a command started by StartCommand. On failure the contents of
+    its log are appended to errors. */
+static bool FinishCommand(pid_t pid, const std::string &log,
+                          std::string *errors) {
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    *errors += "cannot run the compiler\n";
+    return false;
+  }
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) return true;
+  std::string output = ReadFile(log);
+  *errors += output.empty() ? "compiler failed\n" : output;
+  return false;
+}
+
+static bool RunCommand(const std::vector<std::string> &args,
+                       const std::string &log, std::string *errors) {
+  return FinishCommand(StartCommand(args, log), log, errors);
+}
+
+static bool EndsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+std::string NormalizeCode(const std::string &cpp_code) {
+  std::string out;
+  std::string line;
+  std::istringstream in(cpp_code);
+  while (std::getline(in, line)) {
+    std::string normal;
+    char quote = 0;
+    bool space = false;
+    for (unsigned i = 0; i < line.size(); i++) {
+      char ch = line[i];
+      if (quote) {
+        normal += ch;
+        if (ch == '\\' && i + 1 < line.size()) {
+          normal += line[++i];
+        } else if (ch == quote) {
+          quote = 0;
+        }
+      } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+        space = true;
+      } else {
+        if (space && !normal.empty()) normal += ' ';
+        space = false;
+        if (ch == '"' || ch == '\'') quote = ch;
+        normal += ch;
+      }
+    }
+    if (!normal.empty()) out += normal + "\n";
+  }
+  return out;
+} /* NormalizeCode() */
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+BuildConfig::BuildConfig(void)
+    : compiler(getenv("CXX") ? getenv("CXX") : "g++"),
+      flags(),
+      runtime(),
+      runtime_version(FCAL_RUNTIME_VERSION),
+      cache_dir(),
+      max_parallel(4) {
+  flags.push_back("-O2");
+  flags.push_back("-std=c++11");
+  flags.push_back("-pthread");
+  if (getenv("FCAL_CACHE_DIR")) {
+    cache_dir = getenv("FCAL_CACHE_DIR");
+  } else {
+    cache_dir = std::string(getenv("HOME") ? getenv("HOME") : ".") +
+                "/.cache/fcal";
+  }
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_cpus > 0) max_parallel = n_cpus;
+  precompiled_header = false;
+}
+
+/*! Digest of everything besides the program that affects the executable.
+    Runtime files are hashed by content, so rebuilding the runtime without
+    bumping its version still invalidates old entries. */
+std::string BuildCache::ConfigDigest(void) const {
+  std::string config = config_.compiler + '\0' + config_.runtime_version +
+                       '\0' + config_.include_root + '\0' +
+                       (config_.precompiled_header ? "pch" : "") + '\0';
+  for (unsigned i = 0; i < config_.flags.size(); i++) {
+    config += config_.flags[i] + '\0';
+  }
+  for (unsigned i = 0; i < config_.runtime.size(); i++) {
+    config += config_.runtime[i] + '\0' +
+              Sha256Hex(ReadFile(config_.runtime[i]));
+  }
+  /* Most of the runtime is inline in its headers now. */
+  for (int i = 0; i < kNumRuntimeHeaders; i++) {
+    config += Sha256Hex(ReadFile(config_.include_root + "/include/" +
+                                 kRuntimeHeaders[i]));
+  }
+  return Sha256Hex(config);
+}
+
+bool BuildCache::PrepareRuntime(const std::string &config_digest,
+                                std::string *errors) {
+  std::string dir = config_.cache_dir + "/rt/" + config_digest;
+  std::string tmp = config_.cache_dir + "/tmp/rt." + config_digest;
+  std::ostringstream pid;
+  pid << "." << getpid();
+  tmp += pid.str();
+  std::string log = tmp + ".log";
+
+  std::vector<std::string> base(1, config_.compiler);
+  base.insert(base.end(), config_.flags.begin(), config_.flags.end());
+  if (!config_.include_root.empty()) {
+    base.push_back("-I" + config_.include_root);
+  }
+
+  /* Compiled sources are archived; anything else is linked as given. */
+  std::vector<std::string> sources;
+  link_.clear();
+  for (unsigned i = 0; i < config_.runtime.size(); i++) {
+    if (EndsWith(config_.runtime[i], ".cc")) {
+      sources.push_back(config_.runtime[i]);
+    } else {
+      link_.push_back(config_.runtime[i]);
+    }
+  }
+  std::string library = dir + "/libfcalrt.a";
+  if (!sources.empty() && access(library.c_str(), R_OK) != 0) {
+    MakeDirs(dir);
+    std::vector<std::string> archive;
+    archive.push_back("ar");
+    archive.push_back("rcs");
+    archive.push_back(tmp + ".a");
+    bool ok = true;
+    for (unsigned i = 0; ok && i < sources.size(); i++) {
+      std::ostringstream object;
+      object << tmp << "." << i << ".o";
+      std::vector<std::string> args = base;
+      args.push_back("-c");
+      args.push_back(sources[i]);
+      args.push_back("-o");
+      args.push_back(object.str());
+      ok = RunCommand(args, log, errors);
+      archive.push_back(object.str());
+    }
+    unlink((tmp + ".a").c_str());
+    ok = ok && RunCommand(archive, log, errors) &&
+         rename((tmp + ".a").c_str(), library.c_str()) == 0;
+    for (unsigned i = 3; i < archive.size(); i++) unlink(archive[i].c_str());
+    unlink(log.c_str());
+    if (!ok) return false;
+  }
+  if (!sources.empty()) link_.insert(link_.begin(), library);
+
+  /* GCC looks for include/fcalrt.h.gch in each include directory before
+     the header itself, so putting dir first on the path is enough for the
+     generated programs to pick the precompiled header up. */
+  flags_ = config_.flags;
+  if (config_.precompiled_header) {
+    std::string pch = dir + "/include/fcalrt.h.gch";
+    if (access(pch.c_str(), R_OK) != 0) {
+      MakeDirs(dir + "/include");
+      std::vector<std::string> args = base;
+      args.push_back("-x");
+      args.push_back("c++-header");
+      args.push_back(config_.include_root + "/include/fcalrt.h");
+      args.push_back("-o");
+      args.push_back(tmp + ".gch");
+      bool ok = RunCommand(args, log, errors) &&
+                rename((tmp + ".gch").c_str(), pch.c_str()) == 0;
+      unlink((tmp + ".gch").c_str());
+      unlink(log.c_str());
+      if (!ok) return false;
+    }
+    flags_.push_back("-I" + dir);
+  }
+  if (!config_.include_root.empty()) {
+    flags_.push_back("-I" + config_.include_root);
+  }
+  return true;
+} /* BuildCache::PrepareRuntime() */
+
+std::string BuildCache::Key(const std::string &cpp_code) const {
+  return Sha256Hex(ConfigDigest() + '\0' + NormalizeCode(cpp_code));
+}
+
+std::string BuildCache::CachePath(const std::string &key) const {
+  return config_.cache_dir + "/" + key.substr(0, 2) + "/" + key.substr(2);
+}
+
+BuildResult BuildCache::Build(const BuildJob &job) {
+  return BuildAll(std::vector<BuildJob>(1, job))[0];
+}
+
+std::vector<BuildResult> BuildCache::BuildAll(
+    const std::vector<BuildJob> &jobs) {
+  std::string config_digest = ConfigDigest();
+  std::string tmp_dir = config_.cache_dir + "/tmp";
+  MakeDirs(tmp_dir);
+  std::string runtime_errors;
+  bool runtime_ok = PrepareRuntime(config_digest, &runtime_errors);
+
+  /* Look every job up and collect the distinct programs that are missing. */
+  std::vector<BuildResult> results(jobs.size());
+  std::vector<std::string> keys(jobs.size());
+  std::map<std::string, int> missing;  // key -> first job with that key
+  for (unsigned i = 0; i < jobs.size(); i++) {
+    keys[i] =
+        Sha256Hex(config_digest + '\0' + NormalizeCode(jobs[i].cpp_code));
+    results[i].cache_hit = IsExecutable(CachePath(keys[i]));
+    if (!results[i].cache_hit && !missing.count(keys[i])) missing[keys[i]] = i;
+  }
+
+  /* Compile the missing programs, keeping up to max_parallel compilers
+     running. Each one builds into the tmp directory and is renamed into
+     place when it succeeds, so concurrent drivers sharing a cache never see
+     a partial executable. */
+  struct Running {
+    pid_t pid;
+    std::string key;
+    std::string prefix;
+  };
+  std::deque<Running> running;
+  std::map<std::string, std::string> errors;
+  std::map<std::string, int>::iterator next = missing.begin();
+  while (next != missing.end() || !running.empty()) {
+    if (next != missing.end() &&
+        static_cast<int>(running.size()) < config_.max_parallel) {
+      std::ostringstream prefix;
+      prefix << tmp_dir << "/" << next->first << "." << getpid();
+      Running build = {-1, next->first, prefix.str()};
+      if (!runtime_ok) {
+        errors[build.key] = runtime_errors;
+        ++next;
+        continue;
+      }
+      WriteFile(build.prefix + ".cc", jobs[next->second].cpp_code);
+      std::vector<std::string> args(1, config_.compiler);
+      args.insert(args.end(), flags_.begin(), flags_.end());
+      args.push_back("-o");
+      args.push_back(build.prefix + ".bin");
+      args.push_back(build.prefix + ".cc");
+      args.insert(args.end(), link_.begin(), link_.end());
+      build.pid = StartCommand(args, build.prefix + ".log");
+      running.push_back(build);
+      ++next;
+      continue;
+    }
+
+    Running build = running.front();
+    running.pop_front();
+    std::string error;
+    if (FinishCommand(build.pid, build.prefix + ".log", &error)) {
+      std::string path = CachePath(build.key);
+      MakeDirs(path.substr(0, path.rfind('/')));
+      if (rename((build.prefix + ".bin").c_str(), path.c_str()) != 0) {
+        errors[build.key] = "cannot store " + path;
+      }
+    } else {
+      errors[build.key] = error;
+    }
+    unlink((build.prefix + ".cc").c_str());
+    unlink((build.prefix + ".bin").c_str());
+    unlink((build.prefix + ".log").c_str());
+  } /* while() */
+
+  for (unsigned i = 0; i < jobs.size(); i++) {
+    BuildResult &result = results[i];
+    std::map<std::string, std::string>::iterator error = errors.find(keys[i]);
+    result.ok = error == errors.end();
+    if (!result.ok) {
+      result.errors = error->second;
+      continue;
+    }
+    result.executable = CachePath(keys[i]);
+    if (!jobs[i].output.empty()) {
+      if (Place(result.executable, jobs[i].output)) {
+        result.executable = jobs[i].output;
+      } else {
+        result.ok = false;
+        result.errors = "cannot write " + jobs[i].output;
+      }
+    }
+  }
+  return results;
+} /* BuildCache::BuildAll() */
+
+} /* namespace driver */
+} /* namespace fcal */
@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * Name            : build_cache.h
+ * Project         : fcal
+ * Module          : driver
+ * Description     : Builds the C++ generated for FCAL programs into native
+ *                   executables, reusing executables from a local content
+ *                   addressed cache when the same program was built before.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_BUILD_CACHE_H_
+#define PROJECT_INCLUDE_BUILD_CACHE_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <string>
+#include <vector>
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace driver {
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! How generated programs are built. Everything here is part of the cache
+    key, so changing the compiler, a flag or the runtime never reuses an
+    executable built under the old settings. */
+struct BuildConfig {
+  BuildConfig(void);
+
+  std::string compiler;               // default: $CXX, or g++
+  std::vector<std::string> flags;     // e.g. -O2 -std=c++11 -pthread
+  std::vector<std::string> runtime;   // runtime sources or libraries to link
+  std::string runtime_version;        // default: FCAL_RUNTIME_VERSION
+  std::string include_root;           // directory holding include/fcalrt.h
+  std::string cache_dir;              // default: $FCAL_CACHE_DIR or
+                                      // $HOME/.cache/fcal
+  int max_parallel;                   // concurrent compiler processes
+  bool precompiled_header;            // precompile include/fcalrt.h
+};
+
+/*! One program to build: the output of Root::CppCode and, optionally, a
+    path to place the executable at. */
+struct BuildJob {
+  std::string cpp_code;
+  std::string output;
+};
+
+struct BuildResult {
+  bool ok;
+  bool cache_hit;
+  std::string executable;  // the output path, or the executable in the cache
+  std::string errors;      // compiler output when the build failed
+};
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+class BuildCache {
+ public:
+  explicit BuildCache(const BuildConfig &config) : config_(config) {}
+
+  /*! Builds every job, compiling the ones missing from the cache in
+      parallel. Jobs with identical programs are compiled only once. */
+  std::vector<BuildResult> BuildAll(const std::vector<BuildJob> &jobs);
+  BuildResult Build(const BuildJob &job);
+
+  /*! The cache key of a program under this cache's configuration. */
+  std::string Key(const std::string &cpp_code) const;
+
+ private:
+  std::string CachePath(const std::string &key) const;
+  std::string ConfigDigest(void) const;
+
+  /*! Builds what every program shares once per configuration: the runtime
+      sources are compiled into libfcalrt.a and, if asked for, fcalrt.h is
+      precompiled. Fills in link_ and flags_ for the program builds. */
+  bool PrepareRuntime(const std::string &config_digest, std::string *errors);
+
+  BuildConfig config_;
+  std::vector<std::string> flags_;  // flags used to compile programs
+  std::vector<std::string> link_;   // what programs are linked against
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Collapses runs of white space outside string and character literals and
+    drops blank lines, so that layout differences in the generated code do
+    not produce different keys. Line structure is kept for preprocessor
+    directives. */
+std::string NormalizeCode(const std::string &cpp_code);
+
+/*! The SHA-256 digest of data, in lower case hex. */
+std::string Sha256Hex(const std::string &data);
+
+} /* namespace driver */
+} /* namespace fcal */
+
+#endif  // PROJECT_INCLUDE_BUILD_CACHE_H_
@@ -97,6 +97,10 @@ ExtToken *ExtToken::ExtendToken(parser::Parser *p, Token *tokens) {
       return new ExtToken(p, tokens, ";");
     case kColon:
       return new ExtToken(p, tokens, ":");
+    case kDotDot:
+      return new ExtToken(p, tokens, "..");
+    case kComma:
+      return new ExtToken(p, tokens, ",");
     case kAssign:
       return new ExtToken(p, tokens, "=");
 
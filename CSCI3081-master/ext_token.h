@@ -34,11 +34,12 @@ class ExtToken {
  public:
   ExtToken(parser::Parser *p, Token *t)
       : desc_str_(), lexeme_(t->lexeme()), terminal_(t->terminal()),
-             next_(NULL), parser_(p) {}
+             next_(NULL), parser_(p), line_(t->line()),
+             column_(t->column()) {}
   ExtToken(parser::Parser *p, Token *t, std::string d)
       : desc_str_(d), lexeme_(t->lexeme()),
         terminal_(t->terminal()),
-        parser_(p) {}
+        parser_(p), line_(t->line()), column_(t->column()) {}
 
 
   virtual ~ExtToken() {}
@@ -53,17 +54,21 @@ class ExtToken {
   std::string lexeme(void) const { return lexeme_; }
   ExtToken *next(void) const { return next_; }
   scanner::TokenType terminal(void) const { return terminal_; }
+  int line(void) const { return line_; }
+  int column(void) const { return column_; }
 
  protected:
   parser::Parser *parser(void) { return parser_; }
 
  private:
-  ExtToken(void) : parser_(NULL) {}
+  ExtToken(void) : parser_(NULL), line_(0), column_(0) {}
   std::string desc_str_;
   std::string lexeme_;
   scanner::TokenType terminal_;
   ExtToken *next_;
   parser::Parser *parser_;
+  int line_;
+  int column_;
 };
 
 /*
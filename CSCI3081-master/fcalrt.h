@@ -0,0 +1,26 @@
+/*******************************************************************************
+ * Name            : fcalrt.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : The one header generated programs include. Keeping the
+ *                   whole runtime behind a single first include lets it be
+ *                   precompiled once and reused by every generated program.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_FCALRT_H_
+#define PROJECT_INCLUDE_FCALRT_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <math.h>
+#include <iostream>
+#include "include/Matrix.h"
+#include "include/fixed_matrix.h"
+#include "include/matrix_expr.h"
+#include "include/profile.h"
+#include "include/thread_pool.h"
+
+#endif  // PROJECT_INCLUDE_FCALRT_H_
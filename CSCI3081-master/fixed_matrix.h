@@ -0,0 +1,272 @@
+/*******************************************************************************
+ * Name            : fixed_matrix.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Matrices whose shape is known at compile time, kept on the
+ *                   stack, with unrolled kernels for small transforms.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_FIXED_MATRIX_H_
+#define PROJECT_INCLUDE_FIXED_MATRIX_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include "include/Matrix.h"
+#include "include/matrix_expr.h"
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! Calls f(0), f(1), ..., f(N - 1), each inlined with its argument a
+    constant, so that loops over the elements of a fixed_matrix are fully
+    unrolled whatever the optimizer thinks of their length. */
+template <int N>
+struct FixedUnroll {
+  template <typename F>
+  __attribute__((always_inline)) static void Run(const F &f) {
+    FixedUnroll<N - 1>::Run(f);
+    f(N - 1);
+  }
+};
+
+template <>
+struct FixedUnroll<0> {
+  template <typename F>
+  __attribute__((always_inline)) static void Run(const F &) {}
+};
+
+/*! A rows x cols matrix whose shape is part of its type, with its elements
+    in the object itself, row after row. The code generator declares the
+    small matrices whose shape the type checker knows and no assignment
+    changes as fixed_matrix, so that millions of 3 x 3 or 4 x 4 transforms
+    allocate nothing and check no shapes at run time.
+
+    Everywhere else a fixed_matrix is a matrix_view or matrix_block of its
+    elements, so it mixes with matrices in expressions, slices and
+    kernels. */
+template <int R, int C>
+class fixed_matrix {
+ public:
+  static_assert(R > 0 && C > 0, "a fixed_matrix has elements");
+
+  /*! The elements are not set, as with matrix(R, C). */
+  fixed_matrix(void) {}
+  /*! A copy of m, which must be R x C. Explicit, so that no conversion,
+      such as that of the other branch of c ? f : m, checks a shape that
+      the type checker did not. */
+  explicit fixed_matrix(const matrix_view &m) { copy_from(m); }
+
+  int n_rows(void) const { return R; }
+  int n_cols(void) const { return C; }
+  int stride(void) const { return C; }
+  float *access(const int i, const int j) { return data_ + i * C + j; }
+  const float *access(const int i, const int j) const {
+    return data_ + i * C + j;
+  }
+  float at(const int i, const int j) const { return data_[i * C + j]; }
+  void fill(float value) { std::fill(data_, data_ + R * C, value); }
+  /*! Never shared, so there is nothing to do. */
+  void unshare(void) {}
+
+  matrix_view view(int first_row, int last_row, int first_col,
+                   int last_col) const {
+    CheckSlice(R, C, first_row, last_row, first_col, last_col);
+    return matrix_view(access(first_row, first_col), last_row - first_row + 1,
+                       last_col - first_col + 1, C);
+  }
+  matrix_block block(int first_row, int last_row, int first_col,
+                     int last_col) {
+    CheckSlice(R, C, first_row, last_row, first_col, last_col);
+    return matrix_block(access(first_row, first_col),
+                        last_row - first_row + 1, last_col - first_col + 1, C);
+  }
+  operator matrix_view() const { return matrix_view(data_, R, C, C); }
+  operator matrix_block() { return matrix_block(data_, R, C, C); }
+
+ private:
+  void copy_from(const matrix_view &m) {
+    CheckSameShape(R, C, m.n_rows(), m.n_cols());
+    for (int i = 0; i < R; i++) {
+      std::copy(m.access(i, 0), m.access(i, 0) + C, data_ + i * C);
+    }
+  }
+
+  float data_[R * C];
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+template <int R, int C>
+std::ostream &operator<<(std::ostream &os, const fixed_matrix<R, C> &m) {
+  return os << matrix_view(m);
+}
+
+/*! f(a[i:j], b[i:j]) for every element. */
+template <int R, int C, typename F>
+fixed_matrix<R, C> FixedZip(const fixed_matrix<R, C> &a,
+                            const fixed_matrix<R, C> &b, const F &f) {
+  fixed_matrix<R, C> c;
+  const float *x = a.access(0, 0);
+  const float *y = b.access(0, 0);
+  float *z = c.access(0, 0);
+  FixedUnroll<R * C>::Run([&](int k) { z[k] = f(x[k], y[k]); });
+  return c;
+}
+
+/*! f(a[i:j]) for every element. */
+template <int R, int C, typename F>
+fixed_matrix<R, C> FixedMap(const fixed_matrix<R, C> &a, const F &f) {
+  fixed_matrix<R, C> c;
+  const float *x = a.access(0, 0);
+  float *z = c.access(0, 0);
+  FixedUnroll<R * C>::Run([&](int k) { z[k] = f(x[k]); });
+  return c;
+}
+
+/*! a b, each element summed over k in order, as matrix_gemm does. */
+template <int M, int K, int N>
+fixed_matrix<M, N> FixedProduct(const fixed_matrix<M, K> &a,
+                                const fixed_matrix<K, N> &b) {
+  fixed_matrix<M, N> c;
+  FixedUnroll<M * N>::Run([&](int ij) {
+    const int i = ij / N;
+    const int j = ij % N;
+    float sum = 0;
+    FixedUnroll<K>::Run([&](int k) { sum += a.at(i, k) * b.at(k, j); });
+    *c.access(i, j) = sum;
+  });
+  return c;
+}
+
+/*
+ * The lazy_ functions of matrix_expr.h for operands that are all
+ * fixed_matrix compute their value at once instead of building an
+ * expression: a fixed_matrix is cheaper to compute than a node is to
+ * build. Every fixed_matrix parameter is taken by value, so that these are
+ * preferred to the general lazy_ templates, whose parameters are
+ * forwarding references, for any kind of argument. An operand that is not
+ * a fixed_matrix selects the general template, where a fixed_matrix is a
+ * leaf like a matrix.
+ */
+template <int R, int C>
+struct ExprNode<fixed_matrix<R, C> > {
+  typedef MatrixLeaf type;
+};
+
+template <int R, int C>
+fixed_matrix<R, C> matrix_eval(fixed_matrix<R, C> e) {
+  return e;
+}
+
+template <int R, int C>
+void matrix_assign(fixed_matrix<R, C> &m, fixed_matrix<R, C> value) {
+  m = value;
+}
+
+/*! m = e, for an e that is not a fixed_matrix, evaluated into m. */
+template <int R, int C, typename E>
+void matrix_assign(fixed_matrix<R, C> &m, E &&e) {
+  matrix_assign(matrix_block(m), std::forward<E>(e));
+}
+
+template <int R, int C>
+void matrix_assign(matrix &m, fixed_matrix<R, C> value) {
+  matrix_assign(m, matrix_view(value));
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_add(fixed_matrix<R, C> a, fixed_matrix<R, C> b) {
+  return FixedZip(a, b, [](float x, float y) { return x + y; });
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_subtract(fixed_matrix<R, C> a,
+                                 fixed_matrix<R, C> b) {
+  return FixedZip(a, b, [](float x, float y) { return x - y; });
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_hadamard(fixed_matrix<R, C> a,
+                                 fixed_matrix<R, C> b) {
+  return FixedZip(a, b, [](float x, float y) { return x * y; });
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_add_scalar(fixed_matrix<R, C> a, float s) {
+  return FixedMap(a, [s](float x) { return x + s; });
+}
+
+/*! x - s and x + -s round the same way. */
+template <int R, int C>
+fixed_matrix<R, C> lazy_subtract_scalar(fixed_matrix<R, C> a, float s) {
+  return lazy_add_scalar(a, -s);
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_scale(fixed_matrix<R, C> a, float s) {
+  return FixedMap(a, [s](float x) { return x * s; });
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_divide_scalar(fixed_matrix<R, C> a, float s) {
+  return FixedMap(a, [s](float x) { return x / s; });
+}
+
+template <int R, int C>
+fixed_matrix<R, C> lazy_subtract_from(fixed_matrix<R, C> a, float s) {
+  return FixedMap(a, [s](float x) { return s - x; });
+}
+
+template <int M, int K, int N>
+fixed_matrix<M, N> lazy_multiply(fixed_matrix<M, K> a, fixed_matrix<K, N> b) {
+  return FixedProduct(a, b);
+}
+
+template <int M, int K>
+fixed_matrix<M, 1> lazy_vector_multiply(fixed_matrix<M, K> a,
+                                        fixed_matrix<K, 1> v) {
+  return FixedProduct(a, v);
+}
+
+/*! The product is added to z, as matrix_gemm accumulates into z. */
+template <int M, int K, int N>
+fixed_matrix<M, N> lazy_multiply_add(fixed_matrix<M, K> a,
+                                     fixed_matrix<K, N> b,
+                                     fixed_matrix<M, N> z) {
+  return FixedZip(FixedProduct(a, b), z,
+                  [](float x, float y) { return y + x; });
+}
+
+template <int R, int C>
+fixed_matrix<C, R> lazy_transpose(fixed_matrix<R, C> a) {
+  fixed_matrix<C, R> t;
+  FixedUnroll<R * C>::Run(
+      [&](int k) { *t.access(k % C, k / C) = a.at(k / C, k % C); });
+  return t;
+}
+
+#define FCAL_FIXED_MATH(function, f)                                    \
+  template <int R, int C>                                               \
+  fixed_matrix<R, C> lazy_##function(fixed_matrix<R, C> a) {            \
+    return FixedMap(a, [](float x) { return f(x); });                   \
+  }
+FCAL_FIXED_MATH(sqrt, sqrtf)
+FCAL_FIXED_MATH(exp, expf)
+FCAL_FIXED_MATH(log, logf)
+FCAL_FIXED_MATH(sin, sinf)
+FCAL_FIXED_MATH(cos, cosf)
+FCAL_FIXED_MATH(tan, tanf)
+FCAL_FIXED_MATH(fabs, fabsf)
+FCAL_FIXED_MATH(floor, floorf)
+FCAL_FIXED_MATH(ceil, ceilf)
+#undef FCAL_FIXED_MATH
+
+#endif  // PROJECT_INCLUDE_FIXED_MATRIX_H_
@@ -0,0 +1,393 @@
+/*******************************************************************************
+ * Name            : gemm.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Implementation of the cache blocked matrix multiply
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include "include/gemm.h"
+#include "include/simd.h"
+#include "include/thread_pool.h"
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! Block sizes. A kGemmKC deep sliver of A and of B together fit in L1, a
+    kGemmMC x kGemmKC block of A fits in L2, and a kGemmKC x kGemmNC panel of
+    B fits in L3. The micro-kernel, and with it the size of the slivers,
+    depends on the instruction set; see simd.h. kGemmNC is a multiple of
+    every sliver width. */
+static const int kGemmKC = 256;
+static const int kGemmMC = 128;
+static const int kGemmNC = 4096;
+
+/*! Products with fewer multiply-adds than this are not worth packing. */
+static const double kGemmMinBlocked = 64.0 * 64 * 64;
+
+/*! The smallest crossover of the Strassen-Winograd recursion. Below it the
+    additions cost more than the multiplies they save. */
+static const int kStrassenMinCrossover = 256;
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! Cache line aligned scratch space for packed operands. */
+class GemmBuffer {
+ public:
+  GemmBuffer(void) : data_(NULL), size_(0) {}
+  ~GemmBuffer(void) { free(data_); }
+
+  float *Get(size_t size) {
+    if (size > size_) {
+      free(data_);
+      void *p = NULL;
+      if (posix_memalign(&p, 64, size * sizeof(float)) != 0) {
+        std::cout << "out of memory for matrix multiply" << std::endl;
+        exit(1);
+      }
+      data_ = static_cast<float *>(p);
+      size_ = size;
+    }
+    return data_;
+  }
+
+ private:
+  GemmBuffer(const GemmBuffer &);
+
+  float *data_;
+  size_t size_;
+};
+
+/*! An operand as gemm reads it: element [i:j] at data[i * rs + j * cs]. */
+struct GemmOperand {
+  const float *data;
+  size_t rs;
+  size_t cs;
+
+  /*! The block whose first element is [i:j]. */
+  GemmOperand block(int i, int j) const {
+    GemmOperand b = {data + i * rs + j * cs, rs, cs};
+    return b;
+  }
+};
+
+/*! Each thread packs its blocks of A into its own buffer. */
+static thread_local GemmBuffer packed_a_buffer;
+
+/*******************************************************************************
+ * Global Variables
+ ******************************************************************************/
+static int ClampCrossover(int crossover) {
+  return crossover <= 0 ? 0 : std::max(crossover, kStrassenMinCrossover);
+}
+
+/*! $FCAL_STRASSEN, the crossover, or 0, for off. */
+static int ConfiguredCrossover(void) {
+  const char *crossover = getenv("FCAL_STRASSEN");
+  return crossover ? ClampCrossover(atoi(crossover)) : 0;
+}
+
+static std::atomic<int> strassen_crossover(ConfiguredCrossover());
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Copies the mc x kc block at a, whose element [i:p] is at
+    a[i * rs + p * cs], into slivers of mr rows, each stored column by
+    column, padding the last sliver with zeros. */
+static void PackA(int mc, int kc, const float *a, size_t rs, size_t cs,
+                  int mr, float *packed) {
+  for (int i0 = 0; i0 < mc; i0 += mr) {
+    int rows = std::min(mr, mc - i0);
+    for (int p = 0; p < kc; p++) {
+      for (int i = 0; i < rows; i++) packed[i] = a[(i0 + i) * rs + p * cs];
+      for (int i = rows; i < mr; i++) packed[i] = 0;
+      packed += mr;
+    }
+  }
+}
+
+/*! Copies the kc x nc panel at b, whose element [p:j] is at
+    b[p * rs + j * cs], into slivers of nr columns, each stored row by row,
+    padding the last sliver with zeros. */
+static void PackB(int kc, int nc, const float *b, size_t rs, size_t cs,
+                  int nr, float *packed) {
+  for (int j0 = 0; j0 < nc; j0 += nr) {
+    int cols = std::min(nr, nc - j0);
+    for (int p = 0; p < kc; p++) {
+      const float *row = b + p * rs + j0 * cs;
+      if (cs == 1) {
+        for (int j = 0; j < cols; j++) packed[j] = row[j];
+      } else {
+        for (int j = 0; j < cols; j++) packed[j] = row[j * cs];
+      }
+      for (int j = cols; j < nr; j++) packed[j] = 0;
+      packed += nr;
+    }
+  }
+}
+
+/*! Row by row product for small operands, with the same strides. The
+    inner loop is an axpy over a row of B, which the compiler vectorizes
+    when B is not transposed. */
+static void SmallGemm(int m, int n, int k, const float *a, size_t a_rs,
+                      size_t a_cs, const float *b, size_t b_rs, size_t b_cs,
+                      float *c, int ldc) {
+  for (int i = 0; i < m; i++) {
+    float *row = c + static_cast<size_t>(i) * ldc;
+    for (int p = 0; p < k; p++) {
+      float aip = a[i * a_rs + p * a_cs];
+      const float *brow = b + p * b_rs;
+      if (b_cs == 1) {
+        for (int j = 0; j < n; j++) row[j] += aip * brow[j];
+      } else {
+        for (int j = 0; j < n; j++) row[j] += aip * brow[j * b_cs];
+      }
+    }
+  }
+}
+
+/*! gemm by blocks, for operands read with the given strides. */
+static void BlockedGemm(int m, int n, int k, const float *a, size_t a_rs,
+                        size_t a_cs, const float *b, size_t b_rs,
+                        size_t b_cs, float beta, float *c, int ldc) {
+  if (beta != 1) {
+    for (int i = 0; i < m; i++) {
+      float *row = c + static_cast<size_t>(i) * ldc;
+      if (beta == 0) {
+        std::fill_n(row, n, 0.0f);
+      } else {
+        for (int j = 0; j < n; j++) row[j] *= beta;
+      }
+    }
+  }
+  if (m == 0 || n == 0 || k == 0) return;
+
+  if (static_cast<double>(m) * n * k < kGemmMinBlocked) {
+    SmallGemm(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, c, ldc);
+    return;
+  }
+
+  const SimdKernels &kernels = simd_kernels();
+  const int mr = kernels.gemm_mr;
+  const int nr = kernels.gemm_nr;
+
+  /* Smaller blocks of A when there are too few rows to keep every thread
+     busy with full ones. */
+  int threads = ThreadPool::instance().n_threads();
+  int mc = (m + threads - 1) / threads;
+  mc = std::min(kGemmMC / mr * mr, (mc + mr - 1) / mr * mr);
+  int n_blocks = (m + mc - 1) / mc;
+
+  GemmBuffer packed_b_buffer;
+  int nc_max = std::min(kGemmNC, (n + nr - 1) / nr * nr);
+  float *packed_b = packed_b_buffer.Get(kGemmKC * nc_max);
+
+  for (int jc = 0; jc < n; jc += kGemmNC) {
+    int nc = std::min(kGemmNC, n - jc);
+    for (int pc = 0; pc < k; pc += kGemmKC) {
+      int kc = std::min(kGemmKC, k - pc);
+      PackB(kc, nc, b + pc * b_rs + jc * b_cs, b_rs, b_cs, nr, packed_b);
+
+      parallel_for(0, n_blocks, 1, [&](int block) {
+        int ic = block * mc;
+        int rows = std::min(mc, m - ic);
+        float *packed_a = packed_a_buffer.Get(kGemmMC * kGemmKC);
+        PackA(rows, kc, a + ic * a_rs + pc * a_cs, a_rs, a_cs, mr, packed_a);
+        for (int jr = 0; jr < nc; jr += nr) {
+          for (int ir = 0; ir < rows; ir += mr) {
+            kernels.gemm(kc, packed_a + ir * kc, packed_b + jr * kc,
+                         c + static_cast<size_t>(ic + ir) * ldc + jc + jr,
+                         ldc, std::min(mr, rows - ir), std::min(nr, nc - jr));
+          }
+        }
+      });
+    }
+  }
+} /* BlockedGemm() */
+
+static void Multiply(int m, int n, int k, const GemmOperand &a,
+                     const GemmOperand &b, float beta, float *c, int ldc);
+
+/*! The sum of the rows x cols blocks terms[t] times signs[t], in buffer,
+    whose rows it returns as an operand. */
+static GemmOperand Combine(int rows, int cols, const GemmOperand *terms,
+                           const float *signs, int n_terms,
+                           GemmBuffer *buffer) {
+  float *sum = buffer->Get(static_cast<size_t>(rows) * cols);
+  for (int i = 0; i < rows; i++) {
+    float *row = sum + static_cast<size_t>(i) * cols;
+    for (int t = 0; t < n_terms; t++) {
+      const float *x = terms[t].data + i * terms[t].rs;
+      const size_t cs = terms[t].cs;
+      const float sign = signs[t];
+      if (t == 0 && cs == 1) {
+        for (int j = 0; j < cols; j++) row[j] = sign * x[j];
+      } else if (t == 0) {
+        for (int j = 0; j < cols; j++) row[j] = sign * x[j * cs];
+      } else if (cs == 1) {
+        for (int j = 0; j < cols; j++) row[j] += sign * x[j];
+      } else {
+        for (int j = 0; j < cols; j++) row[j] += sign * x[j * cs];
+      }
+    }
+  }
+  GemmOperand operand = {sum, static_cast<size_t>(cols), 1};
+  return operand;
+}
+
+/*! c = value + beta c, where c is not read when beta is 0. */
+static inline void Store(float value, float beta, float *c) {
+  *c = beta == 0 ? value : value + beta * *c;
+}
+
+/*!
+    Winograd's form of Strassen's algorithm: the product of the halves of
+    the even part of the operands takes seven half-size products, computed
+    in parallel and each recursively in turn, instead of eight:
+
+      P1 = A11 B11            P5 = S1 T1   S1 = A21 + A22   T1 = B12 - B11
+      P2 = A12 B21            P6 = S2 T2   S2 = S1 - A11    T2 = B22 - T1
+      P3 = S4 B22             P7 = S3 T3   S3 = A11 - A21   T3 = B22 - B12
+      P4 = A22 T4                          S4 = A12 - S2    T4 = T2 - B21
+
+      C11 = P1 + P2           C21 = P1 + P6 + P7 - P4
+      C12 = P1 + P6 + P5 + P3 C22 = P1 + P6 + P7 + P5
+
+    Each product forms the sums it needs from the quadrants itself, so that
+    the seven are independent. An odd last row, column or step of the sum
+    is peeled off and multiplied by the blocked code.
+*/
+static void StrassenGemm(int m, int n, int k, const GemmOperand &a,
+                         const GemmOperand &b, float beta, float *c,
+                         int ldc) {
+  const int h = m / 2;
+  const int w = n / 2;
+  const int d = k / 2;
+  const GemmOperand a11 = a, a12 = a.block(0, d), a21 = a.block(h, 0),
+                    a22 = a.block(h, d);
+  const GemmOperand b11 = b, b12 = b.block(0, w), b21 = b.block(d, 0),
+                    b22 = b.block(d, w);
+
+  GemmBuffer buffers[7];
+  float *products[7];
+  for (int p = 0; p < 7; p++) {
+    products[p] = buffers[p].Get(static_cast<size_t>(h) * w);
+  }
+  parallel_for(0, 7, 1, [&](int p) {
+    GemmBuffer left, right;
+    GemmOperand x, y;
+    switch (p) {
+      case 0:
+        x = a11;
+        y = b11;
+        break;
+      case 1:
+        x = a12;
+        y = b21;
+        break;
+      case 2: {
+        const GemmOperand s4[] = {a12, a21, a22, a11};
+        const float signs[] = {1, -1, -1, 1};
+        x = Combine(h, d, s4, signs, 4, &left);
+        y = b22;
+        break;
+      }
+      case 3: {
+        const GemmOperand t4[] = {b22, b12, b11, b21};
+        const float signs[] = {1, -1, 1, -1};
+        x = a22;
+        y = Combine(d, w, t4, signs, 4, &right);
+        break;
+      }
+      case 4: {
+        const GemmOperand s1[] = {a21, a22}, t1[] = {b12, b11};
+        const float s_signs[] = {1, 1}, t_signs[] = {1, -1};
+        x = Combine(h, d, s1, s_signs, 2, &left);
+        y = Combine(d, w, t1, t_signs, 2, &right);
+        break;
+      }
+      case 5: {
+        const GemmOperand s2[] = {a21, a22, a11}, t2[] = {b22, b12, b11};
+        const float s_signs[] = {1, 1, -1}, t_signs[] = {1, -1, 1};
+        x = Combine(h, d, s2, s_signs, 3, &left);
+        y = Combine(d, w, t2, t_signs, 3, &right);
+        break;
+      }
+      default: {
+        const GemmOperand s3[] = {a11, a21}, t3[] = {b22, b12};
+        const float signs[] = {1, -1};
+        x = Combine(h, d, s3, signs, 2, &left);
+        y = Combine(d, w, t3, signs, 2, &right);
+      }
+    } /* switch() */
+    Multiply(h, w, d, x, y, 0, products[p], w);
+  });
+
+  parallel_for(0, h, parallel_grain(2 * w), [&](int i) {
+    const float *p[7];
+    for (int q = 0; q < 7; q++) p[q] = products[q] + static_cast<size_t>(i) * w;
+    float *c1 = c + static_cast<size_t>(i) * ldc;
+    float *c2 = c + static_cast<size_t>(h + i) * ldc;
+    for (int j = 0; j < w; j++) {
+      float u2 = p[0][j] + p[5][j];
+      float u3 = u2 + p[6][j];
+      Store(p[0][j] + p[1][j], beta, &c1[j]);
+      Store(u2 + p[4][j] + p[2][j], beta, &c1[w + j]);
+      Store(u3 - p[3][j], beta, &c2[j]);
+      Store(u3 + p[4][j], beta, &c2[w + j]);
+    }
+  });
+
+  if (k > 2 * d) {
+    Multiply(2 * h, 2 * w, 1, a.block(0, 2 * d), b.block(2 * d, 0), 1, c,
+             ldc);
+  }
+  if (n > 2 * w) {
+    Multiply(2 * h, 1, k, a, b.block(0, 2 * w), beta, c + 2 * w, ldc);
+  }
+  if (m > 2 * h) {
+    Multiply(1, n, k, a.block(2 * h, 0), b, beta,
+             c + static_cast<size_t>(2 * h) * ldc, ldc);
+  }
+} /* StrassenGemm() */
+
+/*! op(a) op(b) + beta c, by Strassen-Winograd while every dimension is at
+    least the crossover, and by blocks below it. */
+static void Multiply(int m, int n, int k, const GemmOperand &a,
+                     const GemmOperand &b, float beta, float *c, int ldc) {
+  int crossover = strassen_crossover.load(std::memory_order_relaxed);
+  if (crossover > 0 && std::min(m, std::min(n, k)) >= crossover) {
+    StrassenGemm(m, n, k, a, b, beta, c, ldc);
+    return;
+  }
+  BlockedGemm(m, n, k, a.data, a.rs, a.cs, b.data, b.rs, b.cs, beta, c, ldc);
+}
+
+void gemm(int m, int n, int k, const float *a, int lda, bool transpose_a,
+          const float *b, int ldb, bool transpose_b, float beta, float *c,
+          int ldc) {
+  /* A transposed operand is read with its strides swapped. */
+  const size_t lda_size = lda;
+  const size_t ldb_size = ldb;
+  const GemmOperand op_a = {a, transpose_a ? 1 : lda_size,
+                            transpose_a ? lda_size : 1};
+  const GemmOperand op_b = {b, transpose_b ? 1 : ldb_size,
+                            transpose_b ? ldb_size : 1};
+  Multiply(m, n, k, op_a, op_b, beta, c, ldc);
+}
+
+void gemm_set_strassen_crossover(int crossover) {
+  strassen_crossover.store(ClampCrossover(crossover));
+}
+
+int gemm_strassen_crossover(void) { return strassen_crossover.load(); }
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ * Name            : gemm.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Cache blocked single precision matrix multiply behind
+ *                   matrix_multiply.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_GEMM_H_
+#define PROJECT_INCLUDE_GEMM_H_
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! C = op(A) op(B) + beta C, where op(A) is m x k, op(B) is k x n and C
+    is m x n, all row-major with the given leading dimensions (the distance
+    in floats between rows). op(X) is X, or the transpose of X when its
+    flag is set, which is read in place. When beta is 0, C is not read. C
+    must not overlap A or B.
+
+    The product is computed in blocks sized for the cache hierarchy: panels
+    of B a few megabytes in size for L3, blocks of A for L2, and slivers of
+    both for L1 that a register blocked micro-kernel multiplies. Panels and
+    blocks are packed into contiguous buffers first, so the micro-kernel
+    reads both operands sequentially whatever their strides or layout.
+    Blocks of rows of C are spread over the thread pool. Small products
+    skip the packing.
+
+    Optionally, products whose dimensions are all at least a crossover are
+    split by the Strassen-Winograd recursion into seven half-size products,
+    which run in parallel, instead of eight. That saves an eighth of the
+    work at each level, but its error bound grows with the depth of the
+    recursion rather than with k alone, so it is off unless asked for. */
+void gemm(int m, int n, int k, const float *a, int lda, bool transpose_a,
+          const float *b, int ldb, bool transpose_b, float beta, float *c,
+          int ldc);
+
+/*! Turns the Strassen-Winograd recursion of gemm on for products whose
+    dimensions are all at least crossover, which is raised to at least 256,
+    or off when crossover is 0. It starts with the crossover in
+    $FCAL_STRASSEN, or off. */
+void gemm_set_strassen_crossover(int crossover);
+int gemm_strassen_crossover(void);
+
+#endif  // PROJECT_INCLUDE_GEMM_H_
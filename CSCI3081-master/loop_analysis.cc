@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * Name            : loop_analysis.cc
+ * Project         : fcal
+ * Module          : ast
+ * Description     : Implementation of the repeat loop dependence analysis
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include "include/loop_analysis.h"
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace ast {
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+bool LoopAnalysis::IsLocal(const std::string &name) const {
+  for (unsigned i = 0; i < scopes_.size(); i++) {
+    if (scopes_[i].count(name)) return true;
+  }
+  return false;
+}
+
+void LoopAnalysis::Declare(const std::string &name) {
+  // A local loop variable would hide the one the analysis is about.
+  if (name == index_) Reject();
+  scopes_.back().insert(name);
+}
+
+void LoopAnalysis::ExitBranch(void) {
+  defined_ = saved_defined_.back();
+  saved_defined_.pop_back();
+}
+
+void LoopAnalysis::Read(const std::string &name) {
+  if (name == index_ || IsLocal(name)) return;
+  reads_.insert(name);
+  if (!defined_.count(name)) exposed_reads_.insert(name);
+}
+
+void LoopAnalysis::Write(const std::string &name) {
+  if (name == index_) Reject();
+  if (IsLocal(name)) return;
+  writes_.insert(name);
+  defined_.insert(name);
+}
+
+void LoopAnalysis::AccessCell(const std::string &name, bool row_is_index,
+                              bool col_is_index, bool write) {
+  if (IsLocal(name)) return;
+  CellAccess access = {row_is_index, col_is_index, write};
+  cells_[name].push_back(access);
+}
+
+bool LoopAnalysis::Reduce(const Node *stmt, const std::string &var, char op,
+                          Expr *term) {
+  if (var == index_ || IsLocal(var) || defined_.count(var)) return false;
+  Reduction reduction = {var, op, term};
+  reductions_[stmt] = reduction;
+  return true;
+}
+
+bool LoopAnalysis::Independent(void) const {
+  if (!independent_) return false;
+
+  /* Scalars written in the body: private copies work only if no iteration
+     reads a value left behind by another one, and only if every iteration
+     writes them, so that the last one leaves the value the serial loop
+     would. */
+  for (std::set<std::string>::const_iterator w = writes_.begin();
+       w != writes_.end(); ++w) {
+    if (exposed_reads_.count(*w) || !defined_.count(*w)) return false;
+  }
+
+  /* Reduction variables may be used for nothing else, and all updates of
+     one must combine the same way. */
+  std::map<std::string, bool> multiplicative;
+  for (std::map<const Node *, Reduction>::const_iterator r =
+           reductions_.begin();
+       r != reductions_.end(); ++r) {
+    const Reduction &reduction = r->second;
+    if (reads_.count(reduction.var) || writes_.count(reduction.var) ||
+        cells_.count(reduction.var)) {
+      return false;
+    }
+    bool is_product = reduction.op == '*';
+    if (multiplicative.count(reduction.var) &&
+        multiplicative[reduction.var] != is_product) {
+      return false;
+    }
+    multiplicative[reduction.var] = is_product;
+  }
+
+  /* Written matrices: every access must be in the slice of the iteration,
+     selected by the loop variable as the row or as the column. */
+  for (std::map<std::string, std::vector<CellAccess> >::const_iterator m =
+           cells_.begin();
+       m != cells_.end(); ++m) {
+    const std::vector<CellAccess> &accesses = m->second;
+    bool written = false;
+    bool by_row = true;
+    bool by_col = true;
+    for (unsigned i = 0; i < accesses.size(); i++) {
+      written = written || accesses[i].write;
+      by_row = by_row && accesses[i].row_is_index;
+      by_col = by_col && accesses[i].col_is_index;
+    }
+    if (!written) continue;
+    if (reads_.count(m->first) || writes_.count(m->first)) return false;
+    if (!by_row && !by_col) return false;
+  }
+  return true;
+} /* LoopAnalysis::Independent() */
+
+std::vector<std::string> LoopAnalysis::Privates(void) const {
+  return std::vector<std::string>(writes_.begin(), writes_.end());
+}
+
+std::vector<std::string> LoopAnalysis::WrittenMatrices(void) const {
+  std::vector<std::string> matrices;
+  for (std::map<std::string, std::vector<CellAccess> >::const_iterator m =
+           cells_.begin();
+       m != cells_.end(); ++m) {
+    for (unsigned i = 0; i < m->second.size(); i++) {
+      if (m->second[i].write) {
+        matrices.push_back(m->first);
+        break;
+      }
+    }
+  }
+  return matrices;
+}
+
+std::vector<std::string> LoopAnalysis::Written(void) const {
+  std::vector<std::string> written = Privates();
+  written.push_back(index_);
+  std::vector<std::string> matrices = WrittenMatrices();
+  written.insert(written.end(), matrices.begin(), matrices.end());
+  for (std::map<const Node *, Reduction>::const_iterator r =
+           reductions_.begin();
+       r != reductions_.end(); ++r) {
+    written.push_back(r->second.var);
+  }
+  return written;
+}
+
+} /* namespace ast */
+} /* namespace fcal */
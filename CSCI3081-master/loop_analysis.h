@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * Name            : loop_analysis.h
+ * Project         : fcal
+ * Module          : ast
+ * Description     : Dependence analysis deciding whether the iterations of a
+ *                   repeat loop can run in parallel.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_LOOP_ANALYSIS_H_
+#define PROJECT_INCLUDE_LOOP_ANALYSIS_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace ast {
+
+class Expr;
+class Node;
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! A statement of the form s = s op term that can be computed as a parallel
+    reduction into a private partial result. */
+struct Reduction {
+  std::string var;
+  char op;  // '+', '-' or '*'
+  Expr *term;
+};
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! What the body of a repeat loop reads and writes, gathered by the
+    Node::Analyze pass over it. Independent() then decides whether distinct
+    iterations can run concurrently:
+
+    - matrices written through m[r:c] must be indexed by the loop variable in
+      the same position in every access, so each iteration owns a slice;
+    - other variables written in the body must be written in every
+      iteration, before they are read, so each iteration can have private
+      copies, unless the only thing done with them is a reduction
+      s = s op term;
+    - names declared in the body are private to the iteration anyway.
+
+    Anything the pass does not understand, like printing or a while loop,
+    rejects the loop. */
+class LoopAnalysis {
+ public:
+  explicit LoopAnalysis(const std::string &index)
+      : index_(index),
+        scopes_(1),
+        independent_(true),
+        has_inner_loop_(false) {}
+
+  const std::string &index(void) const { return index_; }
+  void Reject(void) { independent_ = false; }
+
+  /*! Blocks of the body. Names declared in them are private. */
+  void EnterScope(void) { scopes_.push_back(std::set<std::string>()); }
+  void ExitScope(void) { scopes_.pop_back(); }
+  void Declare(const std::string &name);
+
+  /*! Code that may not run, like the body of an if or an inner loop. What
+      it writes does not count as written before later reads. */
+  void EnterBranch(void) { saved_defined_.push_back(defined_); }
+  void ExitBranch(void);
+  void InnerLoop(void) { has_inner_loop_ = true; }
+
+  /*! A read of a scalar variable, or a use of a whole matrix. */
+  void Read(const std::string &name);
+  void Write(const std::string &name);
+  /*! An access to m[r:c]. row_is_index and col_is_index tell whether r and
+      c are exactly the loop variable. */
+  void AccessCell(const std::string &name, bool row_is_index,
+                  bool col_is_index, bool write);
+  /*! Records stmt as a reduction. Returns false, recording nothing, if
+      var is private or was already written in this iteration, in which
+      case stmt is an ordinary assignment. */
+  bool Reduce(const Node *stmt, const std::string &var, char op, Expr *term);
+
+  /*! True if name was declared inside the loop body. */
+  bool IsLocal(const std::string &name) const;
+
+  bool Independent(void) const;
+  bool has_inner_loop(void) const { return has_inner_loop_; }
+  /*! Variables declared outside the loop that each iteration needs its
+      own copy of. */
+  std::vector<std::string> Privates(void) const;
+  /*! Matrices declared outside the loop that the body writes elements
+      of. */
+  std::vector<std::string> WrittenMatrices(void) const;
+  /*! The names the loop bounds must not depend on. */
+  std::vector<std::string> Written(void) const;
+  const std::map<const Node *, Reduction> &reductions(void) const {
+    return reductions_;
+  }
+
+ private:
+  struct CellAccess {
+    bool row_is_index;
+    bool col_is_index;
+    bool write;
+  };
+
+  std::string index_;
+  std::vector<std::set<std::string> > scopes_;
+  std::set<std::string> defined_;
+  std::vector<std::set<std::string> > saved_defined_;
+  std::set<std::string> reads_;
+  std::set<std::string> exposed_reads_;  // read before written
+  std::set<std::string> writes_;
+  std::map<std::string, std::vector<CellAccess> > cells_;
+  std::map<const Node *, Reduction> reductions_;
+  bool independent_;
+  bool has_inner_loop_;
+};
+
+} /* namespace ast */
+} /* namespace fcal */
+
+#endif  // PROJECT_INCLUDE_LOOP_ANALYSIS_H_
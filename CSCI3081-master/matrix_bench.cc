@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * Name            : matrix_bench.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Benchmark of matrix_multiply against the textbook triple
+ *                   loop it replaced.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "include/Matrix.h"
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! The i-j-k loop matrix_multiply used before it was blocked. */
+static matrix reference_multiply(const matrix &a, const matrix &b) {
+  matrix R(a.n_rows(), b.n_cols());
+  for (int i = 0; i < a.n_rows(); i++) {
+    for (int j = 0; j < b.n_cols(); j++) {
+      float sum = 0;
+      for (int k = 0; k < a.n_cols(); k++) {
+        sum += *a.access(i, k) * *b.access(k, j);
+      }
+      *R.access(i, j) = sum;
+    }
+  }
+  return R;
+}
+
+static matrix random_matrix(int rows, int cols) {
+  matrix m(rows, cols);
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      *m.access(i, j) = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+    }
+  }
+  return m;
+}
+
+/*! Seconds taken by the fastest of enough runs of multiply to take about a
+    second in all, and the product from the last one. */
+template <typename Multiply>
+static double time_multiply(Multiply multiply, const matrix &a,
+                            const matrix &b, matrix *result) {
+  double best = 0;
+  double total = 0;
+  for (int run = 0; run == 0 || (total < 1 && run < 10); run++) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    *result = multiply(a, b);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    best = run == 0 ? seconds : std::min(best, seconds);
+    total += seconds;
+  }
+  return best;
+}
+
+/*! Multiplies square matrices of sizes 64, 128, ... up to max_size (8192 by
+    default) and prints the GFLOP/s of both implementations. The reference
+    is only run up to max_reference_size (2048 by default), past which it
+    takes minutes; where it does run, the largest difference between the
+    two products is printed too.
+
+    usage: matrix_bench [max_size [max_reference_size]] */
+int main(int argc, char **argv) {
+  int max_size = argc > 1 ? atoi(argv[1]) : 8192;
+  int max_reference_size = argc > 2 ? atoi(argv[2]) : 2048;
+
+  printf("%6s %14s %14s %9s %12s\n", "n", "blocked GF/s", "reference GF/s",
+         "speedup", "max error");
+  for (int n = 64; n <= max_size; n *= 2) {
+    matrix a = random_matrix(n, n);
+    matrix b = random_matrix(n, n);
+    matrix c(n, n);
+    double flops = 2.0 * n * n * n;
+    double blocked = time_multiply(matrix_multiply, a, b, &c);
+    printf("%6d %14.2f", n, flops / blocked / 1e9);
+    if (n <= max_reference_size) {
+      matrix r(n, n);
+      double reference = time_multiply(reference_multiply, a, b, &r);
+      float error = 0;
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+          error = fmaxf(error, fabsf(*c.access(i, j) - *r.access(i, j)));
+        }
+      }
+      printf(" %14.2f %8.1fx %12.3g", flops / reference / 1e9,
+             reference / blocked, error);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  return 0;
+}
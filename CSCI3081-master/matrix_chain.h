@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * Name            : matrix_chain.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : The order of a chain of matrix products that multiplies
+ *                   the fewest elements, shared by the compiler, which
+ *                   orders chains whose shapes it knows, and the runtime,
+ *                   which orders the others.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_MATRIX_CHAIN_H_
+#define PROJECT_INCLUDE_MATRIX_CHAIN_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdint.h>
+#include <vector>
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! The best order of the product of a chain of n matrices, where matrix i
+    is dims[i] x dims[i + 1], so dims has n + 1 entries. Element i * n + j
+    of the result, for i < j, is the s at which the product of matrices i
+    to j is split: that of i to s times that of s + 1 to j.
+
+    The order is the one of the fewest scalar multiplications, found by the
+    usual dynamic program over the subchains in O(n^3) steps. Of equally
+    cheap orders the one nearest to left to right is chosen, so a chain is
+    computed as written unless another order is strictly cheaper. */
+inline std::vector<int> ChainOrder(const std::vector<int> &dims) {
+  const int n = dims.size() - 1;
+  std::vector<int64_t> cost(n * n, 0);
+  std::vector<int> split(n * n, 0);
+  for (int length = 2; length <= n; length++) {
+    for (int i = 0; i + length <= n; i++) {
+      const int j = i + length - 1;
+      int64_t best = -1;
+      for (int s = j - 1; s >= i; s--) {
+        int64_t c = cost[i * n + s] + cost[(s + 1) * n + j] +
+                    static_cast<int64_t>(dims[i]) * dims[s + 1] * dims[j + 1];
+        if (best < 0 || c < best) {
+          best = c;
+          split[i * n + j] = s;
+        }
+      }
+      cost[i * n + j] = best;
+    }
+  }
+  return split;
+}
+
+#endif  // PROJECT_INCLUDE_MATRIX_CHAIN_H_
@@ -0,0 +1,584 @@
+/*******************************************************************************
+ * Name            : matrix_expr.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Expression templates that evaluate a whole matrix
+ *                   expression in a single pass, without a temporary matrix
+ *                   for each operator in it.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_MATRIX_EXPR_H_
+#define PROJECT_INCLUDE_MATRIX_EXPR_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include "include/Matrix.h"
+#include "include/simd.h"
+#include "include/thread_pool.h"
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! Elements of a row evaluated at once. Each node of an expression keeps at
+    most one block of this size on the stack, so the blocks stay in L1. */
+const int kExprBlock = 512;
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*
+ * The code generator builds a tree of the nodes below with the lazy_
+ * functions at the end of this file, one for each matrix kernel, and hands
+ * it to matrix_eval or matrix_assign. Every node has
+ *
+ *   int rows() const, int cols() const
+ *     the shape of its value, checked when the node is built;
+ *   void Prepare()
+ *     computes the products in it, which cannot be evaluated a block at a
+ *     time, before its rows are evaluated in parallel;
+ *   const float *Row(int i, int j, int n, float *buffer) const
+ *     elements [i:j] to [i:j+n-1] of its value, computed into buffer, which
+ *     has room for kExprBlock elements, or found in a matrix;
+ *   bool Misaligned(const matrix_view &dst) const
+ *     whether computing element [i:j] of it reads an element of dst other
+ *     than [i:j], so that it cannot be evaluated into dst a row at a time.
+ *
+ * Elementwise nodes compute their blocks with the kernels of simd.h, so a
+ * chain of them reads each operand once and writes the result once.
+ */
+
+inline void CheckSameShape(int rows1, int cols1, int rows2, int cols2) {
+  if (rows1 != rows2 || cols1 != cols2) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+}
+
+/*! A matrix or a block of one used as an operand. The matrix must outlive
+    the expression, which it does when both are part of the same full
+    expression. */
+class MatrixLeaf {
+ public:
+  explicit MatrixLeaf(const matrix_view &m) : m_(m) {}
+  int rows() const { return m_.n_rows(); }
+  int cols() const { return m_.n_cols(); }
+  void Prepare() {}
+  const float *Row(int i, int j, int, float *) const {
+    return m_.access(i, j);
+  }
+  bool Misaligned(const matrix_view &dst) const {
+    return m_.overlaps(dst) && !SameBlock(dst);
+  }
+  const matrix_view &value() const { return m_; }
+  bool SameBlock(const matrix_view &m) const {
+    return m_.access(0, 0) == m.access(0, 0) && m_.stride() == m.stride() &&
+           m_.n_rows() == m.n_rows() && m_.n_cols() == m.n_cols();
+  }
+
+ private:
+  matrix_view m_;
+};
+
+/*! l op r, elementwise. */
+template <typename L, typename R>
+class ZipExpr {
+ public:
+  ZipExpr(L l, R r, ZipKernel kernel)
+      : l_(std::move(l)), r_(std::move(r)), kernel_(kernel) {
+    CheckSameShape(l_.rows(), l_.cols(), r_.rows(), r_.cols());
+  }
+  int rows() const { return l_.rows(); }
+  int cols() const { return l_.cols(); }
+  void Prepare() {
+    l_.Prepare();
+    r_.Prepare();
+  }
+  const float *Row(int i, int j, int n, float *buffer) const {
+    float left[kExprBlock];
+    const float *a = l_.Row(i, j, n, left);
+    const float *b = r_.Row(i, j, n, buffer);
+    kernel_(buffer, a, b, n);
+    return buffer;
+  }
+  bool Misaligned(const matrix_view &dst) const {
+    return l_.Misaligned(dst) || r_.Misaligned(dst);
+  }
+
+ private:
+  L l_;
+  R r_;
+  ZipKernel kernel_;
+};
+
+/*! l op s for every element of l. */
+template <typename L>
+class BroadcastExpr {
+ public:
+  BroadcastExpr(L l, float s, BroadcastKernel kernel)
+      : l_(std::move(l)), s_(s), kernel_(kernel) {}
+  int rows() const { return l_.rows(); }
+  int cols() const { return l_.cols(); }
+  void Prepare() { l_.Prepare(); }
+  const float *Row(int i, int j, int n, float *buffer) const {
+    kernel_(buffer, l_.Row(i, j, n, buffer), n, s_);
+    return buffer;
+  }
+  bool Misaligned(const matrix_view &dst) const { return l_.Misaligned(dst); }
+
+ private:
+  L l_;
+  float s_;
+  BroadcastKernel kernel_;
+};
+
+/*! f of every element of l. */
+template <typename L>
+class MapExpr {
+ public:
+  MapExpr(L l, MapKernel kernel) : l_(std::move(l)), kernel_(kernel) {}
+  int rows() const { return l_.rows(); }
+  int cols() const { return l_.cols(); }
+  void Prepare() { l_.Prepare(); }
+  const float *Row(int i, int j, int n, float *buffer) const {
+    kernel_(buffer, l_.Row(i, j, n, buffer), n);
+    return buffer;
+  }
+  bool Misaligned(const matrix_view &dst) const { return l_.Misaligned(dst); }
+
+ private:
+  L l_;
+  MapKernel kernel_;
+};
+
+/*******************************************************************************
+ * Evaluation
+ ******************************************************************************/
+/*! Evaluates e into dst, which has its shape, a row per task. When e may
+    read dst, each block is computed into a buffer before it is stored,
+    since the operands of a node are computed into the buffer it is
+    given. */
+template <typename E>
+void EvaluateRows(const E &e, const matrix_block &dst, bool may_alias) {
+  const int cols = e.cols();
+  parallel_for(0, e.rows(), parallel_grain(cols), [&](int i) {
+    float buffer[kExprBlock];
+    float *row = dst.access(i, 0);
+    for (int j = 0; j < cols; j += kExprBlock) {
+      int n = std::min(kExprBlock, cols - j);
+      const float *value = e.Row(i, j, n, may_alias ? buffer : row + j);
+      if (value != row + j) std::copy(value, value + n, row + j);
+    }
+  });
+}
+
+/*! The value of e as a new matrix. */
+template <typename E>
+matrix Evaluate(E *e) {
+  matrix result(e->rows(), e->cols());
+  e->Prepare();
+  EvaluateRows(*e, result, false);
+  return result;
+}
+
+/*! Evaluates e into dst, which has its shape. A block that e reads out of
+    step, such as m[1 .. n : 0 .. n] in m[0 .. n - 1 : 0 .. n] = ..., is
+    read whole before dst is written. */
+template <typename E>
+void EvaluateInto(E *e, const matrix_block &dst) {
+  e->Prepare();
+  if (!e->Misaligned(dst)) {
+    EvaluateRows(*e, dst, true);
+    return;
+  }
+  matrix result(e->rows(), e->cols());
+  EvaluateRows(*e, result, false);
+  matrix_copy(result, dst);
+}
+
+/*! The value of an operand that must be whole before it is used: the
+    block itself for a leaf, otherwise *storage, where it is evaluated. */
+inline matrix_view Operand(MatrixLeaf *e, matrix *) { return e->value(); }
+
+template <typename E>
+matrix_view Operand(E *e, matrix *storage) {
+  *storage = Evaluate(e);
+  return *storage;
+}
+
+/*! Whether e is exactly the block m. */
+inline bool IsBlock(const MatrixLeaf *e, const matrix_view &m) {
+  return e->SameBlock(m);
+}
+
+template <typename E>
+bool IsBlock(const E *, const matrix_view &) {
+  return false;
+}
+
+/*******************************************************************************
+ * Transposes
+ ******************************************************************************/
+/*! The transpose of l, as a view: a product reads its operand in the other
+    order instead, and only an elementwise use computes it, when it is
+    prepared. */
+template <typename L>
+class TransposeExpr {
+ public:
+  explicit TransposeExpr(L l) : l_(std::move(l)), value_(0, 0) {}
+  int rows() const { return l_.cols(); }
+  int cols() const { return l_.rows(); }
+  void Prepare() { value_ = Compute(); }
+  const float *Row(int i, int j, int, float *) const {
+    return value_.access(i, j);
+  }
+  bool Misaligned(const matrix_view &) const { return false; }
+  matrix Compute() {
+    matrix storage(0, 0);
+    return matrix_transpose(Operand(&l_, &storage));
+  }
+  L *operand() { return &l_; }
+
+ private:
+  L l_;
+  matrix value_;
+};
+
+template <typename L>
+matrix Evaluate(TransposeExpr<L> *e) {
+  return e->Compute();
+}
+
+/*! m = transpose(m) swaps the elements of m in place. */
+template <typename L>
+void EvaluateInto(TransposeExpr<L> *e, const matrix_block &dst) {
+  if (IsBlock(e->operand(), dst)) {
+    matrix_transpose_in_place(dst);
+    return;
+  }
+  matrix storage(0, 0);
+  matrix_view a = Operand(e->operand(), &storage);
+  if (a.overlaps(dst)) {
+    matrix_copy(matrix_transpose(a), dst);
+    return;
+  }
+  matrix_transpose_into(a, dst);
+}
+
+/*! The value of a factor of a product, as Operand, and in *transposed
+    whether the product should read it transposed. The transposes at the
+    top of the factor are left to the product. */
+template <typename E>
+matrix_view Factor(E *e, matrix *storage, bool *transposed) {
+  *transposed = false;
+  return Operand(e, storage);
+}
+
+template <typename L>
+matrix_view Factor(TransposeExpr<L> *e, matrix *storage, bool *transposed) {
+  matrix_view value = Factor(e->operand(), storage, transposed);
+  *transposed = !*transposed;
+  return value;
+}
+
+/*******************************************************************************
+ * Products
+ ******************************************************************************/
+/*! l r, by matrix_gemm, or by matrix_vector_multiply when r is a vector.
+    A product is computed whole, when its expression is prepared. A new
+    product of factors that are not transposed is matrix_multiply's, which
+    keeps the sparse form of a product of sparse factors. */
+template <typename L, typename R>
+class ProductExpr {
+ public:
+  ProductExpr(L l, R r, bool vector)
+      : l_(std::move(l)), r_(std::move(r)), vector_(vector), value_(0, 0) {
+    CheckSameShape(l_.cols(), 0, r_.rows(), 0);
+  }
+  int rows() const { return l_.rows(); }
+  int cols() const { return r_.cols(); }
+  void Prepare() { value_ = Compute(); }
+  const float *Row(int i, int j, int, float *) const {
+    return value_.access(i, j);
+  }
+  bool Misaligned(const matrix_view &) const { return false; }
+  matrix Compute() {
+    matrix a_storage(0, 0), b_storage(0, 0);
+    if (vector_) {
+      return matrix_vector_multiply(Operand(&l_, &a_storage),
+                                    Operand(&r_, &b_storage));
+    }
+    bool transpose_a, transpose_b;
+    matrix_view a = Factor(&l_, &a_storage, &transpose_a);
+    matrix_view b = Factor(&r_, &b_storage, &transpose_b);
+    if (!transpose_a && !transpose_b) return matrix_multiply(a, b);
+    matrix result(rows(), cols());
+    matrix_gemm(a, transpose_a, b, transpose_b, 0, result);
+    return result;
+  }
+
+  /*! The product is computed straight into dst unless dst may be one of
+      its factors. */
+  void ComputeInto(const matrix_block &dst, bool may_alias) {
+    if (vector_) {
+      matrix_copy(Compute(), dst);
+      return;
+    }
+    matrix a_storage(0, 0), b_storage(0, 0);
+    bool transpose_a, transpose_b;
+    matrix_view a = Factor(&l_, &a_storage, &transpose_a);
+    matrix_view b = Factor(&r_, &b_storage, &transpose_b);
+    if (may_alias && (a.overlaps(dst) || b.overlaps(dst))) {
+      matrix result(rows(), cols());
+      matrix_gemm(a, transpose_a, b, transpose_b, 0, result);
+      matrix_copy(result, dst);
+      return;
+    }
+    matrix_gemm(a, transpose_a, b, transpose_b, 0, dst);
+  }
+
+ private:
+  L l_;
+  R r_;
+  bool vector_;
+  matrix value_;
+};
+
+/*! l r + z as one matrix multiply that accumulates into z. */
+template <typename L, typename R, typename Z>
+class MultiplyAddExpr {
+ public:
+  MultiplyAddExpr(L l, R r, Z z)
+      : l_(std::move(l)), r_(std::move(r)), z_(std::move(z)), value_(0, 0) {
+    CheckSameShape(l_.cols(), 0, r_.rows(), 0);
+    CheckSameShape(l_.rows(), r_.cols(), z_.rows(), z_.cols());
+  }
+  int rows() const { return l_.rows(); }
+  int cols() const { return r_.cols(); }
+  void Prepare() {
+    value_ = matrix(rows(), cols());
+    ComputeInto(value_, false);
+  }
+  const float *Row(int i, int j, int, float *) const {
+    return value_.access(i, j);
+  }
+  bool Misaligned(const matrix_view &) const { return false; }
+
+  /*! The product is accumulated into dst after z is evaluated there, so
+      the factors are computed first, and dst is used only if it is not
+      one of them. */
+  void ComputeInto(const matrix_block &dst, bool may_alias) {
+    matrix a_storage(0, 0), b_storage(0, 0);
+    bool transpose_a, transpose_b;
+    matrix_view a = Factor(&l_, &a_storage, &transpose_a);
+    matrix_view b = Factor(&r_, &b_storage, &transpose_b);
+    if (may_alias && (a.overlaps(dst) || b.overlaps(dst))) {
+      matrix result(rows(), cols());
+      EvaluateInto(&z_, result);
+      matrix_gemm(a, transpose_a, b, transpose_b, 1, result);
+      matrix_copy(result, dst);
+      return;
+    }
+    EvaluateInto(&z_, dst);
+    matrix_gemm(a, transpose_a, b, transpose_b, 1, dst);
+  }
+
+ private:
+  L l_;
+  R r_;
+  Z z_;
+  matrix value_;
+};
+
+/*! Products at the root of an expression are computed straight into the
+    result. */
+template <typename L, typename R>
+matrix Evaluate(ProductExpr<L, R> *e) {
+  return e->Compute();
+}
+
+template <typename L, typename R>
+void EvaluateInto(ProductExpr<L, R> *e, const matrix_block &dst) {
+  e->ComputeInto(dst, true);
+}
+
+template <typename L, typename R, typename Z>
+matrix Evaluate(MultiplyAddExpr<L, R, Z> *e) {
+  matrix result(e->rows(), e->cols());
+  e->ComputeInto(result, false);
+  return result;
+}
+
+template <typename L, typename R, typename Z>
+void EvaluateInto(MultiplyAddExpr<L, R, Z> *e, const matrix_block &dst) {
+  e->ComputeInto(dst, true);
+}
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! The node an argument of a lazy_ function becomes: a matrix or a view
+    becomes a leaf, a node is taken as it is. */
+template <typename E>
+struct ExprNode {
+  typedef E type;
+};
+
+template <>
+struct ExprNode<matrix> {
+  typedef MatrixLeaf type;
+};
+
+template <>
+struct ExprNode<matrix_view> {
+  typedef MatrixLeaf type;
+};
+
+template <typename E>
+using ExprNodeOf = typename ExprNode<typename std::decay<E>::type>::type;
+
+/*! The value of expression e as a new matrix. */
+template <typename E>
+matrix matrix_eval(E e) {
+  return Evaluate(&e);
+}
+
+/*! m = e. If m already has the shape of e, e is evaluated into the storage
+    of m, which e may read. */
+template <typename E>
+void matrix_assign(matrix &m, E e) {
+  if (m.n_rows() != e.rows() || m.n_cols() != e.cols()) {
+    m = Evaluate(&e);
+    return;
+  }
+  m.unshare();
+  EvaluateInto(&e, m);
+}
+
+inline void matrix_assign(matrix &m, const matrix &value) { m = value; }
+inline void matrix_assign(matrix &m, matrix &&value) { m = std::move(value); }
+
+/*! m = a block, copied into the storage of m if it has the shape. */
+inline void matrix_assign(matrix &m, const matrix_view &value) {
+  if (m.n_rows() != value.n_rows() || m.n_cols() != value.n_cols()) {
+    m = matrix(value);
+    return;
+  }
+  matrix_copy(value, m);
+}
+
+/*! m[r0 .. r1 : c0 .. c1] = e, evaluated into the block, which e may
+    read. e may also be a matrix or a view. */
+template <typename E>
+void matrix_assign(const matrix_block &dst, E &&e) {
+  ExprNodeOf<E> node(std::forward<E>(e));
+  CheckSameShape(dst.n_rows(), dst.n_cols(), node.rows(), node.cols());
+  EvaluateInto(&node, dst);
+}
+
+/*! One for each kernel of Matrix.h, taking matrices or nodes. */
+template <typename L, typename R>
+ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> > lazy_add(L &&l, R &&r) {
+  return ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      simd_kernels().add);
+}
+
+template <typename L, typename R>
+ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> > lazy_subtract(L &&l, R &&r) {
+  return ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      simd_kernels().subtract);
+}
+
+template <typename L, typename R>
+ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> > lazy_hadamard(L &&l, R &&r) {
+  return ZipExpr<ExprNodeOf<L>, ExprNodeOf<R> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      simd_kernels().multiply);
+}
+
+template <typename L>
+BroadcastExpr<ExprNodeOf<L> > lazy_add_scalar(L &&l, float s) {
+  return BroadcastExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)), s,
+                                       simd_kernels().shift);
+}
+
+/*! x - s and x + -s round the same way. */
+template <typename L>
+BroadcastExpr<ExprNodeOf<L> > lazy_subtract_scalar(L &&l, float s) {
+  return BroadcastExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)), -s,
+                                       simd_kernels().shift);
+}
+
+template <typename L>
+BroadcastExpr<ExprNodeOf<L> > lazy_scale(L &&l, float s) {
+  return BroadcastExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)), s,
+                                       simd_kernels().scale);
+}
+
+template <typename L>
+BroadcastExpr<ExprNodeOf<L> > lazy_divide_scalar(L &&l, float s) {
+  return BroadcastExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)), s,
+                                       simd_kernels().divide);
+}
+
+template <typename L>
+BroadcastExpr<ExprNodeOf<L> > lazy_subtract_from(L &&l, float s) {
+  return BroadcastExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)), s,
+                                       simd_kernels().subtract_from);
+}
+
+template <typename L, typename R>
+ProductExpr<ExprNodeOf<L>, ExprNodeOf<R> > lazy_multiply(L &&l, R &&r) {
+  return ProductExpr<ExprNodeOf<L>, ExprNodeOf<R> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      false);
+}
+
+template <typename L, typename R>
+ProductExpr<ExprNodeOf<L>, ExprNodeOf<R> > lazy_vector_multiply(L &&l,
+                                                                 R &&r) {
+  return ProductExpr<ExprNodeOf<L>, ExprNodeOf<R> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      true);
+}
+
+template <typename L, typename R, typename Z>
+MultiplyAddExpr<ExprNodeOf<L>, ExprNodeOf<R>, ExprNodeOf<Z> >
+lazy_multiply_add(L &&l, R &&r, Z &&z) {
+  return MultiplyAddExpr<ExprNodeOf<L>, ExprNodeOf<R>, ExprNodeOf<Z> >(
+      ExprNodeOf<L>(std::forward<L>(l)), ExprNodeOf<R>(std::forward<R>(r)),
+      ExprNodeOf<Z>(std::forward<Z>(z)));
+}
+
+template <typename L>
+TransposeExpr<ExprNodeOf<L> > lazy_transpose(L &&l) {
+  return TransposeExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)));
+}
+
+#define FCAL_LAZY_MATH(function)                                          \
+  template <typename L>                                                   \
+  MapExpr<ExprNodeOf<L> > lazy_##function(L &&l) {                        \
+    return MapExpr<ExprNodeOf<L> >(ExprNodeOf<L>(std::forward<L>(l)),     \
+                                   simd_kernels().function);              \
+  }
+FCAL_LAZY_MATH(sqrt)
+FCAL_LAZY_MATH(exp)
+FCAL_LAZY_MATH(log)
+FCAL_LAZY_MATH(sin)
+FCAL_LAZY_MATH(cos)
+FCAL_LAZY_MATH(tan)
+FCAL_LAZY_MATH(fabs)
+FCAL_LAZY_MATH(floor)
+FCAL_LAZY_MATH(ceil)
+#undef FCAL_LAZY_MATH
+
+#endif  // PROJECT_INCLUDE_MATRIX_EXPR_H_
@@ -0,0 +1,330 @@
+/*******************************************************************************
+ * Name            : matrix_file.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Binary matrix file headers, and the matrices that stay in
+ *                   such files.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <future>
+#include <sstream>
+#include "include/matrix_file.h"
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! Tiles and panels of disk_matrix_multiply are multiples of this many
+    rows and columns, so that they are worth packing for the blocked
+    multiply. A tile is at least four of them across. */
+static const int kDiskTileQuantum = 64;
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! pread and pwrite, repeated until all n bytes are moved. Reading past
+    the end of the file fails with EIO. */
+static bool ReadFully(int fd, void *buffer, size_t n, uint64_t offset) {
+  char *p = static_cast<char *>(buffer);
+  while (n > 0) {
+    ssize_t done = pread(fd, p, n, offset);
+    if (done < 0 && errno == EINTR) continue;
+    if (done <= 0) {
+      if (done == 0) errno = EIO;
+      return false;
+    }
+    p += done;
+    n -= done;
+    offset += done;
+  }
+  return true;
+}
+
+static bool WriteFully(int fd, const void *buffer, size_t n,
+                       uint64_t offset) {
+  const char *p = static_cast<const char *>(buffer);
+  while (n > 0) {
+    ssize_t done = pwrite(fd, p, n, offset);
+    if (done < 0 && errno == EINTR) continue;
+    if (done < 0) return false;
+    p += done;
+    n -= done;
+    offset += done;
+  }
+  return true;
+}
+
+void InitMatrixFileHeader(int rows, int cols, MatrixFileHeader *header) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, kMatrixFileMagic, sizeof(kMatrixFileMagic));
+  header->version = kMatrixFileVersion;
+  header->element_type = kMatrixFileFloat32;
+  header->rows = rows;
+  header->cols = cols;
+  header->stride = matrix::padded_stride(cols);
+  header->data_offset = sizeof(*header);
+}
+
+bool CheckMatrixFileHeader(const std::string &filename,
+                           const MatrixFileHeader &header, uint64_t size,
+                           std::string *error) {
+  std::stringstream ss;
+  ss << filename << ": ";
+  if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+    ss << "binary matrix files are little-endian";
+  } else if (header.version != kMatrixFileVersion) {
+    ss << "binary matrix file version " << header.version
+       << " is not supported";
+  } else if (header.element_type != kMatrixFileFloat32) {
+    ss << "elements of type " << header.element_type << " are not supported";
+  } else if (header.rows > INT32_MAX || header.cols > INT32_MAX ||
+             header.stride < header.cols ||
+             header.data_offset < sizeof(header) ||
+             header.data_offset > size ||
+             (header.rows > 0 &&
+              (size - header.data_offset) / sizeof(float) / header.rows <
+                  header.stride)) {
+    ss << "is not a complete " << header.rows << " x " << header.cols
+       << " binary matrix file";
+  } else {
+    return true;
+  }
+  *error = ss.str();
+  return false;
+}
+
+/*! The tiles of c are taken in row-major order and the panels of each
+    tile in order, so panels of a are read n / tile times over and panels
+    of b m / tile times; with tiles as large as the budget allows, that
+    reading is small next to the multiplying for large matrices. */
+bool disk_matrix_multiply(const disk_matrix &a, const disk_matrix &b,
+                          disk_matrix *c, size_t memory_bytes,
+                          std::string *error) {
+  const int m = a.n_rows();
+  const int k = a.n_cols();
+  const int n = b.n_cols();
+  if (b.n_rows() != k || c->n_rows() != m || c->n_cols() != n) {
+    *error = "matrices dimensionses not compatible";
+    return false;
+  }
+
+  /* A tile of c takes tile^2 floats and the two pairs of panels, each
+     tile / 4 deep, another tile^2 between them. */
+  int tile = static_cast<int>(sqrt(memory_bytes / sizeof(float) / 2.0)) /
+             kDiskTileQuantum * kDiskTileQuantum;
+  if (tile < 4 * kDiskTileQuantum) {
+    std::stringstream ss;
+    ss << "a memory budget of " << memory_bytes << " bytes is too small "
+       << "to multiply matrices in files";
+    *error = ss.str();
+    return false;
+  }
+  const int mc = std::min(m, tile);
+  const int nc = std::min(n, tile);
+  const int kc = std::min(k, tile / 4 / kDiskTileQuantum * kDiskTileQuantum);
+  const int row_tiles = mc == 0 ? 0 : (m + mc - 1) / mc;
+  const int col_tiles = nc == 0 ? 0 : (n + nc - 1) / nc;
+  const int panels = kc == 0 ? 0 : (k + kc - 1) / kc;
+
+  matrix tile_c(mc, nc);
+  if (panels == 0) {
+    tile_c.fill(0);
+    for (int ti = 0; ti < row_tiles; ti++) {
+      for (int tj = 0; tj < col_tiles; tj++) {
+        int rows = std::min(mc, m - ti * mc);
+        int cols = std::min(nc, n - tj * nc);
+        if (!c->write(ti * mc, tj * nc, tile_c.view(0, rows - 1, 0, cols - 1),
+                      error)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /* Step s multiplies panel s % panels of tile s / panels. */
+  matrix panel_a[2] = {matrix(mc, kc), matrix(mc, kc)};
+  matrix panel_b[2] = {matrix(kc, nc), matrix(kc, nc)};
+  std::string load_error[2];
+  auto load = [&](long s, int buffer) {
+    int i0 = s / panels / col_tiles * mc;
+    int j0 = s / panels % col_tiles * nc;
+    int p0 = s % panels * kc;
+    int rows = std::min(mc, m - i0);
+    int cols = std::min(nc, n - j0);
+    int depth = std::min(kc, k - p0);
+    return a.read(i0, p0, panel_a[buffer].block(0, rows - 1, 0, depth - 1),
+                  &load_error[buffer]) &&
+           b.read(p0, j0, panel_b[buffer].block(0, depth - 1, 0, cols - 1),
+                  &load_error[buffer]);
+  };
+
+  const long steps = static_cast<long>(row_tiles) * col_tiles * panels;
+  if (steps == 0) return true;
+  std::future<bool> next = std::async(std::launch::async, load, 0, 0);
+  for (long s = 0; s < steps; s++) {
+    int buffer = s % 2;
+    if (!next.get()) {
+      *error = load_error[buffer];
+      return false;
+    }
+    if (s + 1 < steps) {
+      next = std::async(std::launch::async, load, s + 1, 1 - buffer);
+    }
+
+    int i0 = s / panels / col_tiles * mc;
+    int j0 = s / panels % col_tiles * nc;
+    int p = s % panels;
+    int rows = std::min(mc, m - i0);
+    int cols = std::min(nc, n - j0);
+    int depth = std::min(kc, k - p * kc);
+    if (p == 0) tile_c.fill(0);
+    matrix_block product = tile_c.block(0, rows - 1, 0, cols - 1);
+    matrix_gemm(panel_a[buffer].view(0, rows - 1, 0, depth - 1), false,
+                panel_b[buffer].view(0, depth - 1, 0, cols - 1), false, 1,
+                product);
+    if (p == panels - 1 && !c->write(i0, j0, product, error)) return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+disk_matrix::disk_matrix(void)
+    : filename_(),
+      fd_(-1),
+      rows_(0),
+      cols_(0),
+      stride_(0),
+      data_offset_(0) {}
+
+disk_matrix::~disk_matrix(void) { close(); }
+
+void disk_matrix::close(void) {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  rows_ = cols_ = stride_ = 0;
+}
+
+bool disk_matrix::open(const std::string &filename, bool writable,
+                       std::string *error) {
+  close();
+  int fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    *error = "cannot open " + filename + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  MatrixFileHeader header;
+  if (fstat(fd, &st) != 0 || !ReadFully(fd, &header, sizeof(header), 0) ||
+      memcmp(header.magic, kMatrixFileMagic, sizeof(kMatrixFileMagic)) != 0) {
+    *error = filename + ": is not a binary matrix file";
+    ::close(fd);
+    return false;
+  }
+  if (!CheckMatrixFileHeader(filename, header, st.st_size, error)) {
+    ::close(fd);
+    return false;
+  }
+  filename_ = filename;
+  fd_ = fd;
+  rows_ = header.rows;
+  cols_ = header.cols;
+  stride_ = header.stride;
+  data_offset_ = header.data_offset;
+  return true;
+}
+
+/*! As matrix_save does, the file is made next to filename and renamed
+    over it, so matrices mapped from the old file keep their storage. */
+bool disk_matrix::create(const std::string &filename, int rows, int cols,
+                         std::string *error) {
+  close();
+  MatrixFileHeader header;
+  InitMatrixFileHeader(rows, cols, &header);
+  uint64_t size = header.data_offset +
+                  static_cast<uint64_t>(rows) * header.stride * sizeof(float);
+  std::stringstream temp;
+  temp << filename << ".tmp" << getpid();
+  int fd = ::open(temp.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0 || ftruncate(fd, size) != 0 ||
+      !WriteFully(fd, &header, sizeof(header), 0) ||
+      rename(temp.str().c_str(), filename.c_str()) != 0) {
+    *error = "cannot create " + filename + ": " + strerror(errno);
+    if (fd >= 0) {
+      ::close(fd);
+      unlink(temp.str().c_str());
+    }
+    return false;
+  }
+  filename_ = filename;
+  fd_ = fd;
+  rows_ = rows;
+  cols_ = cols;
+  stride_ = header.stride;
+  data_offset_ = header.data_offset;
+  return true;
+}
+
+bool disk_matrix::check_block(int first_row, int first_col, int rows,
+                              int cols, std::string *error) const {
+  if (first_row < 0 || first_col < 0 || first_row + rows > rows_ ||
+      first_col + cols > cols_) {
+    std::stringstream ss;
+    ss << filename_ << ": block [" << first_row << " .. "
+       << first_row + rows - 1 << " : " << first_col << " .. "
+       << first_col + cols - 1 << "] is outside the " << rows_ << " x "
+       << cols_ << " matrix";
+    *error = ss.str();
+    return false;
+  }
+  return true;
+}
+
+uint64_t disk_matrix::offset(int i, int j) const {
+  return data_offset_ +
+         (static_cast<uint64_t>(i) * stride_ + j) * sizeof(float);
+}
+
+bool disk_matrix::read(int first_row, int first_col, const matrix_block &dst,
+                       std::string *error) const {
+  if (!check_block(first_row, first_col, dst.n_rows(), dst.n_cols(), error)) {
+    return false;
+  }
+  for (int i = 0; i < dst.n_rows(); i++) {
+    if (!ReadFully(fd_, dst.access(i, 0), dst.n_cols() * sizeof(float),
+                   offset(first_row + i, first_col))) {
+      *error = "cannot read " + filename_ + ": " + strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool disk_matrix::write(int first_row, int first_col, const matrix_view &src,
+                        std::string *error) {
+  if (!check_block(first_row, first_col, src.n_rows(), src.n_cols(), error)) {
+    return false;
+  }
+  for (int i = 0; i < src.n_rows(); i++) {
+    if (!WriteFully(fd_, src.access(i, 0), src.n_cols() * sizeof(float),
+                    offset(first_row + i, first_col))) {
+      *error = "cannot write " + filename_ + ": " + strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
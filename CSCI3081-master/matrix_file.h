@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * Name            : matrix_file.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : The binary matrix file format, and matrices too large for
+ *                   memory that stay in such files and are multiplied a tile
+ *                   at a time.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_MATRIX_FILE_H_
+#define PROJECT_INCLUDE_MATRIX_FILE_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdint.h>
+#include <string>
+#include "include/Matrix.h"
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! A binary matrix file starts with a MatrixFileHeader, whose magic number
+    no text matrix file can start with. */
+static const char kMatrixFileMagic[8] = {'\x89', 'F', 'C', 'A',
+                                         'L', 'M', 'A', 'T'};
+static const uint32_t kMatrixFileVersion = 1;
+static const uint32_t kMatrixFileFloat32 = 1;
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! The header of a binary matrix file, which fills its first cache line.
+    Element [i:j] is the little-endian float at byte data_offset +
+    (i * stride + j) * 4. Every row is stride elements long, with zeros
+    after the first cols, so a file written from a matrix of this runtime
+    is laid out as the matrix's storage is and can be mapped in as it. */
+struct MatrixFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t element_type;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t stride;
+  uint32_t reserved;
+  uint64_t data_offset;
+  char padding[24];
+};
+static_assert(sizeof(MatrixFileHeader) == kMatrixAlignment,
+              "a matrix file header is one cache line");
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! A matrix that stays in a binary matrix file, for matrices larger than
+    memory. Blocks of it are read into and written from matrices in memory,
+    so no more of it is resident than the caller's blocks. */
+class disk_matrix {
+ public:
+  disk_matrix(void);
+  ~disk_matrix(void);
+
+  /*! Opens the binary matrix file filename, for writing too if writable.
+      Returns false and says why in *error if it cannot. */
+  bool open(const std::string &filename, bool writable, std::string *error);
+  /*! Replaces filename with a rows x cols binary matrix file of zeros and
+      opens it for writing. The file is sparse until it is written. */
+  bool create(const std::string &filename, int rows, int cols,
+              std::string *error);
+
+  int n_rows(void) const { return rows_; }
+  int n_cols(void) const { return cols_; }
+
+  /*! Reads the block of this matrix whose first element is
+      [first_row:first_col], and whose shape is that of dst, into dst. */
+  bool read(int first_row, int first_col, const matrix_block &dst,
+            std::string *error) const;
+  /*! Writes src over the block of this matrix whose first element is
+      [first_row:first_col]. */
+  bool write(int first_row, int first_col, const matrix_view &src,
+             std::string *error);
+
+ private:
+  disk_matrix(const disk_matrix &);
+  void close(void);
+  bool check_block(int first_row, int first_col, int rows, int cols,
+                   std::string *error) const;
+  uint64_t offset(int i, int j) const;
+
+  std::string filename_;
+  int fd_;
+  int rows_;
+  int cols_;
+  int stride_;
+  uint64_t data_offset_;
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! The header of a binary file for a rows x cols matrix of this runtime. */
+void InitMatrixFileHeader(int rows, int cols, MatrixFileHeader *header);
+
+/*! Whether this runtime can read a binary matrix file of size bytes that
+    starts with header. If not, says why in *error. */
+bool CheckMatrixFileHeader(const std::string &filename,
+                           const MatrixFileHeader &header, uint64_t size,
+                           std::string *error);
+
+/*! c = a * b, for matrices in files, using about memory_bytes of memory.
+    c must already have the shape of the product and be open for writing.
+
+    c is computed a square tile at a time, as large as the budget allows.
+    For each tile, panels of the rows of a and the columns of b stream
+    through two pairs of buffers: while one pair is multiplied into the
+    tile, the next is read on another thread, so reading overlaps
+    computing. A finished tile is written to c. */
+bool disk_matrix_multiply(const disk_matrix &a, const disk_matrix &b,
+                          disk_matrix *c, size_t memory_bytes,
+                          std::string *error);
+
+#endif  // PROJECT_INCLUDE_MATRIX_FILE_H_
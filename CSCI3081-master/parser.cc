@@ -59,6 +59,10 @@ ParseResult Parser::Parse(const char *text) {
     assert(tokens_ != NULL);
     curr_token_ = tokens_;
     pr = ParseProgram();
+
+    // Reject ill-typed programs here rather than when g++ runs.
+    ast::SymbolTable symbols;
+    pr.ast()->TypeCheck(&symbols);
   } catch (std::string errMsg) {
     pr.ok(false);
     pr.errors(errMsg);
@@ -78,6 +82,7 @@ ParseResult Parser::ParseProgram() {
   ParseResult pr;
   // root
   // Program ::= varName '(' ')' '{' Stmts '}'
+  scanner::ExtToken *first = curr_token_;
   match(scanner::kVariableName);
   std::string name(prev_token_->lexeme());
   ast::VarName *varname = new ast::VarName(name);
@@ -94,6 +99,7 @@ ParseResult Parser::ParseProgram() {
   match(scanner::kEndOfFile);
 
   pr.ast(new ast::Root(varname, s));
+  set_span(pr.ast(), first);
   return pr;
 } /* Parser::ParseProgram() */
 
@@ -176,6 +182,7 @@ ParseResult Parser::parse_standard_decl() {
 ParseResult Parser::parse_decl() {
   // std::cout<<"\n Success: parse_decl:"<<curr_token_->lexeme()<<std::endl;
   ParseResult pr;
+  scanner::ExtToken *first = curr_token_;
   // Decl :: matrix variableName ....
   if (next_is(scanner::kMatrixKwd)) {
     pr = parse_matrix_decl();
@@ -183,6 +190,7 @@ ParseResult Parser::parse_decl() {
     // Decl ::= Type variableName semiColon
     pr = parse_standard_decl();
   }
+  set_span(pr.ast(), first);
   return pr;
 }
 
@@ -190,6 +198,7 @@ ParseResult Parser::parse_decl() {
 ParseResult Parser::parse_stmts() {
   // std::cout<<"\n Success: parse_stmts:"<<curr_token_->lexeme()<<std::endl;
   ParseResult pr;
+  scanner::ExtToken *first = curr_token_;
   if (!next_is(scanner::kRightCurly) && !next_is(scanner::kInKwd)) {
     // Stmts ::= Stmt Stmts
     ParseResult pr_stmt = parse_stmt();
@@ -205,6 +214,7 @@ ParseResult Parser::parse_stmts() {
       if (!stmts) throw((std::string) "Bad cast of stmts in parse_stmts");
     }
     pr.ast(new ast::StmtsSeq(stmt, stmts));
+    set_span(pr.ast(), first);
   } else {
     // Stmts ::=
     // nothing to match.k
@@ -217,6 +227,7 @@ ParseResult Parser::parse_stmts() {
 ParseResult Parser::parse_stmt() {
   // std::cout<<"\n Success: parse_stmt:"<<curr_token_->lexeme()<<std::endl;
   ParseResult pr;
+  scanner::ExtToken *first = curr_token_;
 
   // Stmt ::= Decl
   if (next_is(scanner::kIntKwd) || next_is(scanner::kFloatKwd) ||
@@ -248,11 +259,26 @@ ParseResult Parser::parse_stmt() {
     } else {
       pr.ast(new ast::IfStmt(expr, stmt1));
     }
+  } else if (next_is(scanner::kVariableName) &&
+             curr_token_->lexeme() == "matrix_write") {
+    // Stmt ::= 'matrix_write' '(' Expr ',' Expr ')' ';'
+    match(scanner::kVariableName);
+    match(scanner::kLeftParen);
+    ParseResult matrixPr = parse_expr(0);
+    ast::Expr *matrix = dynamic_cast<ast::Expr *>(matrixPr.ast());
+    match(scanner::kComma);
+    ParseResult filePr = parse_expr(0);
+    ast::Expr *file = dynamic_cast<ast::Expr *>(filePr.ast());
+    match(scanner::kRightParen);
+    match(scanner::kSemiColon);
+    pr.ast(new ast::MatrixWriteStmt(matrix, file));
   } else if (attempt_match(scanner::kVariableName)) {
-    ast::Expr *expr2;
-    ast::Expr *expr3;
+    ast::Expr *expr2 = NULL;
+    ast::Expr *expr3 = NULL;
+    ast::MatrixSliceExpr *slice = NULL;
     /*
      * Stmt ::= varName '=' Expr ';'  | varName '[' Expr ':' Expr ']'
+     * '=' Expr ';' | varName '[' Expr '..' Expr ':' Expr '..' Expr ']'
      * '=' Expr ';'
      */
     std::string name(prev_token_->lexeme());
@@ -261,17 +287,24 @@ ParseResult Parser::parse_stmt() {
     if (attempt_match(scanner::kLeftSquare)) {
       leftSquare = true;
       ParseResult exprPr2 = parse_expr(0);
-      ast::Expr *expr2 = dynamic_cast<ast::Expr *>(exprPr2.ast());
-      match(scanner::kColon);
-      ParseResult exprPr3 = parse_expr(0);
-      ast::Expr *expr3 = dynamic_cast<ast::Expr *>(exprPr3.ast());
-      match(scanner::kRightSquare);
+      expr2 = dynamic_cast<ast::Expr *>(exprPr2.ast());
+      if (attempt_match(scanner::kDotDot)) {
+        ParseResult slicePr = parse_slice(varname, expr2);
+        slice = dynamic_cast<ast::MatrixSliceExpr *>(slicePr.ast());
+      } else {
+        match(scanner::kColon);
+        ParseResult exprPr3 = parse_expr(0);
+        expr3 = dynamic_cast<ast::Expr *>(exprPr3.ast());
+        match(scanner::kRightSquare);
+      }
     }
     match(scanner::kAssign);
     ParseResult exprPr1 = parse_expr(0);
     ast::Expr *expr1 = dynamic_cast<ast::Expr *>(exprPr1.ast());
     match(scanner::kSemiColon);
-    if (leftSquare)
+    if (slice)
+      pr.ast(new ast::AssignSliceStmt(slice, expr1));
+    else if (leftSquare)
       pr.ast(new ast::AssignMatrixStmt(varname, expr2, expr3, expr1));
     else
       pr.ast(new ast::AssignStmt(varname, expr1));
@@ -326,6 +359,7 @@ ParseResult Parser::parse_stmt() {
           " while parsing a statement");
   }
   // Stmt ::= variableName assign Expr semiColon
+  set_span(pr.ast(), first);
   return pr;
 }
 
@@ -336,10 +370,13 @@ ParseResult Parser::parse_expr(int rbp) {
      associated parse methods.  The ExtToken objects have 'nud' and
      'led' methods that are dispatchers that call the appropriate
      parse methods.*/
+  scanner::ExtToken *first = curr_token_;
   ParseResult left = curr_token_->nud();
+  set_span(left.ast(), first);
 
   while (rbp < curr_token_->lbp()) {
     left = curr_token_->led(left);
+    set_span(left.ast(), first);
   }
 
   return left;
@@ -400,9 +437,10 @@ ParseResult Parser::parse_variable_name() {
   std::string name(prev_token_->lexeme());
   ast::VarName *varname = new ast::VarName(name);
   if (attempt_match(scanner::kLeftSquare)) {
-    // Expr ::= varName '[' Expr ':' Expr ']'
     ParseResult exprPr1 = parse_expr(0);
     ast::Expr *expr1 = dynamic_cast<ast::Expr *>(exprPr1.ast());
+    if (attempt_match(scanner::kDotDot)) return parse_slice(varname, expr1);
+    // Expr ::= varName '[' Expr ':' Expr ']'
     match(scanner::kColon);
     ParseResult exprPr2 = parse_expr(0);
     ast::Expr *expr2 = dynamic_cast<ast::Expr *>(exprPr2.ast());
@@ -421,6 +459,24 @@ ParseResult Parser::parse_variable_name() {
   return pr;
 }
 
+// Expr ::= varName '[' Expr '..' Expr ':' Expr '..' Expr ']'
+// The name, the first row and the '..' after it have been consumed.
+ParseResult Parser::parse_slice(ast::VarName *varname, ast::Expr *first_row) {
+  ParseResult pr;
+  ParseResult lastRowPr = parse_expr(0);
+  ast::Expr *last_row = dynamic_cast<ast::Expr *>(lastRowPr.ast());
+  match(scanner::kColon);
+  ParseResult firstColPr = parse_expr(0);
+  ast::Expr *first_col = dynamic_cast<ast::Expr *>(firstColPr.ast());
+  match(scanner::kDotDot);
+  ParseResult lastColPr = parse_expr(0);
+  ast::Expr *last_col = dynamic_cast<ast::Expr *>(lastColPr.ast());
+  match(scanner::kRightSquare);
+  pr.ast(new ast::MatrixSliceExpr(varname, first_row, last_row, first_col,
+                                  last_col));
+  return pr;
+}
+
 // Expr ::= leftParen Expr rightParen
 ParseResult Parser::parse_nested_expr() {
   ParseResult pr;
@@ -609,5 +665,18 @@ std::string Parser::make_error_msg(const scanner::TokenType &terminal) {
 
 std::string Parser::make_error_msg(const char *msg) { return msg; }
 
+/*! Records on node the source span from the token first to the last token
+    consumed. Nodes that consumed no tokens, like empty statement lists,
+    keep an empty span. */
+void Parser::set_span(ast::Node *node, scanner::ExtToken *first) {
+  if (node == NULL || first == curr_token_) return;
+  ast::SourceSpan span;
+  span.first_line = first->line();
+  span.first_column = first->column();
+  span.last_line = prev_token_->line();
+  span.last_column = prev_token_->column();
+  node->span(span);
+}
+
 } /* namespace parser */
 } /* namespace fcal */
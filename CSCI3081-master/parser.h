@@ -74,6 +74,7 @@ class Parser {
   ParseResult parse_string_const();
   ParseResult parse_char_const();
   ParseResult parse_variable_name();
+  ParseResult parse_slice(ast::VarName *varname, ast::Expr *first_row);
   ParseResult parse_nested_expr();
   ParseResult parse_not_expr();
   ParseResult parse_let_expr();
@@ -96,6 +97,7 @@ class Parser {
   std::string make_error_msg(const scanner::TokenType &terminal);
   std::string make_error_msg_expected(const scanner::TokenType &terminal);
   std::string make_error_msg(const char *msg);
+  void set_span(ast::Node *node, scanner::ExtToken *first);
 
   scanner::ExtToken *tokens_;
   scanner::ExtToken *curr_token_;
@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * Name            : profile.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Aggregation of the profiling counters and the hot spot
+ *                   report written when a profiled program exits.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "include/profile.h"
+
+/*******************************************************************************
+ * Global Variables
+ ******************************************************************************/
+thread_local ProfileCounters *profile_counters = NULL;
+thread_local ProfileScope *ProfileScope::current_ = NULL;
+
+static const ProfileSite *profile_sites = NULL;
+static int profile_n_sites = 0;
+
+/*! Every thread's counters. Threads never free theirs, so the report can
+    read them after the threads that wrote them have finished. */
+static std::mutex profile_mutex;
+static std::vector<ProfileCounters *> profile_all_counters;
+
+/*! Start of the run on both clocks, to convert ticks to seconds. */
+static uint64_t profile_start_ticks = 0;
+static std::chrono::steady_clock::time_point profile_start_time;
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+ProfileCounters *profile_new_thread_counters(void) {
+  profile_counters = new ProfileCounters[profile_n_sites]();
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  profile_all_counters.push_back(profile_counters);
+  return profile_counters;
+}
+
+/*! Sums the counters of every thread and writes one line per site that
+    ran, hottest first. */
+static void profile_report(void) {
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - profile_start_time)
+                       .count();
+  uint64_t ticks = profile_ticks() - profile_start_ticks;
+  double ticks_per_second = seconds > 0 ? ticks / seconds : 1;
+
+  std::vector<ProfileCounters> totals(profile_n_sites, ProfileCounters());
+  {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    for (unsigned t = 0; t < profile_all_counters.size(); t++) {
+      for (int i = 0; i < profile_n_sites; i++) {
+        totals[i].count += profile_all_counters[t][i].count;
+        totals[i].total_ticks += profile_all_counters[t][i].total_ticks;
+        totals[i].child_ticks += profile_all_counters[t][i].child_ticks;
+        totals[i].bytes += profile_all_counters[t][i].bytes;
+      }
+    }
+  }
+
+  std::vector<int> order;
+  for (int i = 0; i < profile_n_sites; i++) {
+    if (totals[i].count > 0) order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return totals[a].total_ticks - totals[a].child_ticks >
+           totals[b].total_ticks - totals[b].child_ticks;
+  });
+
+  FILE *out = stderr;
+  const char *path = getenv("FCAL_PROFILE");
+  if (path && *path && !(out = fopen(path, "w"))) out = stderr;
+  fprintf(out, "FCAL profile: %.3f s\n", seconds);
+  fprintf(out, "%6s %12s %12s %12s %6s %12s  %s\n", "line", "count",
+          "total ms", "self ms", "self%", "MB touched", "site");
+  for (unsigned k = 0; k < order.size(); k++) {
+    const ProfileCounters &c = totals[order[k]];
+    double total = c.total_ticks / ticks_per_second;
+    double self = (c.total_ticks - c.child_ticks) / ticks_per_second;
+    fprintf(out, "%6d %12llu %12.3f %12.3f %6.1f %12.1f  %s\n",
+            profile_sites[order[k]].line,
+            static_cast<unsigned long long>(c.count), total * 1e3, self * 1e3,
+            seconds > 0 ? 100 * self / seconds : 0, c.bytes / 1e6,
+            profile_sites[order[k]].label);
+  }
+  if (out != stderr) fclose(out);
+} /* profile_report() */
+
+void profile_start(const ProfileSite *sites, int n_sites) {
+  profile_sites = sites;
+  profile_n_sites = n_sites;
+  profile_start_time = std::chrono::steady_clock::now();
+  profile_start_ticks = profile_ticks();
+  atexit(profile_report);
+}
@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * Name            : profile.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Counters and timers that generated programs compiled in
+ *                   profiling mode use to report where their time goes.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_PROFILE_H_
+#define PROJECT_INCLUDE_PROFILE_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdint.h>
+#include "include/Matrix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! A place in the FCAL program that is timed: a statement, a loop body or a
+    matrix kernel. The code generator emits a table of these. */
+struct ProfileSite {
+  int line;
+  const char *label;
+};
+
+/*! What one thread has measured at one site. */
+struct ProfileCounters {
+  uint64_t count;
+  uint64_t total_ticks;
+  uint64_t child_ticks;
+  uint64_t bytes;
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Registers the program's sites and arranges for the report to be written
+    when the program exits: to the file named by $FCAL_PROFILE, or to
+    standard error. */
+void profile_start(const ProfileSite *sites, int n_sites);
+
+/*! Each thread's counters, one per site. They are created on first use and
+    kept until the report is written. */
+extern thread_local ProfileCounters *profile_counters;
+ProfileCounters *profile_new_thread_counters(void);
+
+inline ProfileCounters *profile_thread_counters(void) {
+  return profile_counters ? profile_counters : profile_new_thread_counters();
+}
+
+/*! A cheap timestamp: the time stamp counter where there is one. */
+inline uint64_t profile_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! Times a site from construction until Stop() or destruction, whichever
+    comes first. Scopes nest per thread, so the time of inner sites is
+    subtracted from the self time of the site enclosing them. */
+class ProfileScope {
+ public:
+  explicit ProfileScope(int site)
+      : counters_(profile_thread_counters() + site),
+        parent_(current_),
+        start_(profile_ticks()),
+        running_(true) {
+    current_ = this;
+  }
+  ~ProfileScope(void) { Stop(); }
+
+  void Stop(void) {
+    if (!running_) return;
+    running_ = false;
+    uint64_t ticks = profile_ticks() - start_;
+    counters_->count++;
+    counters_->total_ticks += ticks;
+    if (parent_) parent_->counters_->child_ticks += ticks;
+    current_ = parent_;
+  }
+  void AddBytes(uint64_t bytes) { counters_->bytes += bytes; }
+
+ private:
+  ProfileScope(const ProfileScope &);
+
+  static thread_local ProfileScope *current_;
+  ProfileCounters *counters_;
+  ProfileScope *parent_;
+  uint64_t start_;
+  bool running_;
+};
+
+inline uint64_t matrix_bytes(const matrix &m) {
+  return static_cast<uint64_t>(m.n_rows()) * m.n_cols() * sizeof(float);
+}
+inline uint64_t matrix_bytes(float) { return 0; }
+/*! The factors of a chain of products, from matrix_multiply_chain. */
+inline uint64_t matrix_bytes(const std::vector<matrix_view> &factors) {
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < factors.size(); i++) {
+    bytes += static_cast<uint64_t>(factors[i].n_rows()) *
+             factors[i].n_cols() * sizeof(float);
+  }
+  return bytes;
+}
+
+inline uint64_t operand_bytes() { return 0; }
+template <typename Operand, typename... Rest>
+uint64_t operand_bytes(const Operand &operand, const Rest &... rest) {
+  return matrix_bytes(operand) + operand_bytes(rest...);
+}
+
+/*! Calls kernel(operands...) as site, counting the bytes of its operands
+    and its result as touched. The operands are evaluated by the caller, so
+    their time is not charged to the kernel. */
+template <typename Kernel, typename... Operands>
+matrix profile_kernel(int site, Kernel kernel, const Operands &... operands) {
+  ProfileScope scope(site);
+  matrix result = kernel(operands...);
+  scope.AddBytes(operand_bytes(operands...) + matrix_bytes(result));
+  return result;
+}
+
+#endif  // PROJECT_INCLUDE_PROFILE_H_
@@ -60,25 +60,27 @@ Scanner::Scanner() {
   regex_array[26] = make_regex("^\\]");
   regex_array[27] = make_regex("^;");
   regex_array[28] = make_regex("^:");
+  regex_array[29] = make_regex("^\\.\\.");
+  regex_array[30] = make_regex("^,");
 
   // Operator Tokentypes
-  regex_array[29] = make_regex("^=");
-  regex_array[30] = make_regex("^\\+");
-  regex_array[31] = make_regex("^\\*");
-  regex_array[32] = make_regex("^-");
-  regex_array[33] = make_regex("^/");
-  regex_array[34] = make_regex("^<");
-  regex_array[35] = make_regex("^<=");
-  regex_array[36] = make_regex("^>");
-  regex_array[37] = make_regex("^>=");
-  regex_array[38] = make_regex("^==");
-  regex_array[39] = make_regex("^!=");
-  regex_array[40] = make_regex("^&&");
-  regex_array[41] = make_regex("^\\|\\|");
-  regex_array[42] = make_regex("^!");
+  regex_array[31] = make_regex("^=");
+  regex_array[32] = make_regex("^\\+");
+  regex_array[33] = make_regex("^\\*");
+  regex_array[34] = make_regex("^-");
+  regex_array[35] = make_regex("^/");
+  regex_array[36] = make_regex("^<");
+  regex_array[37] = make_regex("^<=");
+  regex_array[38] = make_regex("^>");
+  regex_array[39] = make_regex("^>=");
+  regex_array[40] = make_regex("^==");
+  regex_array[41] = make_regex("^!=");
+  regex_array[42] = make_regex("^&&");
+  regex_array[43] = make_regex("^\\|\\|");
+  regex_array[44] = make_regex("^!");
 
   // Special Terminal Types
-  regex_array[43] = make_regex("$\\0");
+  regex_array[45] = make_regex("$\\0");
 }
 /*! Default Token constructor. Instantiate lexeme_ to empty string,
 terminal_ to lexical error token type, and next_ (which is next token) to
@@ -87,6 +89,8 @@ Token::Token() {
   lexeme_ = "";
   terminal_ = kLexicalError;
   next_ = NULL;
+  line_ = 0;
+  column_ = 0;
 }
 
 /*! This constructor requires three parameters: lexeme_, terminal_, and next_
@@ -98,6 +102,8 @@ Token::Token(std::string a, TokenType t, Token* s) {
   lexeme_ = a;
   terminal_ = t;
   next_ = s;
+  line_ = 0;
+  column_ = 0;
 }
 /*! This returns the TokenType terminal_ */
 TokenType Token::terminal(void) { return terminal_; }
@@ -121,6 +127,28 @@ void Token::setLexeme_(std::string lex) { lexeme_ = lex; }
   \param next_ the pointer to the next token object */
 void Token::setNext(Token* nextToken) { next_ = nextToken; }
 
+/*! This function records where the token starts in the source
+  \param line the line, counting from 1
+  \param column the column, counting from 1 */
+void Token::setPosition(int line, int column) {
+  line_ = line;
+  column_ = column;
+}
+
+/*! Advances the current line past the text in [begin, end). Only newlines
+    are looked at, with memchr, so tracking positions costs next to nothing
+    next to matching the token regexes. */
+static void advance_lines(const char* begin, const char* end, int* line,
+                          const char** line_start) {
+  const char* newline;
+  while ((newline = static_cast<const char*>(
+              memchr(begin, '\n', end - begin))) != NULL) {
+    (*line)++;
+    begin = newline + 1;
+    *line_start = begin;
+  }
+}
+
 /*! Create the compiled regular expressions. */
 regex_t* white_space = make_regex("^[\n\t\r ]+");
 regex_t* block_comment = make_regex("^/\\*([^\\*]|\\*+[^\\*/])*\\*+/");
@@ -128,10 +156,13 @@ regex_t* inline_comment = make_regex("^//[^\n\r]*");
 
 Token* Scanner::Scan(const char* text) {
   int num_matched_chars;
+  int line = 1;
+  const char* line_start = text;
   /*! Consume leading white space and comments */
   num_matched_chars = consume_whitespace_and_comments(
       white_space, block_comment, inline_comment, text);
 
+  advance_lines(text, text + num_matched_chars, &line, &line_start);
   text = text + num_matched_chars;
 
   int max_num_matched_chars = 0;
@@ -144,7 +175,7 @@ Token* Scanner::Scan(const char* text) {
     max_num_matched_chars = 0;
     match_type = kLexicalError;
 
-    for (int i = 0; i < 44; i++) {
+    for (int i = 0; i < 46; i++) {
       num_matched_chars = match_regex(regex_array[i], text);
       if (num_matched_chars > max_num_matched_chars) {
         max_num_matched_chars = num_matched_chars;
@@ -161,14 +192,18 @@ Token* Scanner::Scan(const char* text) {
     new_token = new Token;
     current_token->setTokenType(match_type);
     current_token->setLexeme_(str);
+    current_token->setPosition(line, text - line_start + 1);
     current_token->setNext(new_token);
     current_token = new_token;
 
+    const char* token_start = text;
     text = text + max_num_matched_chars;
     num_matched_chars = consume_whitespace_and_comments(
         white_space, block_comment, inline_comment, text);
     text = text + num_matched_chars;
+    advance_lines(token_start, text, &line, &line_start);
   }
+  current_token->setPosition(line, text - line_start + 1);
   current_token->setTokenType(kEndOfFile);
   current_token->setNext(NULL);
 
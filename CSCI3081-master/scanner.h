@@ -68,6 +68,8 @@ enum kTokenEnumType {
   kRightSquare,
   kSemiColon,
   kColon,
+  kDotDot,
+  kComma,
 
   // Operators
   kAssign,
@@ -101,10 +103,16 @@ class Token {
         void setTokenType(TokenType);
         void setLexeme_(std::string);
         void setNext(Token *);
+        /*! Where the token starts in the source, counting from 1. */
+        int line(void) const { return line_; }
+        int column(void) const { return column_; }
+        void setPosition(int line, int column);
  private:
         TokenType terminal_;
         std::string lexeme_;
         Token * next_;
+        int line_;
+        int column_;
 };
 
 class Scanner {
@@ -112,7 +120,7 @@ class Scanner {
         Scanner();
         Token * Scan(const char *);
  private:
-        regex_t* regex_array[44];
+        regex_t* regex_array[46];
 };
 
 } /* namespace scanner */
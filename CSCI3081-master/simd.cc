@@ -0,0 +1,586 @@
+/*******************************************************************************
+ * Name            : simd.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Scalar, SSE2, AVX2 and AVX-512 kernels and the CPUID
+ *                   based choice between them.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FCAL_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Adds the first rows x cols of a full tile computed into tile, with row
+    length nr, to c. The vector kernels store edge tiles this way. */
+static void AddTile(const float *tile, int nr, float *c, int ldc, int rows,
+                    int cols) {
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) c[i * ldc + j] += tile[i * nr + j];
+  }
+}
+
+/*******************************************************************************
+ * Scalar Kernels
+ ******************************************************************************/
+/*! Plain C++; the fixed size accumulator still lets a compiler targeting
+    any vector instruction set keep it in registers. */
+static void GemmScalar(int kc, const float *a, const float *b, float *c,
+                       int ldc, int rows, int cols) {
+  const int kMR = 4;
+  const int kNR = 8;
+  float acc[kMR][kNR] = {{0}};
+  for (int p = 0; p < kc; p++) {
+    for (int i = 0; i < kMR; i++) {
+      for (int j = 0; j < kNR; j++) acc[i][j] += a[i] * b[j];
+    }
+    a += kMR;
+    b += kNR;
+  }
+  AddTile(&acc[0][0], kNR, c, ldc, rows, cols);
+}
+
+#ifdef FCAL_SIMD_X86
+/*******************************************************************************
+ * SSE2 Kernels
+ ******************************************************************************/
+/*! 4 x 8 tile: eight accumulators of the sixteen xmm registers. */
+__attribute__((target("sse2"))) static void GemmSse2(
+    int kc, const float *a, const float *b, float *c, int ldc, int rows,
+    int cols) {
+  __m128 acc[4][2];
+  for (int i = 0; i < 4; i++) acc[i][0] = acc[i][1] = _mm_setzero_ps();
+  for (int p = 0; p < kc; p++) {
+    __m128 b0 = _mm_loadu_ps(b);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    for (int i = 0; i < 4; i++) {
+      __m128 ai = _mm_set1_ps(a[i]);
+      acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(ai, b0));
+      acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(ai, b1));
+    }
+    a += 4;
+    b += 8;
+  }
+  if (rows == 4 && cols == 8) {
+    for (int i = 0; i < 4; i++) {
+      float *row = c + i * ldc;
+      _mm_storeu_ps(row, _mm_add_ps(_mm_loadu_ps(row), acc[i][0]));
+      _mm_storeu_ps(row + 4, _mm_add_ps(_mm_loadu_ps(row + 4), acc[i][1]));
+    }
+    return;
+  }
+  float tile[4 * 8];
+  for (int i = 0; i < 4; i++) {
+    _mm_storeu_ps(tile + i * 8, acc[i][0]);
+    _mm_storeu_ps(tile + i * 8 + 4, acc[i][1]);
+  }
+  AddTile(tile, 8, c, ldc, rows, cols);
+}
+
+/*******************************************************************************
+ * AVX2 Kernels
+ ******************************************************************************/
+/*! 6 x 16 tile: twelve accumulators, two rows of B and a broadcast of A
+    fill fifteen of the sixteen ymm registers. */
+__attribute__((target("avx2,fma"))) static void GemmAvx2(
+    int kc, const float *a, const float *b, float *c, int ldc, int rows,
+    int cols) {
+  __m256 acc[6][2];
+  for (int i = 0; i < 6; i++) acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+  for (int p = 0; p < kc; p++) {
+    __m256 b0 = _mm256_loadu_ps(b);
+    __m256 b1 = _mm256_loadu_ps(b + 8);
+    for (int i = 0; i < 6; i++) {
+      __m256 ai = _mm256_broadcast_ss(a + i);
+      acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += 6;
+    b += 16;
+  }
+  if (rows == 6 && cols == 16) {
+    for (int i = 0; i < 6; i++) {
+      float *row = c + i * ldc;
+      _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+      _mm256_storeu_ps(row + 8,
+                       _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+    }
+    return;
+  }
+  float tile[6 * 16];
+  for (int i = 0; i < 6; i++) {
+    _mm256_storeu_ps(tile + i * 16, acc[i][0]);
+    _mm256_storeu_ps(tile + i * 16 + 8, acc[i][1]);
+  }
+  AddTile(tile, 16, c, ldc, rows, cols);
+}
+
+/*******************************************************************************
+ * AVX-512 Kernels
+ ******************************************************************************/
+/*! 12 x 32 tile: twenty four accumulators of the thirty two zmm
+    registers. Edge columns are handled with masked loads and stores. */
+__attribute__((target("avx512f"))) static void GemmAvx512(
+    int kc, const float *a, const float *b, float *c, int ldc, int rows,
+    int cols) {
+  __m512 acc[12][2];
+  for (int i = 0; i < 12; i++) acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+  for (int p = 0; p < kc; p++) {
+    __m512 b0 = _mm512_loadu_ps(b);
+    __m512 b1 = _mm512_loadu_ps(b + 16);
+    for (int i = 0; i < 12; i++) {
+      __m512 ai = _mm512_set1_ps(a[i]);
+      acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+    }
+    a += 12;
+    b += 32;
+  }
+  __mmask16 mask0 = cols >= 16 ? 0xffff : (1u << cols) - 1;
+  __mmask16 mask1 = cols >= 32 ? 0xffff
+                    : cols <= 16 ? 0 : (1u << (cols - 16)) - 1;
+  for (int i = 0; i < rows; i++) {
+    float *row = c + i * ldc;
+    _mm512_mask_storeu_ps(
+        row, mask0,
+        _mm512_add_ps(_mm512_maskz_loadu_ps(mask0, row), acc[i][0]));
+    _mm512_mask_storeu_ps(
+        row + 16, mask1,
+        _mm512_add_ps(_mm512_maskz_loadu_ps(mask1, row + 16), acc[i][1]));
+  }
+}
+#endif  // FCAL_SIMD_X86
+
+/*******************************************************************************
+ * Elementwise Operations
+ ******************************************************************************/
+/*! Each operation has one overload per register width, so a single loop
+    template per instruction set serves all of them. */
+struct AddOp {
+  static float Apply(float a, float b) { return a + b; }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a, __m128 b) {
+    return _mm_add_ps(a, b);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a, __m256 b) {
+    return _mm256_add_ps(a, b);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a,
+                                                         __m512 b) {
+    return _mm512_add_ps(a, b);
+  }
+#endif
+};
+
+struct SubtractOp {
+  static float Apply(float a, float b) { return a - b; }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a, __m128 b) {
+    return _mm_sub_ps(a, b);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a, __m256 b) {
+    return _mm256_sub_ps(a, b);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a,
+                                                         __m512 b) {
+    return _mm512_sub_ps(a, b);
+  }
+#endif
+};
+
+struct MultiplyOp {
+  static float Apply(float a, float b) { return a * b; }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a, __m128 b) {
+    return _mm_mul_ps(a, b);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a, __m256 b) {
+    return _mm256_mul_ps(a, b);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a,
+                                                         __m512 b) {
+    return _mm512_mul_ps(a, b);
+  }
+#endif
+};
+
+struct DivideOp {
+  static float Apply(float a, float b) { return a / b; }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a, __m128 b) {
+    return _mm_div_ps(a, b);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a, __m256 b) {
+    return _mm256_div_ps(a, b);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a,
+                                                         __m512 b) {
+    return _mm512_div_ps(a, b);
+  }
+#endif
+};
+
+/*! b - a: the scalar is always the second operand of a broadcast. */
+struct SubtractFromOp {
+  static float Apply(float a, float b) { return b - a; }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a, __m128 b) {
+    return _mm_sub_ps(b, a);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a, __m256 b) {
+    return _mm256_sub_ps(b, a);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a,
+                                                         __m512 b) {
+    return _mm512_sub_ps(b, a);
+  }
+#endif
+};
+
+/*! The AVX-512 forms of SqrtOp, FloorOp and CeilOp are the masked
+    intrinsics with every lane selected, which compute the same thing; the
+    unmasked ones pass g++ an undefined vector that -Wall reports as maybe
+    uninitialized. */
+struct SqrtOp {
+  static float Apply(float a) { return sqrtf(a); }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a) {
+    return _mm_sqrt_ps(a);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a) {
+    return _mm256_sqrt_ps(a);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a) {
+    return _mm512_mask_sqrt_ps(a, 0xFFFF, a);
+  }
+#endif
+};
+
+/*! Clears the sign bit. */
+struct FabsOp {
+  static float Apply(float a) { return fabsf(a); }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("sse2"))) static __m128 Apply(__m128 a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+  }
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a) {
+    return _mm512_abs_ps(a);
+  }
+#endif
+};
+
+/*! No instruction set here has exp, log or the trigonometric functions,
+    so these are always libm's. */
+struct ExpOp {
+  static float Apply(float a) { return expf(a); }
+};
+
+struct LogOp {
+  static float Apply(float a) { return logf(a); }
+};
+
+struct SinOp {
+  static float Apply(float a) { return sinf(a); }
+};
+
+struct CosOp {
+  static float Apply(float a) { return cosf(a); }
+};
+
+struct TanOp {
+  static float Apply(float a) { return tanf(a); }
+};
+
+/*! Rounding to an integer needs SSE4.1, so there is no SSE2 form. */
+struct FloorOp {
+  static float Apply(float a) { return floorf(a); }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a) {
+    return _mm256_floor_ps(a);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a) {
+    return _mm512_mask_roundscale_ps(
+        a, 0xFFFF, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  }
+#endif
+};
+
+struct CeilOp {
+  static float Apply(float a) { return ceilf(a); }
+#ifdef FCAL_SIMD_X86
+  __attribute__((target("avx2"))) static __m256 Apply(__m256 a) {
+    return _mm256_ceil_ps(a);
+  }
+  __attribute__((target("avx512f"))) static __m512 Apply(__m512 a) {
+    return _mm512_mask_roundscale_ps(
+        a, 0xFFFF, a, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+  }
+#endif
+};
+
+/*******************************************************************************
+ * Scalar Elementwise Kernels
+ ******************************************************************************/
+template <typename Op>
+static void ZipScalar(float *dst, const float *a, const float *b, int n) {
+  for (int i = 0; i < n; i++) dst[i] = Op::Apply(a[i], b[i]);
+}
+
+template <typename Op>
+static void BroadcastScalar(float *dst, const float *src, int n, float s) {
+  for (int i = 0; i < n; i++) dst[i] = Op::Apply(src[i], s);
+}
+
+template <typename Op>
+static void MapScalar(float *dst, const float *src, int n) {
+  for (int i = 0; i < n; i++) dst[i] = Op::Apply(src[i]);
+}
+
+/*! dst + src * s, which reads dst and so has no Op. */
+static void AddScaledScalar(float *dst, const float *src, int n, float s) {
+  for (int i = 0; i < n; i++) dst[i] += src[i] * s;
+}
+
+#ifdef FCAL_SIMD_X86
+/*******************************************************************************
+ * SSE2 Elementwise Kernels
+ ******************************************************************************/
+template <typename Op>
+__attribute__((target("sse2"))) static void ZipSse2(float *dst,
+                                                    const float *a,
+                                                    const float *b, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, Op::Apply(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(a[i], b[i]);
+}
+
+template <typename Op>
+__attribute__((target("sse2"))) static void BroadcastSse2(float *dst,
+                                                          const float *src,
+                                                          int n, float s) {
+  __m128 vs = _mm_set1_ps(s);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, Op::Apply(_mm_loadu_ps(src + i), vs));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(src[i], s);
+}
+
+template <typename Op>
+__attribute__((target("sse2"))) static void MapSse2(float *dst,
+                                                    const float *src, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, Op::Apply(_mm_loadu_ps(src + i)));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(src[i]);
+}
+
+__attribute__((target("sse2"))) static void AddScaledSse2(float *dst,
+                                                          const float *src,
+                                                          int n, float s) {
+  __m128 vs = _mm_set1_ps(s);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                                      _mm_mul_ps(_mm_loadu_ps(src + i), vs)));
+  }
+  for (; i < n; i++) dst[i] += src[i] * s;
+}
+
+/*******************************************************************************
+ * AVX2 Elementwise Kernels
+ ******************************************************************************/
+template <typename Op>
+__attribute__((target("avx2"))) static void ZipAvx2(float *dst,
+                                                    const float *a,
+                                                    const float *b, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i,
+                     Op::Apply(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(a[i], b[i]);
+}
+
+template <typename Op>
+__attribute__((target("avx2"))) static void BroadcastAvx2(float *dst,
+                                                          const float *src,
+                                                          int n, float s) {
+  __m256 vs = _mm256_set1_ps(s);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, Op::Apply(_mm256_loadu_ps(src + i), vs));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(src[i], s);
+}
+
+template <typename Op>
+__attribute__((target("avx2"))) static void MapAvx2(float *dst,
+                                                    const float *src, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, Op::Apply(_mm256_loadu_ps(src + i)));
+  }
+  for (; i < n; i++) dst[i] = Op::Apply(src[i]);
+}
+
+/*! Fused, as the AVX2 gemm kernel is. */
+__attribute__((target("avx2,fma"))) static void AddScaledAvx2(
+    float *dst, const float *src, int n, float s) {
+  __m256 vs = _mm256_set1_ps(s);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_loadu_ps(src + i), vs,
+                                              _mm256_loadu_ps(dst + i)));
+  }
+  for (; i < n; i++) dst[i] = fmaf(src[i], s, dst[i]);
+}
+
+/*******************************************************************************
+ * AVX-512 Elementwise Kernels
+ ******************************************************************************/
+/*! The last partial vector is loaded and stored under a mask. */
+template <typename Op>
+__attribute__((target("avx512f"))) static void ZipAvx512(float *dst,
+                                                         const float *a,
+                                                         const float *b,
+                                                         int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(dst + i,
+                     Op::Apply(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+  }
+  if (i < n) {
+    __mmask16 mask = (1u << (n - i)) - 1;
+    _mm512_mask_storeu_ps(dst + i, mask,
+                          Op::Apply(_mm512_maskz_loadu_ps(mask, a + i),
+                                    _mm512_maskz_loadu_ps(mask, b + i)));
+  }
+}
+
+template <typename Op>
+__attribute__((target("avx512f"))) static void BroadcastAvx512(
+    float *dst, const float *src, int n, float s) {
+  __m512 vs = _mm512_set1_ps(s);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(dst + i, Op::Apply(_mm512_loadu_ps(src + i), vs));
+  }
+  if (i < n) {
+    __mmask16 mask = (1u << (n - i)) - 1;
+    _mm512_mask_storeu_ps(dst + i, mask,
+                          Op::Apply(_mm512_maskz_loadu_ps(mask, src + i), vs));
+  }
+}
+
+template <typename Op>
+__attribute__((target("avx512f"))) static void MapAvx512(float *dst,
+                                                         const float *src,
+                                                         int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(dst + i, Op::Apply(_mm512_loadu_ps(src + i)));
+  }
+  if (i < n) {
+    __mmask16 mask = (1u << (n - i)) - 1;
+    _mm512_mask_storeu_ps(dst + i, mask,
+                          Op::Apply(_mm512_maskz_loadu_ps(mask, src + i)));
+  }
+}
+
+__attribute__((target("avx512f"))) static void AddScaledAvx512(
+    float *dst, const float *src, int n, float s) {
+  __m512 vs = _mm512_set1_ps(s);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(dst + i, _mm512_fmadd_ps(_mm512_loadu_ps(src + i), vs,
+                                              _mm512_loadu_ps(dst + i)));
+  }
+  if (i < n) {
+    __mmask16 mask = (1u << (n - i)) - 1;
+    _mm512_mask_storeu_ps(
+        dst + i, mask,
+        _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, src + i), vs,
+                        _mm512_maskz_loadu_ps(mask, dst + i)));
+  }
+}
+#endif  // FCAL_SIMD_X86
+
+/*******************************************************************************
+ * Dispatch
+ ******************************************************************************/
+/*! Every elementwise kernel of one instruction set, in the order of
+    SimdKernels. Floor and ceil come from the rounding level. */
+#define FCAL_SIMD_ELEMENTWISE(level, rounding)                              \
+  Zip##level<AddOp>, Zip##level<SubtractOp>, Zip##level<MultiplyOp>,        \
+      Broadcast##level<AddOp>, Broadcast##level<MultiplyOp>,                \
+      Broadcast##level<DivideOp>, Broadcast##level<SubtractFromOp>,         \
+      AddScaled##level, Map##level<SqrtOp>, MapScalar<ExpOp>,               \
+      MapScalar<LogOp>, MapScalar<SinOp>, MapScalar<CosOp>,                 \
+      MapScalar<TanOp>,                                                     \
+      Map##level<FabsOp>, Map##rounding<FloorOp>, Map##rounding<CeilOp>
+
+static const SimdKernels kSimdKernels[] = {
+    {kSimdScalar, "scalar", 4, 8, GemmScalar,
+     FCAL_SIMD_ELEMENTWISE(Scalar, Scalar)},
+#ifdef FCAL_SIMD_X86
+    {kSimdSse2, "sse2", 4, 8, GemmSse2, FCAL_SIMD_ELEMENTWISE(Sse2, Scalar)},
+    {kSimdAvx2, "avx2", 6, 16, GemmAvx2, FCAL_SIMD_ELEMENTWISE(Avx2, Avx2)},
+    {kSimdAvx512, "avx512", 12, 32, GemmAvx512,
+     FCAL_SIMD_ELEMENTWISE(Avx512, Avx512)},
+#endif
+};
+#undef FCAL_SIMD_ELEMENTWISE
+static const int kNumSimdKernels = sizeof(kSimdKernels) / sizeof(SimdKernels);
+
+/*! The widest level this processor and operating system support. GCC's
+    cpu checks read CPUID, and for AVX also XGETBV, so a processor whose
+    operating system does not save the wide registers is not mistaken for
+    one that can use them. */
+static SimdLevel DetectSimdLevel(void) {
+#ifdef FCAL_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return kSimdAvx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return kSimdAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) return kSimdSse2;
+#endif
+  return kSimdScalar;
+}
+
+static const SimdKernels *ChooseSimdKernels(void) {
+  SimdLevel level = DetectSimdLevel();
+  const char *forced = getenv("FCAL_SIMD");
+  const SimdKernels *chosen = &kSimdKernels[0];
+  for (int i = 0; i < kNumSimdKernels; i++) {
+    if (kSimdKernels[i].level > level) break;
+    chosen = &kSimdKernels[i];
+    if (forced && strcmp(forced, chosen->name) == 0) break;
+  }
+  return chosen;
+}
+
+const SimdKernels &simd_kernels(void) {
+  static const SimdKernels *kernels = ChooseSimdKernels();
+  return *kernels;
+}
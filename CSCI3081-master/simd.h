@@ -0,0 +1,71 @@
+/*******************************************************************************
+ * Name            : simd.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Vectorized kernels for the matrix runtime, chosen when a
+ *                   program starts from what its processor supports.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_SIMD_H_
+#define PROJECT_INCLUDE_SIMD_H_
+
+/*******************************************************************************
+ * Type Definitions
+ ******************************************************************************/
+enum SimdLevel { kSimdScalar, kSimdSse2, kSimdAvx2, kSimdAvx512 };
+
+/*! Adds the product of a packed kc deep sliver of A, gemm_mr rows stored
+    column by column, and a packed sliver of B, gemm_nr columns stored row by
+    row, to the rows x cols tile of C at c. */
+typedef void (*GemmKernel)(int kc, const float *a, const float *b, float *c,
+                           int ldc, int rows, int cols);
+
+/*! dst[i] = a[i] op b[i] for i in [0, n). dst may be a or b. */
+typedef void (*ZipKernel)(float *dst, const float *a, const float *b, int n);
+
+/*! dst[i] = src[i] op s for i in [0, n). dst may be src. */
+typedef void (*BroadcastKernel)(float *dst, const float *src, int n, float s);
+
+/*! dst[i] = f(src[i]) for i in [0, n). dst may be src. */
+typedef void (*MapKernel)(float *dst, const float *src, int n);
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! One implementation of every kernel, all for the same instruction set. */
+struct SimdKernels {
+  SimdLevel level;
+  const char *name;
+  int gemm_mr;
+  int gemm_nr;
+  GemmKernel gemm;
+  ZipKernel add;
+  ZipKernel subtract;
+  ZipKernel multiply;
+  BroadcastKernel shift;          /* src + s */
+  BroadcastKernel scale;          /* src * s */
+  BroadcastKernel divide;         /* src / s */
+  BroadcastKernel subtract_from;  /* s - src */
+  BroadcastKernel add_scaled;     /* dst + src * s */
+  MapKernel sqrt;  /* the functions of kMathFunctions, in its order */
+  MapKernel exp;
+  MapKernel log;
+  MapKernel sin;
+  MapKernel cos;
+  MapKernel tan;
+  MapKernel fabs;
+  MapKernel floor;
+  MapKernel ceil;
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! The kernels for the widest instruction set both the processor (asked
+    with CPUID) and the operating system support. $FCAL_SIMD, one of scalar,
+    sse2, avx2 or avx512, lowers the choice, which is made once per run. */
+const SimdKernels &simd_kernels(void);
+
+#endif  // PROJECT_INCLUDE_SIMD_H_
@@ -0,0 +1,334 @@
+/*******************************************************************************
+ * Name            : sparse_matrix.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Matrices in compressed sparse row form, and the products
+ *                   that skip their zeros.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <algorithm>
+#include <utility>
+#include "include/simd.h"
+#include "include/sparse_matrix.h"
+#include "include/thread_pool.h"
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+bool IsSparse(int rows, int cols, size_t nonzeros) {
+  double size = static_cast<double>(rows) * cols;
+  return size > 0 && nonzeros <= kSparseDensity * size;
+}
+
+/*! The grain for parallel_for over rows rows that do work elements of work
+    between them. */
+static int RowGrain(double work, int rows) {
+  if (rows == 0) return 1;
+  return parallel_grain(static_cast<int>(std::min(work / rows, 1e9)));
+}
+
+/*! The first n elements of row = beta times themselves. */
+static void ScaleRow(float *row, int n, float beta) {
+  if (beta == 0) {
+    std::fill_n(row, n, 0.0f);
+  } else if (beta != 1) {
+    simd_kernels().scale(row, row, n, beta);
+  }
+}
+
+/*! c = a b + beta c, for a sparse a and a dense b, or a sparse b in
+    sparse_b. Each row of c is scaled and then has the rows of b that the
+    nonzeros of its row of a pick added to it. When b is sparse too, that
+    is Gustavson's algorithm with the row of c as its accumulator. */
+static void AddRows(const sparse_matrix &a, const matrix_view &b,
+                    const sparse_matrix *sparse_b, float beta,
+                    const matrix_block &c) {
+  const int n = c.n_cols();
+  const BroadcastKernel add_scaled = simd_kernels().add_scaled;
+  double row_work = sparse_b != NULL
+                        ? static_cast<double>(sparse_b->n_nonzeros()) /
+                              std::max(1, sparse_b->n_rows())
+                        : n;
+  parallel_for(0, c.n_rows(), RowGrain(a.n_nonzeros() * row_work, c.n_rows()),
+               [&](int i) {
+    float *row = c.access(i, 0);
+    ScaleRow(row, n, beta);
+    for (size_t p = a.row_start(i); p < a.row_start(i + 1); p++) {
+      const float x = a.value(p);
+      const int k = a.column(p);
+      if (sparse_b == NULL) {
+        add_scaled(row, b.access(k, 0), n, x);
+        continue;
+      }
+      for (size_t q = sparse_b->row_start(k); q < sparse_b->row_start(k + 1);
+           q++) {
+        row[sparse_b->column(q)] += x * sparse_b->value(q);
+      }
+    }
+  });
+}
+
+/*! A transposed factor is transposed first, so that rows of it can be
+    added: a sparse one by sparse_matrix::transpose, which gives it in the
+    other form, and a dense one by matrix_transpose. When only b is sparse,
+    the transpose of c, op(b)^T op(a)^T, is computed instead, with op(b)^T
+    in sparse form, and transposed into c.
+
+    Zeros are skipped, so a product never sees an infinity or a NaN of a
+    dense factor times a zero of a sparse one. */
+void sparse_gemm(const matrix_view &a, bool transpose_a,
+                 const matrix_view &b, bool transpose_b, float beta,
+                 const matrix_block &c) {
+  matrix dense_storage(0, 0);
+  sparse_matrix a_storage(0, 0), b_storage(0, 0);
+  const sparse_matrix *sa = a.sparse();
+  const sparse_matrix *sb = b.sparse();
+
+  if (sa != NULL) {
+    if (transpose_a) {
+      a_storage = sa->transpose();
+      sa = &a_storage;
+    }
+    matrix_view dense_b = b;
+    if (sb != NULL && transpose_b) {
+      b_storage = sb->transpose();
+      sb = &b_storage;
+    } else if (transpose_b) {
+      dense_storage = matrix_transpose(b);
+      dense_b = dense_storage;
+    }
+    AddRows(*sa, dense_b, sb, beta, c);
+    return;
+  }
+
+  if (!transpose_b) {
+    b_storage = sb->transpose();
+    sb = &b_storage;
+  }
+  matrix_view dense_a = a;
+  if (!transpose_a) {
+    dense_storage = matrix_transpose(a);
+    dense_a = dense_storage;
+  }
+  matrix transposed(c.n_cols(), c.n_rows());
+  AddRows(*sb, dense_a, NULL, 0, transposed);
+  if (beta == 0) {
+    matrix_transpose_into(transposed, c);
+    return;
+  }
+  matrix product = matrix_transpose(transposed);
+  const int n = c.n_cols();
+  parallel_for(0, c.n_rows(), parallel_grain(n), [&](int i) {
+    float *row = c.access(i, 0);
+    ScaleRow(row, n, beta);
+    simd_kernels().add(row, row, product.access(i, 0), n);
+  });
+}
+
+/*! The count takes one pass over the nonzeros of a. */
+size_t sparse_multiply_terms(const sparse_matrix &a, const sparse_matrix &b) {
+  size_t terms = 0;
+  for (size_t p = 0; p < a.n_nonzeros(); p++) {
+    int k = a.column(p);
+    terms += b.row_start(k + 1) - b.row_start(k);
+  }
+  return terms;
+}
+
+/*! Gustavson's algorithm, in two passes over the rows: the first counts
+    the columns of each row of the product, marking the columns it has
+    seen, and the second adds the products into a dense accumulator and
+    gathers the columns it marked. Each chunk of rows has its own marks
+    and accumulator. */
+sparse_matrix sparse_multiply(const sparse_matrix &a, const sparse_matrix &b) {
+  if (a.n_cols() != b.n_rows()) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  const int m = a.n_rows();
+  const int n = b.n_cols();
+  sparse_matrix r(m, n);
+  double row_work = static_cast<double>(b.n_nonzeros()) /
+                    std::max(1, b.n_rows()) * a.n_nonzeros();
+  const int grain = RowGrain(row_work, m);
+
+  parallel_for_range(0, m, grain, [&](int begin, int end) {
+    std::vector<int> mark(n, -1);
+    for (int i = begin; i < end; i++) {
+      size_t count = 0;
+      for (size_t p = a.row_start(i); p < a.row_start(i + 1); p++) {
+        int k = a.column(p);
+        for (size_t q = b.row_start(k); q < b.row_start(k + 1); q++) {
+          int j = b.column(q);
+          if (mark[j] != i) {
+            mark[j] = i;
+            count++;
+          }
+        }
+      }
+      r.row_start_[i + 1] = count;
+    }
+  });
+  for (int i = 0; i < m; i++) r.row_start_[i + 1] += r.row_start_[i];
+  r.columns_.resize(r.row_start_[m]);
+  r.values_.resize(r.row_start_[m]);
+
+  parallel_for_range(0, m, grain, [&](int begin, int end) {
+    std::vector<int> mark(n, -1);
+    std::vector<float> sum(n);
+    for (int i = begin; i < end; i++) {
+      int *columns = r.columns_.data() + r.row_start_[i];
+      int *next = columns;
+      for (size_t p = a.row_start(i); p < a.row_start(i + 1); p++) {
+        const float x = a.value(p);
+        const int k = a.column(p);
+        for (size_t q = b.row_start(k); q < b.row_start(k + 1); q++) {
+          int j = b.column(q);
+          if (mark[j] != i) {
+            mark[j] = i;
+            sum[j] = 0;
+            *next++ = j;
+          }
+          sum[j] += x * b.value(q);
+        }
+      }
+      std::sort(columns, next);
+      float *values = r.values_.data() + r.row_start_[i];
+      for (int *j = columns; j < next; j++) *values++ = sum[*j];
+    }
+  });
+  return r;
+}
+
+matrix sparse_vector_multiply(const sparse_matrix &a, const matrix_view &v) {
+  if (v.n_rows() != a.n_cols() || v.n_cols() != 1) {
+    std::cout << "matrices dimensionses not compatible" << std::endl;
+    exit(1);
+  }
+  matrix r(a.n_rows(), 1);
+  parallel_for(0, a.n_rows(),
+               RowGrain(static_cast<double>(a.n_nonzeros()), a.n_rows()),
+               [&](int i) {
+    float sum = 0;
+    for (size_t p = a.row_start(i); p < a.row_start(i + 1); p++) {
+      sum += a.value(p) * v.at(a.column(p), 0);
+    }
+    *r.access(i, 0) = sum;
+  });
+  return r;
+}
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+sparse_matrix::sparse_matrix(int rows, int cols)
+    : rows_(rows), cols_(cols), row_start_(rows + 1, 0) {}
+
+/*! The nonzeros of each row are counted in parallel, which places each
+    row, and then gathered in parallel. */
+sparse_matrix::sparse_matrix(const matrix_view &m)
+    : rows_(m.n_rows()), cols_(m.n_cols()), row_start_(rows_ + 1, 0) {
+  parallel_for(0, rows_, parallel_grain(cols_), [&](int i) {
+    const float *row = m.access(i, 0);
+    size_t count = 0;
+    for (int j = 0; j < cols_; j++) count += row[j] != 0;
+    row_start_[i + 1] = count;
+  });
+  for (int i = 0; i < rows_; i++) row_start_[i + 1] += row_start_[i];
+  columns_.resize(row_start_[rows_]);
+  values_.resize(row_start_[rows_]);
+  parallel_for(0, rows_, parallel_grain(cols_), [&](int i) {
+    const float *row = m.access(i, 0);
+    size_t k = row_start_[i];
+    for (int j = 0; j < cols_; j++) {
+      if (row[j] != 0) {
+        columns_[k] = j;
+        values_[k++] = row[j];
+      }
+    }
+  });
+}
+
+/*! The entries are sorted into rows by counting, and each row by column,
+    keeping entries for the same element in order, so that their sum is
+    the same from run to run. Elements whose entries add to zero are
+    dropped. */
+sparse_matrix::sparse_matrix(int rows, int cols,
+                             const std::vector<sparse_entry> &entries)
+    : rows_(rows), cols_(cols), row_start_(rows + 1, 0) {
+  std::vector<size_t> first(rows + 1, 0);
+  for (size_t e = 0; e < entries.size(); e++) first[entries[e].row + 1]++;
+  for (int i = 0; i < rows; i++) first[i + 1] += first[i];
+  std::vector<std::pair<int, float> > placed(entries.size());
+  std::vector<size_t> next(first.begin(), first.end() - 1);
+  for (size_t e = 0; e < entries.size(); e++) {
+    placed[next[entries[e].row]++] =
+        std::make_pair(entries[e].col, entries[e].value);
+  }
+
+  parallel_for(0, rows, 1, [&](int i) {
+    std::pair<int, float> *begin = placed.data() + first[i];
+    std::pair<int, float> *end = placed.data() + first[i + 1];
+    std::stable_sort(begin, end,
+                     [](const std::pair<int, float> &x,
+                        const std::pair<int, float> &y) {
+                       return x.first < y.first;
+                     });
+    std::pair<int, float> *kept = begin;
+    for (std::pair<int, float> *e = begin; e < end;) {
+      std::pair<int, float> sum = *e++;
+      while (e < end && e->first == sum.first) sum.second += (e++)->second;
+      if (sum.second != 0) *kept++ = sum;
+    }
+    row_start_[i + 1] = kept - begin;
+  });
+  for (int i = 0; i < rows; i++) row_start_[i + 1] += row_start_[i];
+  columns_.resize(row_start_[rows]);
+  values_.resize(row_start_[rows]);
+  for (int i = 0; i < rows; i++) {
+    for (size_t k = row_start_[i]; k < row_start_[i + 1]; k++) {
+      columns_[k] = placed[first[i] + k - row_start_[i]].first;
+      values_[k] = placed[first[i] + k - row_start_[i]].second;
+    }
+  }
+}
+
+/*! A counting sort of the entries by column. Rows are taken in order, so
+    each row of the transpose comes out sorted. */
+sparse_matrix sparse_matrix::transpose(void) const {
+  sparse_matrix t(cols_, rows_);
+  for (size_t k = 0; k < columns_.size(); k++) t.row_start_[columns_[k] + 1]++;
+  for (int j = 0; j < cols_; j++) t.row_start_[j + 1] += t.row_start_[j];
+  t.columns_.resize(columns_.size());
+  t.values_.resize(values_.size());
+  std::vector<size_t> next(t.row_start_.begin(), t.row_start_.end() - 1);
+  for (int i = 0; i < rows_; i++) {
+    for (size_t k = row_start_[i]; k < row_start_[i + 1]; k++) {
+      size_t to = next[columns_[k]]++;
+      t.columns_[to] = i;
+      t.values_[to] = values_[k];
+    }
+  }
+  return t;
+}
+
+matrix sparse_matrix::dense(void) const {
+  matrix m(rows_, cols_);
+  parallel_for(0, rows_, parallel_grain(cols_), [&](int i) {
+    float *row = m.access(i, 0);
+    std::fill_n(row, cols_, 0.0f);
+    for (size_t k = row_start_[i]; k < row_start_[i + 1]; k++) {
+      row[columns_[k]] = values_[k];
+    }
+  });
+  return m;
+}
+
+bool sparse_matrix::is_sparse(void) const {
+  return IsSparse(rows_, cols_, values_.size());
+}
@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Name            : sparse_matrix.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Matrices in compressed sparse row form, and the products
+ *                   that skip their zeros.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_SPARSE_MATRIX_H_
+#define PROJECT_INCLUDE_SPARSE_MATRIX_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "include/Matrix.h"
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! A matrix with at most this fraction of its elements nonzero is sparse:
+    its products skip the zeros, which is faster than multiplying them
+    with the blocked kernels of gemm.h. */
+const double kSparseDensity = 0.05;
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+/*! Element [row:col] of a matrix, with its value. */
+struct sparse_entry {
+  int row;
+  int col;
+  float value;
+};
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! A matrix in compressed sparse row (CSR) form: the nonzero elements of
+    each row, by column, with the column of each. The nonzeros of row i
+    are entries row_start(i) to row_start(i + 1) - 1. The transpose of a
+    matrix in this form is the matrix in compressed sparse column form. */
+class sparse_matrix {
+ public:
+  /*! A rows x cols matrix of zeros. */
+  sparse_matrix(int rows, int cols);
+  /*! The nonzero elements of m. */
+  explicit sparse_matrix(const matrix_view &m);
+  /*! The rows x cols matrix with the given elements, in any order. The
+      values of entries for the same element are added. */
+  sparse_matrix(int rows, int cols, const std::vector<sparse_entry> &entries);
+
+  int n_rows(void) const { return rows_; }
+  int n_cols(void) const { return cols_; }
+  size_t n_nonzeros(void) const { return values_.size(); }
+  size_t row_start(int i) const { return row_start_[i]; }
+  int column(size_t k) const { return columns_[k]; }
+  float value(size_t k) const { return values_[k]; }
+
+  /*! The transpose, which is this matrix in compressed sparse column
+      form. */
+  sparse_matrix transpose(void) const;
+  /*! The elements as a matrix, with the zeros written out. */
+  matrix dense(void) const;
+  /*! Whether so few elements are nonzero that this matrix is better kept
+      in this form: at most kSparseDensity of them. */
+  bool is_sparse(void) const;
+
+  friend sparse_matrix sparse_multiply(const sparse_matrix &a,
+                                       const sparse_matrix &b);
+
+ private:
+  int rows_;
+  int cols_;
+  std::vector<size_t> row_start_;
+  std::vector<int> columns_;
+  std::vector<float> values_;
+};
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Whether a rows x cols matrix with nonzeros nonzero elements is sparse,
+    as sparse_matrix::is_sparse. */
+bool IsSparse(int rows, int cols, size_t nonzeros);
+
+/*! c = op(a) op(b) + beta c, as matrix_gemm, when a or b has a sparse
+    form; matrix_gemm calls this for them. Only the nonzeros of the sparse
+    factors are multiplied. */
+void sparse_gemm(const matrix_view &a, bool transpose_a,
+                 const matrix_view &b, bool transpose_b, float beta,
+                 const matrix_block &c);
+
+/*! The number of products of nonzeros that a b adds up, which bounds
+    the number of nonzeros of a b. */
+size_t sparse_multiply_terms(const sparse_matrix &a, const sparse_matrix &b);
+
+/*! a b, where both are sparse, as a sparse matrix. Worth it over
+    sparse_gemm only when the product is sparse too. */
+sparse_matrix sparse_multiply(const sparse_matrix &a, const sparse_matrix &b);
+
+/*! a v, for a column vector v. */
+matrix sparse_vector_multiply(const sparse_matrix &a, const matrix_view &v);
+
+#endif  // PROJECT_INCLUDE_SPARSE_MATRIX_H_
@@ -0,0 +1,210 @@
+/*******************************************************************************
+ * Name            : thread_pool.cc
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : Implementation of the worker pool and parallel_for
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "include/thread_pool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*******************************************************************************
+ * Global Variables
+ ******************************************************************************/
+/*! The queue of the calling thread: its own for pool workers, the shared
+    queue 0 for every other thread. */
+static thread_local int queue_index = 0;
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+/*! Pins the calling thread to the n-th processor it is allowed to run on,
+    wrapping around when there are fewer. Does nothing where affinity is
+    not supported. */
+static void PinThread(int n) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+  int count = CPU_COUNT(&allowed);
+  if (count == 0) return;
+  n %= count;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed) || n-- > 0) continue;
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+    return;
+  }
+#else
+  (void)n;
+#endif
+}
+
+/*! $FCAL_THREADS, or one thread per hardware thread. */
+static int ConfiguredThreads(void) {
+  const char *threads = getenv("FCAL_THREADS");
+  if (threads && atoi(threads) > 0) return atoi(threads);
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static bool ConfiguredAffinity(void) {
+  const char *affinity = getenv("FCAL_AFFINITY");
+  return affinity && strcmp(affinity, "1") == 0;
+}
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+ThreadPool::ThreadPool(int n_threads, bool pin_threads)
+    : pending_(0), stopping_(false) {
+  for (int i = 0; i < std::max(1, n_threads); i++) {
+    queues_.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+  }
+  if (pin_threads) PinThread(0);
+  for (int i = 1; i < n_threads; i++) {
+    workers_.push_back(
+        std::thread(&ThreadPool::WorkerLoop, this, i, pin_threads));
+  }
+}
+
+ThreadPool::~ThreadPool(void) {
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wakeup_.notify_all();
+  for (unsigned i = 0; i < workers_.size(); i++) workers_[i].join();
+}
+
+ThreadPool &ThreadPool::instance(void) {
+  static ThreadPool pool(ConfiguredThreads(), ConfiguredAffinity());
+  return pool;
+}
+
+void ThreadPool::Submit(const std::function<void(void)> &task) {
+  WorkQueue &queue = *queues_[queue_index];
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+  /* Taking the lock orders the increment before a sleeping worker's check
+     of pending_, so the wakeup cannot be lost. */
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    pending_++;
+  }
+  wakeup_.notify_one();
+}
+
+/*! The newest task of the thread's own queue keeps its data in cache; the
+    oldest task of another queue is the largest piece of work left there. */
+bool ThreadPool::PopTask(int index, std::function<void(void)> *task) {
+  int n = queues_.size();
+  for (int k = 0; k < n; k++) {
+    WorkQueue &queue = *queues_[(index + k) % n];
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+    if (k == 0) {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    pending_--;
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPool::RunPendingTask(void) {
+  std::function<void(void)> task;
+  if (pending_ == 0 || !PopTask(queue_index, &task)) return false;
+  task();
+  return true;
+}
+
+void ThreadPool::WorkerLoop(int index, bool pin) {
+  queue_index = index;
+  if (pin) PinThread(index);
+  while (true) {
+    std::function<void(void)> task;
+    if (PopTask(index, &task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    while (!stopping_ && pending_ == 0) wakeup_.wait(lock);
+    if (stopping_ && pending_ == 0) return;
+  } /* while() */
+} /* ThreadPool::WorkerLoop() */
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+void parallel_for_range(int begin, int end, int grain,
+                        const std::function<void(int, int)> &body) {
+  int n = end - begin;
+  if (n <= 0) return;
+  if (grain < 1) grain = 1;
+  ThreadPool &pool = ThreadPool::instance();
+  if (n <= grain || pool.n_threads() == 1) {
+    body(begin, end);
+    return;
+  }
+
+  /* A few chunks per thread, so that threads finishing early can steal
+     from threads that are slow. */
+  int n_chunks = std::min(4 * pool.n_threads(), (n + grain - 1) / grain);
+  std::atomic<int> remaining(n_chunks - 1);
+  std::mutex done_mutex;
+  std::condition_variable done;
+
+  for (int c = n_chunks - 1; c >= 1; c--) {
+    int lo = begin + static_cast<long long>(n) * c / n_chunks;
+    int hi = begin + static_cast<long long>(n) * (c + 1) / n_chunks;
+    pool.Submit([&, lo, hi]() {
+      body(lo, hi);
+      std::unique_lock<std::mutex> lock(done_mutex);
+      if (--remaining == 0) done.notify_one();
+    });
+  }
+
+  /* The caller runs the first chunk itself, then helps with whatever is
+     queued, its own chunks included, until they are all done. */
+  body(begin, begin + n / n_chunks);
+  while (remaining > 0) {
+    if (pool.RunPendingTask()) continue;
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait_for(lock, std::chrono::milliseconds(1),
+                  [&]() { return remaining == 0; });
+  }
+  /* The last chunk may still be holding the lock to notify. */
+  std::unique_lock<std::mutex> lock(done_mutex);
+} /* parallel_for_range() */
+
+void parallel_for(int begin, int end, int grain,
+                  const std::function<void(int)> &body) {
+  parallel_for_range(begin, end, grain, [&](int lo, int hi) {
+    for (int i = lo; i < hi; i++) body(i);
+  });
+}
+
+int parallel_grain(int work_per_index) {
+  if (work_per_index < 1) work_per_index = 1;
+  return std::max(1, kParallelMinWork / work_per_index);
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * Name            : thread_pool.h
+ * Project         : fcal
+ * Module          : runtime
+ * Description     : A pool of worker threads shared by the generated program
+ *                   and the matrix runtime.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_THREAD_POOL_H_
+#define PROJECT_INCLUDE_THREAD_POOL_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*! Loops doing less work than this (in elements touched) run serially, since
+    waking the workers would cost more than it saves. */
+const int kParallelMinWork = 1 << 15;
+
+/*! Fewest iterations a parallelized FCAL repeat loop needs before it is
+    shared out, for bodies that are straight line code and for bodies with
+    an inner loop, which do far more work per iteration. */
+const int kParallelMinTrips = 4096;
+const int kParallelMinNestedTrips = 2;
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! A fixed set of worker threads that balance load by stealing work.
+    Every worker has its own queue, which it takes tasks from newest first;
+    when it runs out it takes the oldest task from another queue. Threads
+    outside the pool share one more queue.
+
+    The process-wide instance is created the first time it is used, with
+    $FCAL_THREADS threads (counting the thread that waits on a parallel
+    loop) or else one per hardware thread. With $FCAL_AFFINITY set to 1
+    each worker is pinned to its own processor, and the thread that
+    created the pool to the first one. */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int n_threads, bool pin_threads = false);
+  ~ThreadPool(void);
+
+  static ThreadPool &instance(void);
+
+  int n_threads(void) const { return workers_.size() + 1; }
+  /*! Queues task on the calling thread's queue. */
+  void Submit(const std::function<void(void)> &task);
+  /*! Runs one queued task, stolen if need be, on the calling thread.
+      Returns false if every queue was empty. */
+  bool RunPendingTask(void);
+
+ private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void(void)> > tasks;
+  };
+
+  ThreadPool(const ThreadPool &);
+  void WorkerLoop(int index, bool pin);
+  bool PopTask(int index, std::function<void(void)> *task);
+
+  std::vector<std::thread> workers_;
+  std::vector<std::unique_ptr<WorkQueue> > queues_;  // 0: outside threads
+  std::atomic<int> pending_;
+  std::mutex sleep_mutex_;
+  std::condition_variable wakeup_;
+  bool stopping_;
+};
+
+/*! Calls body(i) for every i in [begin, end), splitting the range into
+    contiguous chunks of at least grain indices spread over the pool. The
+    calling thread takes part, running queued tasks while it waits, and
+    returns once every chunk is done. Ranges that fit in one chunk run on
+    the calling thread. Calls made from inside a chunk split their range
+    too; idle threads steal the pieces. */
+void parallel_for(int begin, int end, int grain,
+                  const std::function<void(int)> &body);
+
+/*! Like parallel_for, but calls body(chunk_begin, chunk_end) once per chunk,
+    so the body can keep private state, like a partial sum, for a whole
+    chunk. */
+void parallel_for_range(int begin, int end, int grain,
+                        const std::function<void(int, int)> &body);
+
+/*! The grain to give parallel_for when each index does work_per_index
+    elements of work. */
+int parallel_grain(int work_per_index);
+
+#endif  // PROJECT_INCLUDE_THREAD_POOL_H_
@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * Name            : types.cc
+ * Project         : fcal
+ * Module          : ast
+ * Description     : Implementation of static types and the symbol table
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <sstream>
+#include <string>
+#include "include/types.h"
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace ast {
+
+/*******************************************************************************
+ * Functions
+ ******************************************************************************/
+std::string TypeError(const std::string &msg) { return "Type error: " + msg; }
+
+/*******************************************************************************
+ * Member Functions
+ ******************************************************************************/
+Type Type::Matrix(int rows, int cols) {
+  Type t(kMatrixType);
+  t.rows_ = rows;
+  t.cols_ = cols;
+  return t;
+}
+
+bool Type::operator==(const Type &other) const {
+  return kind_ == other.kind_ && rows_ == other.rows_ && cols_ == other.cols_;
+}
+
+std::string Type::ToString(void) const {
+  switch (kind_) {
+    case kIntType:
+      return "int";
+    case kFloatType:
+      return "float";
+    case kBoolType:
+      return "boolean";
+    case kStringType:
+      return "string";
+    case kMatrixType: {
+      std::ostringstream ss;
+      ss << "matrix[";
+      if (rows_ == kUnknownDim) ss << "?"; else ss << rows_;
+      ss << ":";
+      if (cols_ == kUnknownDim) ss << "?"; else ss << cols_;
+      ss << "]";
+      return ss.str();
+    }
+    default:
+      return "<unchecked>";
+  } /* switch() */
+} /* Type::ToString() */
+
+void SymbolTable::EnterScope(void) {
+  scopes_.push_back(std::map<std::string, Variable>());
+}
+
+void SymbolTable::ExitScope(void) { scopes_.pop_back(); }
+
+void SymbolTable::Declare(const std::string &name, const Type &type,
+                          bool *keeps_shape) {
+  if (scopes_.back().count(name)) {
+    throw TypeError("variable '" + name + "' is already declared");
+  }
+  Variable &var = scopes_.back()[name];
+  var.type = type;
+  var.keeps_shape = keeps_shape;
+  if (keeps_shape != NULL) *keeps_shape = true;
+}
+
+Type SymbolTable::Lookup(const std::string &name) const {
+  for (int i = scopes_.size() - 1; i >= 0; i--) {
+    std::map<std::string, Variable>::const_iterator it =
+        scopes_[i].find(name);
+    if (it != scopes_[i].end()) return it->second.type;
+  }
+  throw TypeError("variable '" + name + "' is not declared");
+}
+
+/*! Checks that a value of the given type may be stored in a variable.
+    Numbers convert freely between int and float. A matrix variable takes on
+    whatever size is assigned to it, so when the new size differs from the
+    one recorded we can no longer promise either and drop the shape. */
+void SymbolTable::Assign(const std::string &name, const Type &type) {
+  for (int i = scopes_.size() - 1; i >= 0; i--) {
+    std::map<std::string, Variable>::iterator it = scopes_[i].find(name);
+    if (it == scopes_[i].end()) continue;
+
+    Type &var = it->second.type;
+    if (var.is_numeric() && type.is_numeric()) return;
+    if (var.kind() != type.kind()) {
+      throw TypeError("cannot assign " + type.ToString() + " to '" + name +
+                      "' of type " + var.ToString());
+    }
+    if (var.is_matrix() && var != type) {
+      Type unknown = Type::Matrix(kUnknownDim, kUnknownDim);
+      if (var != unknown) {
+        var = unknown;
+        changed_ = true;
+      }
+      if (it->second.keeps_shape != NULL) *it->second.keeps_shape = false;
+    }
+    return;
+  }
+  throw TypeError("variable '" + name + "' is not declared");
+} /* SymbolTable::Assign() */
+
+} /* namespace ast */
+} /* namespace fcal */
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Name            : types.h
+ * Project         : fcal
+ * Module          : ast
+ * Description     : Static types and the symbol table used by the type
+ *                   checking pass over the AST.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_TYPES_H_
+#define PROJECT_INCLUDE_TYPES_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace ast {
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*
+ * The kinds of values an FCAL expression can produce. kNoType is the
+ * type of an expression that has not been type checked yet.
+ */
+enum kTypeEnumKind {
+  kNoType,
+  kIntType,
+  kFloatType,
+  kBoolType,
+  kStringType,
+  kMatrixType
+};
+typedef enum kTypeEnumKind TypeKind;
+
+/*! Dimension of a matrix whose size is only known at run time. */
+const int kUnknownDim = -1;
+
+/*! Matrix variables with a known shape of at most this many elements, that
+    keep it for their whole life, are generated as fixed_matrix
+    (fixed_matrix.h): on the stack, with unrolled kernels. */
+const int kFixedMatrixMaxElements = 64;
+
+/*! The single argument functions of math.h that FCAL programs may call. */
+const char *const kMathFunctions[] = {"sqrt", "exp",   "log",  "sin", "cos",
+                                      "tan",  "fabs", "floor", "ceil"};
+const int kNumMathFunctions = sizeof(kMathFunctions) / sizeof(char *);
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! A static type. Matrix types also carry their shape when it is known at
+    compile time, which lets the code generator pick specialized kernels. */
+class Type {
+ public:
+  Type(void) : kind_(kNoType), rows_(kUnknownDim), cols_(kUnknownDim) {}
+  explicit Type(TypeKind kind)
+      : kind_(kind), rows_(kUnknownDim), cols_(kUnknownDim) {}
+  static Type Matrix(int rows, int cols);
+
+  TypeKind kind(void) const { return kind_; }
+  int rows(void) const { return rows_; }
+  int cols(void) const { return cols_; }
+
+  bool is_numeric(void) const {
+    return kind_ == kIntType || kind_ == kFloatType;
+  }
+  bool is_matrix(void) const { return kind_ == kMatrixType; }
+  bool has_shape(void) const {
+    return is_matrix() && rows_ != kUnknownDim && cols_ != kUnknownDim;
+  }
+  /*! Whether a matrix of this type may be a fixed_matrix. */
+  bool fits_fixed(void) const {
+    return has_shape() && rows_ > 0 && cols_ > 0 &&
+           rows_ * cols_ <= kFixedMatrixMaxElements;
+  }
+
+  bool operator==(const Type &other) const;
+  bool operator!=(const Type &other) const { return !(*this == other); }
+  std::string ToString(void) const;
+
+ private:
+  TypeKind kind_;
+  int rows_;
+  int cols_;
+};
+
+/*! Maps variable names to their types. Scopes mirror the blocks that the
+    generated C++ introduces, so a name may be redeclared in an inner scope
+    but not twice in the same one. */
+class SymbolTable {
+ public:
+  SymbolTable(void) : scopes_(1), changed_(false) {}
+
+  void EnterScope(void);
+  void ExitScope(void);
+  /*! Declares name. If keeps_shape is given, *keeps_shape is set, and
+      cleared again when an assignment drops the shape of the matrix. */
+  void Declare(const std::string &name, const Type &type,
+               bool *keeps_shape = NULL);
+  Type Lookup(const std::string &name) const;
+  void Assign(const std::string &name, const Type &type);
+
+  /*! True if an assignment has forgotten the shape of some matrix since the
+      flag was last cleared. Loops use this to re-check their bodies. */
+  bool changed(void) const { return changed_; }
+  void changed(bool changed_in) { changed_ = changed_in; }
+
+ private:
+  struct Variable {
+    Type type;
+    bool *keeps_shape;
+  };
+  std::vector<std::map<std::string, Variable> > scopes_;
+  bool changed_;
+};
+
+std::string TypeError(const std::string &msg);
+
+} /* namespace ast */
+} /* namespace fcal */
+
+#endif  // PROJECT_INCLUDE_TYPES_H_
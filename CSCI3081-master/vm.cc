@@ -0,0 +1,488 @@
+/*******************************************************************************
+ * Name            : vm.cc
+ * Project         : fcal
+ * Module          : vm
+ * Description     : Implementation of the bytecode compiler and interpreter
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <math.h>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "include/Matrix.h"
+#include "include/ast.h"
+#include "include/vm.h"
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace vm {
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/* Implementations of the functions in kMathFunctions, in the same order. */
+static float (*const kMathImpls[])(float) = {sqrtf, expf,  logf,   sinf, cosf,
+                                             tanf,  fabsf, floorf, ceilf};
+
+/* Their elementwise forms from the matrix runtime, in the same order. */
+static matrix (*const kMatrixMathImpls[])(const matrix_view &) = {
+    matrix_sqrt, matrix_exp,  matrix_log,   matrix_sin, matrix_cos,
+    matrix_tan,  matrix_fabs, matrix_floor, matrix_ceil};
+
+#define FCAL_VM_NAME_ENTRY(name) #name,
+static const char *const kOpcodeNames[] = {FCAL_VM_OPCODES(FCAL_VM_NAME_ENTRY)};
+#undef FCAL_VM_NAME_ENTRY
+
+/*******************************************************************************
+ * Compiler
+ ******************************************************************************/
+Compiler::Compiler(void) : program_(), scopes_(1) {
+  for (int b = 0; b < kNumBanks; b++) {
+    next_[b] = 0;
+    floor_[b] = 0;
+    program_.n_registers[b] = 0;
+  }
+}
+
+Program Compiler::Compile(ast::Node *root) {
+  root->Compile(this);
+  Emit(kHalt);
+  return program_;
+}
+
+int Compiler::Emit(Opcode op, int a, int b, int c, int d) {
+  Instr instr = {op, a, b, c, d};
+  program_.code.push_back(instr);
+  return program_.code.size() - 1;
+}
+
+void Compiler::PatchJump(int instr) {
+  Instr &jump = program_.code[instr];
+  if (jump.op == kJump) {
+    jump.a = here();
+  } else {
+    jump.b = here();
+  }
+}
+
+int Compiler::FloatConstant(float value) {
+  program_.floats.push_back(value);
+  return program_.floats.size() - 1;
+}
+
+/*! Takes the lexeme of a string constant, quotes included, and stores the
+    string it denotes. */
+int Compiler::StringConstant(const std::string &lexeme) {
+  std::string value;
+  for (unsigned i = 1; i + 1 < lexeme.size(); i++) {
+    if (lexeme[i] != '\\' || i + 2 >= lexeme.size()) {
+      value += lexeme[i];
+      continue;
+    }
+    switch (lexeme[++i]) {
+      case 'n':
+        value += '\n';
+        break;
+      case 't':
+        value += '\t';
+        break;
+      default:
+        value += lexeme[i];
+    } /* switch() */
+  }
+  program_.strings.push_back(value);
+  return program_.strings.size() - 1;
+} /* Compiler::StringConstant() */
+
+int Compiler::RegisterList(const std::vector<int> &regs) {
+  program_.registers.insert(program_.registers.end(), regs.begin(),
+                            regs.end());
+  return program_.registers.size() - regs.size();
+}
+
+Bank Compiler::BankOf(const ast::Type &type) {
+  if (type.kind() == ast::kStringType) return kStringBank;
+  if (type.kind() == ast::kMatrixType) return kMatrixBank;
+  return kNumberBank;
+}
+
+int Compiler::NewTemp(const ast::Type &type) {
+  Bank bank = BankOf(type);
+  int reg = next_[bank]++;
+  if (next_[bank] > program_.n_registers[bank]) {
+    program_.n_registers[bank] = next_[bank];
+  }
+  return reg;
+}
+
+int Compiler::Convert(int reg, const ast::Type &from, const ast::Type &to) {
+  if (from.kind() == ast::kIntType && to.kind() == ast::kFloatType) {
+    int tmp = NewTemp(to);
+    Emit(kIntToFloat, tmp, reg);
+    return tmp;
+  } else if (from.kind() == ast::kFloatType && to.kind() == ast::kIntType) {
+    int tmp = NewTemp(to);
+    Emit(kFloatToInt, tmp, reg);
+    return tmp;
+  }
+  return reg;
+}
+
+void Compiler::Move(int dst, int src, const ast::Type &type) {
+  if (dst == src) return;
+  switch (BankOf(type)) {
+    case kStringBank:
+      Emit(kMoveString, dst, src);
+      break;
+    case kMatrixBank:
+      Emit(kMoveMatrix, dst, src);
+      break;
+    default:
+      Emit(kMove, dst, src);
+  } /* switch() */
+}
+
+/*! Registers in use when a scope is entered, temporaries included, stay
+    reserved until it is left. */
+void Compiler::EnterScope(void) {
+  Scope scope;
+  for (int b = 0; b < kNumBanks; b++) {
+    scope.saved_next[b] = next_[b];
+    scope.saved_floor[b] = floor_[b];
+    floor_[b] = next_[b];
+  }
+  scopes_.push_back(scope);
+}
+
+void Compiler::ExitScope(void) {
+  for (int b = 0; b < kNumBanks; b++) {
+    next_[b] = scopes_.back().saved_next[b];
+    floor_[b] = scopes_.back().saved_floor[b];
+  }
+  scopes_.pop_back();
+}
+
+int Compiler::DeclareVar(const std::string &name, const ast::Type &type) {
+  int reg = NewTemp(type);
+  floor_[BankOf(type)] = next_[BankOf(type)];
+  Var var = {reg, type};
+  scopes_.back().vars[name] = var;
+  return reg;
+}
+
+int Compiler::LookupVar(const std::string &name, ast::Type *type) const {
+  for (int i = scopes_.size() - 1; i >= 0; i--) {
+    std::map<std::string, Var>::const_iterator it = scopes_[i].vars.find(name);
+    if (it == scopes_[i].vars.end()) continue;
+    if (type) *type = it->second.type;
+    return it->second.reg;
+  }
+  throw std::string("Internal Error: variable " + name + " has no register");
+}
+
+void Compiler::EndStatement(void) {
+  for (int b = 0; b < kNumBanks; b++) next_[b] = floor_[b];
+}
+
+/*******************************************************************************
+ * Interpreter
+ ******************************************************************************/
+union Number {
+  int i;
+  float f;
+};
+
+/*! Owns the matrix registers so they are freed however Run exits. */
+class MatrixBank {
+ public:
+  explicit MatrixBank(int n) : regs_(n > 0 ? n : 1, NULL) {}
+  ~MatrixBank(void) {
+    for (unsigned i = 0; i < regs_.size(); i++) delete regs_[i];
+  }
+  matrix **regs(void) { return &regs_[0]; }
+
+ private:
+  std::vector<matrix *> regs_;
+};
+
+static void Store(matrix **regs, int reg, const matrix &value) {
+  if (regs[reg] == NULL) {
+    regs[reg] = new matrix(value);
+  } else {
+    *regs[reg] = value;
+  }
+}
+
+/*! Results of the matrix kernels are moved into their register. */
+static void Store(matrix **regs, int reg, matrix &&value) {
+  if (regs[reg] == NULL) {
+    regs[reg] = new matrix(std::move(value));
+  } else {
+    *regs[reg] = std::move(value);
+  }
+}
+
+static const matrix &Load(matrix **regs, int reg) {
+  if (regs[reg] == NULL) throw std::string("Run time error: matrix not set");
+  return *regs[reg];
+}
+
+/*! The matrix in reg, after checking that [i:j] is inside it. */
+static matrix &Element(matrix **regs, int reg, int i, int j) {
+  Load(regs, reg);
+  matrix &m = *regs[reg];
+  if (i < 0 || i >= m.n_rows() || j < 0 || j >= m.n_cols()) {
+    std::ostringstream ss;
+    ss << "Run time error: index [" << i << ":" << j << "] out of range";
+    throw ss.str();
+  }
+  return m;
+}
+
+/*! The matrix in reg, after checking that the slice whose bounds are in
+    bounds[0] to bounds[3] is inside it. */
+static matrix &Slice(matrix **regs, int reg, const Number *bounds) {
+  Load(regs, reg);
+  matrix &m = *regs[reg];
+  if (bounds[0].i < 0 || bounds[1].i >= m.n_rows() ||
+      bounds[1].i < bounds[0].i - 1 || bounds[2].i < 0 ||
+      bounds[3].i >= m.n_cols() || bounds[3].i < bounds[2].i - 1) {
+    std::ostringstream ss;
+    ss << "Run time error: slice [" << bounds[0].i << " .. " << bounds[1].i
+       << " : " << bounds[2].i << " .. " << bounds[3].i << "] out of range";
+    throw ss.str();
+  }
+  return m;
+}
+
+/*
+ * Where the compiler allows it, each handler jumps straight to the handler
+ * of the next instruction through a table of label addresses. This gives the
+ * branch predictor one indirect jump per handler to learn from instead of a
+ * single shared one at the top of a switch. Other compilers use the switch.
+ */
+#if defined(__GNUC__)
+#define FCAL_VM_COMPUTED_GOTO
+#endif
+
+#ifdef FCAL_VM_COMPUTED_GOTO
+#define VM_CASE(name) L_##name:
+#define VM_DISPATCH() goto *kDispatch[pc->op]
+#define VM_NEXT() goto *kDispatch[(++pc)->op]
+#define VM_JUMP(target) goto *kDispatch[(pc = code + (target))->op]
+#else
+#define VM_CASE(name) case name:
+#define VM_NEXT() \
+  {               \
+    ++pc;         \
+    continue;     \
+  }
+#define VM_JUMP(target)   \
+  {                       \
+    pc = code + (target); \
+    continue;             \
+  }
+#endif
+#define VM_BINARY(field, result, op) \
+  N[pc->a].result = N[pc->b].field op N[pc->c].field
+
+void Run(const Program &program, std::ostream &out) {
+  std::vector<Number> numbers(program.n_registers[kNumberBank] + 1);
+  std::vector<std::string> strings(program.n_registers[kStringBank] + 1);
+  MatrixBank matrices(program.n_registers[kMatrixBank]);
+  Number *N = &numbers[0];
+  std::string *S = &strings[0];
+  matrix **M = matrices.regs();
+  const Instr *code = &program.code[0];
+  const Instr *pc = code;
+
+#ifdef FCAL_VM_COMPUTED_GOTO
+#define FCAL_VM_LABEL_ENTRY(name) &&L_##name,
+  static void *const kDispatch[] = {FCAL_VM_OPCODES(FCAL_VM_LABEL_ENTRY)};
+#undef FCAL_VM_LABEL_ENTRY
+  VM_DISPATCH();
+#undef VM_DISPATCH
+#else
+  for (;;) switch (pc->op) {
+#endif
+  VM_CASE(kHalt) return;
+  VM_CASE(kLoadInt) N[pc->a].i = pc->b; VM_NEXT();
+  VM_CASE(kLoadFloat) N[pc->a].f = program.floats[pc->b]; VM_NEXT();
+  VM_CASE(kLoadString) S[pc->a] = program.strings[pc->b]; VM_NEXT();
+  VM_CASE(kMove) N[pc->a] = N[pc->b]; VM_NEXT();
+  VM_CASE(kMoveString) S[pc->a] = S[pc->b]; VM_NEXT();
+  VM_CASE(kMoveMatrix) Store(M, pc->a, Load(M, pc->b)); VM_NEXT();
+  VM_CASE(kIntToFloat) N[pc->a].f = N[pc->b].i; VM_NEXT();
+  VM_CASE(kFloatToInt) N[pc->a].i = static_cast<int>(N[pc->b].f); VM_NEXT();
+  VM_CASE(kAddInt) VM_BINARY(i, i, +); VM_NEXT();
+  VM_CASE(kSubInt) VM_BINARY(i, i, -); VM_NEXT();
+  VM_CASE(kMulInt) VM_BINARY(i, i, *); VM_NEXT();
+  VM_CASE(kDivInt)
+    if (N[pc->c].i == 0) throw std::string("Run time error: division by zero");
+    VM_BINARY(i, i, /);
+    VM_NEXT();
+  VM_CASE(kAddFloat) VM_BINARY(f, f, +); VM_NEXT();
+  VM_CASE(kSubFloat) VM_BINARY(f, f, -); VM_NEXT();
+  VM_CASE(kMulFloat) VM_BINARY(f, f, *); VM_NEXT();
+  VM_CASE(kDivFloat) VM_BINARY(f, f, /); VM_NEXT();
+  VM_CASE(kIncInt) N[pc->a].i++; VM_NEXT();
+  VM_CASE(kLtInt) VM_BINARY(i, i, <); VM_NEXT();
+  VM_CASE(kLeInt) VM_BINARY(i, i, <=); VM_NEXT();
+  VM_CASE(kGtInt) VM_BINARY(i, i, >); VM_NEXT();
+  VM_CASE(kGeInt) VM_BINARY(i, i, >=); VM_NEXT();
+  VM_CASE(kEqInt) VM_BINARY(i, i, ==); VM_NEXT();
+  VM_CASE(kNeInt) VM_BINARY(i, i, !=); VM_NEXT();
+  VM_CASE(kLtFloat) VM_BINARY(f, i, <); VM_NEXT();
+  VM_CASE(kLeFloat) VM_BINARY(f, i, <=); VM_NEXT();
+  VM_CASE(kGtFloat) VM_BINARY(f, i, >); VM_NEXT();
+  VM_CASE(kGeFloat) VM_BINARY(f, i, >=); VM_NEXT();
+  VM_CASE(kEqFloat) VM_BINARY(f, i, ==); VM_NEXT();
+  VM_CASE(kNeFloat) VM_BINARY(f, i, !=); VM_NEXT();
+  VM_CASE(kLtString) N[pc->a].i = S[pc->b] < S[pc->c]; VM_NEXT();
+  VM_CASE(kLeString) N[pc->a].i = S[pc->b] <= S[pc->c]; VM_NEXT();
+  VM_CASE(kGtString) N[pc->a].i = S[pc->b] > S[pc->c]; VM_NEXT();
+  VM_CASE(kGeString) N[pc->a].i = S[pc->b] >= S[pc->c]; VM_NEXT();
+  VM_CASE(kEqString) N[pc->a].i = S[pc->b] == S[pc->c]; VM_NEXT();
+  VM_CASE(kNeString) N[pc->a].i = S[pc->b] != S[pc->c]; VM_NEXT();
+  VM_CASE(kConcat) S[pc->a] = S[pc->b] + S[pc->c]; VM_NEXT();
+  VM_CASE(kNot) N[pc->a].i = !N[pc->b].i; VM_NEXT();
+  VM_CASE(kJump) VM_JUMP(pc->a);
+  VM_CASE(kJumpIfFalse)
+    if (!N[pc->a].i) VM_JUMP(pc->b);
+    VM_NEXT();
+  VM_CASE(kJumpIfTrue)
+    if (N[pc->a].i) VM_JUMP(pc->b);
+    VM_NEXT();
+  VM_CASE(kNewMatrix)
+    Store(M, pc->a, matrix(N[pc->b].i, N[pc->c].i));
+    VM_NEXT();
+  VM_CASE(kMatrixGet) {
+    int i = N[pc->c].i;
+    int j = N[pc->d].i;
+    N[pc->a].f = Element(M, pc->b, i, j).at(i, j);
+    VM_NEXT();
+  }
+  VM_CASE(kMatrixSet) {
+    int i = N[pc->b].i;
+    int j = N[pc->c].i;
+    *Element(M, pc->a, i, j).access(i, j) = N[pc->d].f;
+    VM_NEXT();
+  }
+  VM_CASE(kSlice) {
+    const Number *bounds = N + pc->c;
+    Store(M, pc->a, matrix(Slice(M, pc->b, bounds).view(
+                        bounds[0].i, bounds[1].i, bounds[2].i, bounds[3].i)));
+    VM_NEXT();
+  }
+  VM_CASE(kSetSlice) {
+    const Number *bounds = N + pc->b;
+    const matrix &value = Load(M, pc->c);
+    matrix_block block = Slice(M, pc->a, bounds).block(
+        bounds[0].i, bounds[1].i, bounds[2].i, bounds[3].i);
+    if (block.n_rows() != value.n_rows() ||
+        block.n_cols() != value.n_cols()) {
+      throw std::string("Run time error: slice assigned a matrix of another "
+                        "shape");
+    }
+    matrix_copy(value, block);
+    VM_NEXT();
+  }
+  VM_CASE(kNRows) N[pc->a].i = Load(M, pc->b).n_rows(); VM_NEXT();
+  VM_CASE(kNCols) N[pc->a].i = Load(M, pc->b).n_cols(); VM_NEXT();
+  VM_CASE(kMatMul)
+    Store(M, pc->a, matrix_multiply(Load(M, pc->b), Load(M, pc->c)));
+    VM_NEXT();
+  VM_CASE(kMatVecMul)
+    Store(M, pc->a, matrix_vector_multiply(Load(M, pc->b), Load(M, pc->c)));
+    VM_NEXT();
+  VM_CASE(kMatMulAdd)
+    Store(M, pc->a, matrix_multiply_add(Load(M, pc->b), Load(M, pc->c),
+                                        Load(M, pc->d)));
+    VM_NEXT();
+  VM_CASE(kMatChain) {
+    const int *regs = &program.registers[pc->b];
+    std::vector<matrix_view> factors;
+    for (int k = 0; k < pc->c; k++) factors.push_back(Load(M, regs[k]));
+    Store(M, pc->a, matrix_multiply_chain(factors));
+    VM_NEXT();
+  }
+  VM_CASE(kMatAdd)
+    Store(M, pc->a, matrix_add(Load(M, pc->b), Load(M, pc->c)));
+    VM_NEXT();
+  VM_CASE(kMatSub)
+    Store(M, pc->a, matrix_subtract(Load(M, pc->b), Load(M, pc->c)));
+    VM_NEXT();
+  VM_CASE(kMatAddScalar)
+    Store(M, pc->a, matrix_add_scalar(Load(M, pc->b), N[pc->c].f));
+    VM_NEXT();
+  VM_CASE(kMatSubScalar)
+    Store(M, pc->a, matrix_subtract_scalar(Load(M, pc->b), N[pc->c].f));
+    VM_NEXT();
+  VM_CASE(kMatScale)
+    Store(M, pc->a, matrix_scale(Load(M, pc->b), N[pc->c].f));
+    VM_NEXT();
+  VM_CASE(kMatDivScalar)
+    Store(M, pc->a, matrix_divide_scalar(Load(M, pc->b), N[pc->c].f));
+    VM_NEXT();
+  VM_CASE(kMatSubFrom)
+    Store(M, pc->a, matrix_subtract_from(Load(M, pc->b), N[pc->c].f));
+    VM_NEXT();
+  VM_CASE(kTranspose)
+    Store(M, pc->a, matrix_transpose(Load(M, pc->b)));
+    VM_NEXT();
+  VM_CASE(kMatrixRead) {
+    matrix m(0, 0);
+    std::string error;
+    if (!matrix::matrix_load(S[pc->b], &m, &error)) {
+      throw std::string("Run time error: " + error);
+    }
+    Store(M, pc->a, std::move(m));
+    VM_NEXT();
+  }
+  VM_CASE(kMatrixWrite) {
+    std::string error;
+    if (!matrix::matrix_save(Load(M, pc->a), S[pc->b], &error)) {
+      throw std::string("Run time error: " + error);
+    }
+    VM_NEXT();
+  }
+  VM_CASE(kCallMath) N[pc->a].f = kMathImpls[pc->c](N[pc->b].f); VM_NEXT();
+  VM_CASE(kMatMath)
+    Store(M, pc->a, kMatrixMathImpls[pc->c](Load(M, pc->b)));
+    VM_NEXT();
+  VM_CASE(kPrintInt) out << N[pc->a].i; VM_NEXT();
+  VM_CASE(kPrintFloat) out << N[pc->a].f; VM_NEXT();
+  VM_CASE(kPrintString) out << S[pc->a]; VM_NEXT();
+  VM_CASE(kPrintMatrix) out << Load(M, pc->a); VM_NEXT();
+#ifndef FCAL_VM_COMPUTED_GOTO
+    default:
+      throw std::string("Internal Error: bad opcode");
+  } /* switch() */
+#endif
+} /* Run() */
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+#undef VM_BINARY
+
+std::string Disassemble(const Program &program) {
+  std::ostringstream ss;
+  for (unsigned i = 0; i < program.code.size(); i++) {
+    const Instr &instr = program.code[i];
+    ss << i << ": " << kOpcodeNames[instr.op] << " " << instr.a << " "
+       << instr.b << " " << instr.c << " " << instr.d << std::endl;
+  }
+  return ss.str();
+}
+
+} /* namespace vm */
+} /* namespace fcal */
@@ -0,0 +1,217 @@
+/*******************************************************************************
+ * Name            : vm.h
+ * Project         : fcal
+ * Module          : vm
+ * Description     : A register based bytecode for FCAL, the compiler from the
+ *                   AST to it and the interpreter that runs it. Programs run
+ *                   directly, without generating C++ and invoking g++.
+ * Copyright       : 2017 CSCI3081W Staff. All rights reserved.
+ * Original Author : Aadil Naumaan and Sifora Tek-Lab
+ ******************************************************************************/
+
+#ifndef PROJECT_INCLUDE_VM_H_
+#define PROJECT_INCLUDE_VM_H_
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "include/types.h"
+
+/*******************************************************************************
+ * Namespaces
+ ******************************************************************************/
+namespace fcal {
+namespace ast {
+class Node;
+} /* namespace ast */
+namespace vm {
+
+/*******************************************************************************
+ * Constant Definitions
+ ******************************************************************************/
+/*
+ * The instruction set. Operands a, b, c and d are register numbers unless
+ * noted. Registers live in three banks: numbers (ints, floats and booleans,
+ * which are stored as the ints 0 and 1), strings and matrices. The type
+ * checker has already resolved every operand type, so each instruction
+ * works on exactly one type and never inspects tags at run time.
+ *
+ * The list is written once here and expanded into both the opcode enum and
+ * the interpreter's dispatch table so the two cannot drift apart.
+ */
+#define FCAL_VM_OPCODES(X)                                                    \
+  X(kHalt)          /* stop                                                */ \
+  X(kLoadInt)       /* num[a] = b (immediate)                              */ \
+  X(kLoadFloat)     /* num[a] = float constant b                           */ \
+  X(kLoadString)    /* str[a] = string constant b                          */ \
+  X(kMove)          /* num[a] = num[b]                                     */ \
+  X(kMoveString)    /* str[a] = str[b]                                     */ \
+  X(kMoveMatrix)    /* mat[a] = mat[b]                                     */ \
+  X(kIntToFloat)    /* num[a] = (float) num[b]                             */ \
+  X(kFloatToInt)    /* num[a] = (int) num[b]                               */ \
+  X(kAddInt)        /* num[a] = num[b] + num[c], and so on                 */ \
+  X(kSubInt)                                                                  \
+  X(kMulInt)                                                                  \
+  X(kDivInt)                                                                  \
+  X(kAddFloat)                                                                \
+  X(kSubFloat)                                                                \
+  X(kMulFloat)                                                                \
+  X(kDivFloat)                                                                \
+  X(kIncInt)        /* num[a] += 1                                         */ \
+  X(kLtInt)         /* num[a] = num[b] < num[c], and so on                 */ \
+  X(kLeInt)                                                                   \
+  X(kGtInt)                                                                   \
+  X(kGeInt)                                                                   \
+  X(kEqInt)                                                                   \
+  X(kNeInt)                                                                   \
+  X(kLtFloat)                                                                 \
+  X(kLeFloat)                                                                 \
+  X(kGtFloat)                                                                 \
+  X(kGeFloat)                                                                 \
+  X(kEqFloat)                                                                 \
+  X(kNeFloat)                                                                 \
+  X(kLtString)      /* num[a] = str[b] < str[c], and so on                 */ \
+  X(kLeString)                                                                \
+  X(kGtString)                                                                \
+  X(kGeString)                                                                \
+  X(kEqString)                                                                \
+  X(kNeString)                                                                \
+  X(kConcat)        /* str[a] = str[b] + str[c]                            */ \
+  X(kNot)           /* num[a] = !num[b]                                    */ \
+  X(kJump)          /* goto a (instruction index)                          */ \
+  X(kJumpIfFalse)   /* if (!num[a]) goto b                                 */ \
+  X(kJumpIfTrue)    /* if (num[a]) goto b                                  */ \
+  X(kNewMatrix)     /* mat[a] = matrix(num[b], num[c])                     */ \
+  X(kMatrixGet)     /* num[a] = mat[b][num[c]:num[d]]                      */ \
+  X(kMatrixSet)     /* mat[a][num[b]:num[c]] = num[d]                      */ \
+  X(kSlice)         /* mat[a] = mat[b][rows : cols], bounds in num[c..c+3] */ \
+  X(kSetSlice)      /* mat[a][rows : cols] = mat[c], bounds in num[b..b+3] */ \
+  X(kNRows)         /* num[a] = n_rows(mat[b])                             */ \
+  X(kNCols)         /* num[a] = n_cols(mat[b])                             */ \
+  X(kMatMul)        /* mat[a] = matrix_multiply(mat[b], mat[c])            */ \
+  X(kMatVecMul)     /* mat[a] = matrix_vector_multiply(mat[b], mat[c])     */ \
+  X(kMatMulAdd)     /* mat[a] = mat[b] * mat[c] + mat[d], in one product   */ \
+  X(kMatChain)      /* mat[a] = product of the c matrices in the registers */ \
+                    /* listed from registers[b], in the cheapest order     */ \
+  X(kMatAdd)        /* mat[a] = matrix_add(mat[b], mat[c])                 */ \
+  X(kMatSub)        /* mat[a] = matrix_subtract(mat[b], mat[c])            */ \
+  X(kMatAddScalar)  /* mat[a] = matrix_add_scalar(mat[b], num[c])          */ \
+  X(kMatSubScalar)  /* mat[a] = matrix_subtract_scalar(mat[b], num[c])     */ \
+  X(kMatScale)      /* mat[a] = matrix_scale(mat[b], num[c])               */ \
+  X(kMatDivScalar)  /* mat[a] = matrix_divide_scalar(mat[b], num[c])       */ \
+  X(kMatSubFrom)    /* mat[a] = matrix_subtract_from(mat[b], num[c])       */ \
+  X(kTranspose)     /* mat[a] = matrix_transpose(mat[b])                   */ \
+  X(kMatrixRead)    /* mat[a] = matrix::matrix_read(str[b])                */ \
+  X(kMatrixWrite)   /* matrix::matrix_write(mat[a], str[b])                */ \
+  X(kCallMath)      /* num[a] = math function c of num[b]                  */ \
+  X(kMatMath)       /* mat[a] = math function c of each element of mat[b]  */ \
+  X(kPrintInt)      /* print num[a] (booleans print as 0/1, as in C++)     */ \
+  X(kPrintFloat)                                                              \
+  X(kPrintString)                                                             \
+  X(kPrintMatrix)
+
+#define FCAL_VM_ENUM_ENTRY(name) name,
+enum kOpcodeEnumType { FCAL_VM_OPCODES(FCAL_VM_ENUM_ENTRY) kNumOpcodes };
+#undef FCAL_VM_ENUM_ENTRY
+typedef enum kOpcodeEnumType Opcode;
+
+/*! The register banks. */
+enum kBankEnumType { kNumberBank, kStringBank, kMatrixBank, kNumBanks };
+typedef enum kBankEnumType Bank;
+
+/*******************************************************************************
+ * Structure Definitions
+ ******************************************************************************/
+struct Instr {
+  Opcode op;
+  int a;
+  int b;
+  int c;
+  int d;
+};
+
+/*! A compiled program: its code, constant pools and the number of registers
+    it needs in each bank. Instructions with more operands than an Instr
+    holds list their registers in registers. */
+struct Program {
+  std::vector<Instr> code;
+  std::vector<float> floats;
+  std::vector<std::string> strings;
+  std::vector<int> registers;
+  int n_registers[kNumBanks];
+};
+
+/*******************************************************************************
+ * Class Definitions
+ ******************************************************************************/
+/*! Translates a type checked AST into a Program. The AST nodes emit their
+    own code through Node::Compile; this class provides the instruction
+    buffer, register allocation and the variable scopes they need.
+
+    Variables are pinned to a register for the lifetime of their scope.
+    Temporaries are allocated above them and are released after every
+    statement. */
+class Compiler {
+ public:
+  Compiler(void);
+
+  Program Compile(ast::Node *root);
+
+  int Emit(Opcode op, int a = 0, int b = 0, int c = 0, int d = 0);
+  int here(void) const { return program_.code.size(); }
+  /*! Point the jump target of a previously emitted jump at here(). */
+  void PatchJump(int instr);
+
+  int FloatConstant(float value);
+  int StringConstant(const std::string &value);
+  /*! Stores a list of registers, returning the index of its first. */
+  int RegisterList(const std::vector<int> &regs);
+
+  int NewTemp(const ast::Type &type);
+  /*! Returns reg if it already holds a value of type to, or a new temporary
+      holding reg converted from type from. */
+  int Convert(int reg, const ast::Type &from, const ast::Type &to);
+  void Move(int dst, int src, const ast::Type &type);
+
+  void EnterScope(void);
+  void ExitScope(void);
+  int DeclareVar(const std::string &name, const ast::Type &type);
+  /*! Returns the register of a variable, and its type if type is not NULL */
+  int LookupVar(const std::string &name, ast::Type *type) const;
+
+  /*! Release every temporary allocated since the last statement began. */
+  void EndStatement(void);
+
+  static Bank BankOf(const ast::Type &type);
+
+ private:
+  struct Var {
+    int reg;
+    ast::Type type;
+  };
+  struct Scope {
+    std::map<std::string, Var> vars;
+    int saved_next[kNumBanks];
+    int saved_floor[kNumBanks];
+  };
+
+  Program program_;
+  std::vector<Scope> scopes_;
+  int next_[kNumBanks];   // first free register
+  int floor_[kNumBanks];  // first register above the newest variable
+};
+
+/*! Runs a compiled program, writing what it prints to out. Run time errors
+    such as an index out of range are reported by throwing a string. */
+void Run(const Program &program, std::ostream &out);
+
+std::string Disassemble(const Program &program);
+
+} /* namespace vm */
+} /* namespace fcal */
+
+#endif  // PROJECT_INCLUDE_VM_H_